@@ -0,0 +1,227 @@
+#include "bench.h"
+#include "dynarray.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int bench_wad_open(bench_wad_t *wad, const char *path) {
+  wad->fp = fopen(path, "wb");
+  if (wad->fp == NULL) { return 1; }
+
+  dynarray_init(wad->lumps, 0);
+
+  // The header is written last, once the directory offset is known
+  uint8_t header[12] = {0};
+  fwrite(header, sizeof(header), 1, wad->fp);
+  return 0;
+}
+
+void bench_wad_add(bench_wad_t *wad, const char *name, const void *data,
+                   size_t size) {
+  bench_lump_t lump = {.offset = ftell(wad->fp), .size = size};
+  strncpy(lump.name, name, 8);
+  dynarray_push(wad->lumps, lump);
+
+  if (size > 0) { fwrite(data, size, 1, wad->fp); }
+}
+
+void bench_wad_add_bytes(bench_wad_t *wad, const char *name,
+                         bytearray_t *bytes) {
+  bench_wad_add(wad, name, bytes->data, bytes->count);
+  dynarray_free((*bytes));
+}
+
+int bench_wad_close(bench_wad_t *wad) {
+  bytearray_t header;
+  dynarray_init(header, 12);
+  bench_put(&header, "IWAD", 4);
+  bench_put_i32(&header, wad->lumps.count);
+  bench_put_i32(&header, ftell(wad->fp));
+
+  for (size_t i = 0; i < wad->lumps.count; i++) {
+    bench_lump_t *lump = &wad->lumps.data[i];
+    uint8_t       entry[16];
+    memcpy(entry, &lump->offset, 4);
+    memcpy(entry + 4, &lump->size, 4);
+    memcpy(entry + 8, lump->name, 8);
+    fwrite(entry, sizeof(entry), 1, wad->fp);
+  }
+
+  fseek(wad->fp, 0, SEEK_SET);
+  fwrite(header.data, header.count, 1, wad->fp);
+
+  int ret_code = ferror(wad->fp) ? 1 : 0;
+  if (fclose(wad->fp) != 0) { ret_code = 1; }
+  wad->fp = NULL;
+
+  dynarray_free(header);
+  dynarray_free(wad->lumps);
+  return ret_code;
+}
+
+void bench_put(bytearray_t *bytes, const void *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    dynarray_push((*bytes), ((const uint8_t *)data)[i]);
+  }
+}
+
+void bench_put_i16(bytearray_t *bytes, int16_t value) {
+  bench_put(bytes, &value, 2);
+}
+
+void bench_put_i32(bytearray_t *bytes, int32_t value) {
+  bench_put(bytes, &value, 4);
+}
+
+void bench_put_name(bytearray_t *bytes, const char *name) {
+  char padded[8] = {0};
+  strncpy(padded, name, 8);
+  bench_put(bytes, padded, 8);
+}
+
+void bench_put_patch(bytearray_t *bytes, int width, int height,
+                     uint32_t *seed) {
+  bench_put_i16(bytes, width);
+  bench_put_i16(bytes, height);
+  bench_put_i16(bytes, 0);
+  bench_put_i16(bytes, 0);
+
+  // Column offsets are filled in as the columns are written
+  size_t offsets = bytes->count;
+  for (int x = 0; x < width; x++) {
+    bench_put_i32(bytes, 0);
+  }
+
+  for (int x = 0; x < width; x++) {
+    int32_t offset = bytes->count;
+    memcpy(&bytes->data[offsets + x * 4], &offset, 4);
+
+    int top = 0, num_posts = 1 + bench_random(seed) % 3;
+    for (int i = 0; i < num_posts; i++) {
+      top += bench_random(seed) % 9;
+      int length = 1 + bench_random(seed) % (height / 3);
+      if (top + length > height || top > 254) { break; }
+
+      uint8_t post[3] = {top, length, 0};
+      bench_put(bytes, post, 3);
+      for (int y = 0; y < length; y++) {
+        uint8_t index = 1 + bench_random(seed) % 246; // never 247
+        dynarray_push((*bytes), index);
+      }
+      dynarray_push((*bytes), 0);
+      top += length;
+    }
+    dynarray_push((*bytes), 0xff);
+  }
+}
+
+void bench_put_textures(bytearray_t *bytes, const bench_texture_t *textures,
+                        int num) {
+  bench_put_i32(bytes, num);
+
+  int32_t offset = 4 + 4 * num;
+  for (int i = 0; i < num; i++) {
+    bench_put_i32(bytes, offset);
+    offset += 22 + 10 * textures[i].num_patches;
+  }
+
+  for (int i = 0; i < num; i++) {
+    const bench_texture_t *texture = &textures[i];
+    bench_put_name(bytes, texture->name);
+    bench_put_i32(bytes, 0);
+    bench_put_i16(bytes, texture->width);
+    bench_put_i16(bytes, texture->height);
+    bench_put_i32(bytes, 0);
+    bench_put_i16(bytes, texture->num_patches);
+
+    for (int j = 0; j < texture->num_patches; j++) {
+      bench_put_i16(bytes, texture->patches[j].x);
+      bench_put_i16(bytes, texture->patches[j].y);
+      bench_put_i16(bytes, texture->patches[j].index);
+      bench_put_i16(bytes, 0);
+      bench_put_i16(bytes, 0);
+    }
+  }
+}
+
+void bench_add_map(bench_wad_t *wad, const char *mapname, int num_sidedefs,
+                   const char (*names)[9], int num_names, uint32_t *seed) {
+  int         num_linedefs = num_sidedefs / 2;
+  bytearray_t things, linedefs, sidedefs, vertices, sectors;
+  dynarray_init(things, 0);
+  dynarray_init(linedefs, 0);
+  dynarray_init(sidedefs, 0);
+  dynarray_init(vertices, 0);
+  dynarray_init(sectors, 0);
+
+  int16_t player_start[] = {4, 4, 0, 1, 7};
+  bench_put(&things, player_start, sizeof(player_start));
+
+  for (int i = 0; i < num_linedefs; i++) {
+    uint16_t linedef[] = {i, i + 1, 4, 0, 0, 2 * i, 2 * i + 1};
+    bench_put(&linedefs, linedef, sizeof(linedef));
+  }
+
+  for (int i = 0; i < num_linedefs * 2; i++) {
+    bench_put_i16(&sidedefs, 0);
+    bench_put_i16(&sidedefs, 0);
+    for (int j = 0; j < 3; j++) {
+      uint32_t pick = bench_random(seed);
+      bench_put_name(&sidedefs,
+                     pick % 10 == 0 ? "-" : names[pick / 10 % num_names]);
+    }
+    bench_put_i16(&sidedefs, 0);
+  }
+
+  for (int i = 0; i <= num_linedefs; i++) {
+    bench_put_i16(&vertices, i % 1000 * 8);
+    bench_put_i16(&vertices, i / 1000 * 8);
+  }
+
+  int16_t heights[] = {0, 128};
+  bench_put(&sectors, heights, sizeof(heights));
+  bench_put_name(&sectors, "FLOOR0");
+  bench_put_name(&sectors, "FLOOR0");
+  int16_t light_special_tag[] = {160, 0, 0};
+  bench_put(&sectors, light_special_tag, sizeof(light_special_tag));
+
+  bench_wad_add(wad, mapname, NULL, 0);
+  bench_wad_add_bytes(wad, "THINGS", &things);
+  bench_wad_add_bytes(wad, "LINEDEFS", &linedefs);
+  bench_wad_add_bytes(wad, "SIDEDEFS", &sidedefs);
+  bench_wad_add_bytes(wad, "VERTEXES", &vertices);
+  bench_wad_add(wad, "SEGS", NULL, 0);
+  bench_wad_add(wad, "SSECTORS", NULL, 0);
+  bench_wad_add(wad, "NODES", NULL, 0);
+  bench_wad_add_bytes(wad, "SECTORS", &sectors);
+  bench_wad_add(wad, "REJECT", NULL, 0);
+  bench_wad_add(wad, "BLOCKMAP", NULL, 0);
+}
+
+uint32_t bench_random(uint32_t *seed) {
+  // xorshift32
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 17;
+  *seed ^= *seed << 5;
+  return *seed;
+}
+
+double bench_time_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int compare_samples(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+double bench_median(double *samples, int num) {
+  qsort(samples, num, sizeof(double), compare_samples);
+  return samples[num / 2];
+}
@@ -0,0 +1,68 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include "dynarray.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The benchmarks build their input as a WAD file, lump by lump, so that they
+// time the same loader code as the game
+
+typedef dynarray(uint8_t) bytearray_t;
+
+typedef struct bench_lump {
+  char     name[8];
+  uint32_t offset, size;
+} bench_lump_t;
+
+typedef struct bench_wad {
+  FILE *fp;
+  dynarray(bench_lump_t) lumps;
+} bench_wad_t;
+
+int  bench_wad_open(bench_wad_t *wad, const char *path);
+void bench_wad_add(bench_wad_t *wad, const char *name, const void *data,
+                   size_t size);
+void bench_wad_add_bytes(bench_wad_t *wad, const char *name,
+                         bytearray_t *bytes); // frees the bytes
+int  bench_wad_close(bench_wad_t *wad);
+
+void bench_put(bytearray_t *bytes, const void *data, size_t size);
+void bench_put_i16(bytearray_t *bytes, int16_t value);
+void bench_put_i32(bytearray_t *bytes, int32_t value);
+void bench_put_name(bytearray_t *bytes, const char *name);
+
+// A patch of the given size whose columns hold one to three posts at random
+void bench_put_patch(bytearray_t *bytes, int width, int height,
+                     uint32_t *seed);
+
+typedef struct bench_tex_patch {
+  int16_t  x, y;
+  uint16_t index; // into PNAMES
+} bench_tex_patch_t;
+
+typedef struct bench_texture {
+  char              name[9];
+  int16_t           width, height;
+  int               num_patches;
+  bench_tex_patch_t patches[4];
+} bench_texture_t;
+
+void bench_put_textures(bytearray_t *bytes, const bench_texture_t *textures,
+                        int num);
+
+// A map of one sector with a row of two-sided linedefs. Every sidedef gets
+// three texture names picked from the list at random, one in ten of them "-".
+void bench_add_map(bench_wad_t *wad, const char *mapname, int num_sidedefs,
+                   const char (*names)[9], int num_names, uint32_t *seed);
+
+// Deterministic, so every run builds the same WAD
+uint32_t bench_random(uint32_t *seed);
+
+double bench_time_ms();
+// Sorts the samples and returns the middle one
+double bench_median(double *samples, int num);
+
+#endif // !_BENCH_H
@@ -0,0 +1,122 @@
+#include "bench.h"
+#include "wad.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Times compositing every texture of TEXTURE1 and TEXTURE2 for a texture set
+// the size of Doom II's. The checksum of the texels tells whether a change to
+// the compositor changed its output.
+
+#define NUM_TEXTURES1 125
+#define NUM_TEXTURES2 303
+#define NUM_PATCHES   350
+#define NUM_RUNS      21
+
+static int build_wad(const char *path) {
+  bench_wad_t wad;
+  if (bench_wad_open(&wad, path) != 0) { return 1; }
+
+  uint32_t seed = 5;
+
+  bytearray_t bytes;
+  dynarray_init(bytes, 0);
+  bench_put_i32(&bytes, NUM_PATCHES);
+  for (int i = 0; i < NUM_PATCHES; i++) {
+    char name[9];
+    snprintf(name, sizeof(name), "P%05d", i);
+    bench_put_name(&bytes, name);
+  }
+  bench_wad_add_bytes(&wad, "PNAMES", &bytes);
+
+  // One to four patches each, placed anywhere from partly off the left or
+  // top edge to the middle of the texture
+  static const int16_t widths[]  = {64, 128, 128, 256};
+  static const int16_t heights[] = {64, 72, 128, 128};
+  bench_texture_t textures[NUM_TEXTURES1 + NUM_TEXTURES2];
+  for (int i = 0; i < NUM_TEXTURES1 + NUM_TEXTURES2; i++) {
+    bench_texture_t *texture = &textures[i];
+    snprintf(texture->name, sizeof(texture->name), "T%05d", i);
+    texture->width       = widths[bench_random(&seed) % 4];
+    texture->height      = heights[bench_random(&seed) % 4];
+    texture->num_patches = 1 + bench_random(&seed) % 4;
+    for (int j = 0; j < texture->num_patches; j++) {
+      texture->patches[j] = (bench_tex_patch_t){
+          .x     = (int)(bench_random(&seed) % (texture->width + 16)) - 32,
+          .y     = (int)(bench_random(&seed) % (texture->height / 2 + 16)) - 16,
+          .index = bench_random(&seed) % NUM_PATCHES,
+      };
+    }
+  }
+  dynarray_init(bytes, 0);
+  bench_put_textures(&bytes, textures, NUM_TEXTURES1);
+  bench_wad_add_bytes(&wad, "TEXTURE1", &bytes);
+  dynarray_init(bytes, 0);
+  bench_put_textures(&bytes, textures + NUM_TEXTURES1, NUM_TEXTURES2);
+  bench_wad_add_bytes(&wad, "TEXTURE2", &bytes);
+
+  static const int patch_widths[] = {32, 64, 64, 128};
+  bench_wad_add(&wad, "P_START", NULL, 0);
+  for (int i = 0; i < NUM_PATCHES; i++) {
+    char name[9];
+    snprintf(name, sizeof(name), "P%05d", i);
+    dynarray_init(bytes, 0);
+    bench_put_patch(&bytes, patch_widths[bench_random(&seed) % 4], 128,
+                    &seed);
+    bench_wad_add_bytes(&wad, name, &bytes);
+  }
+  bench_wad_add(&wad, "P_END", NULL, 0);
+
+  return bench_wad_close(&wad);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <wad to write>\n", argv[0]);
+    return 1;
+  }
+
+  if (build_wad(argv[1]) != 0) {
+    fprintf(stderr, "Failed to write %s\n", argv[1]);
+    return 1;
+  }
+
+  wad_t wad;
+  if (wad_map_from_file(argv[1], &wad) != 0) { return 1; }
+
+  double   samples[NUM_RUNS];
+  size_t   num = 0, num_texels = 0;
+  uint64_t checksum = 0;
+  for (int i = 0; i < NUM_RUNS; i++) {
+    wall_tex_t *textures = wad_read_textures(&num, &wad);
+
+    double start = bench_time_ms();
+    if (wad_composite_textures(textures, 0, num, NULL, &wad) != 0) {
+      return 1;
+    }
+    samples[i] = bench_time_ms() - start;
+
+    if (i == 0) {
+      // FNV-1a over every texel in order
+      checksum = 14695981039346656037ull;
+      for (size_t j = 0; j < num; j++) {
+        size_t size = (size_t)textures[j].width * textures[j].height;
+        for (size_t k = 0; k < size; k++) {
+          checksum = (checksum ^ textures[j].data[k]) * 1099511628211ull;
+        }
+        num_texels += size;
+      }
+    }
+
+    wad_free_wall_textures(textures, num);
+  }
+
+  printf("Composited %zu textures (%.1f MB of texels), checksum %016llx\n",
+         num, num_texels / (1024.0 * 1024.0), (unsigned long long)checksum);
+  printf("wad_composite_textures: %8.2f ms\n",
+         bench_median(samples, NUM_RUNS));
+
+  wad_free(&wad);
+  return 0;
+}
@@ -0,0 +1,146 @@
+#include "bench.h"
+#include "name_table.h"
+#include "util.h"
+#include "wad.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Times reading a map with 50k sidedefs whose texture names are spread over
+// the whole texture directory, and resolving those names through the name
+// table against the linear scan that read_sidedefs used to do for each one
+
+#define NUM_SIDEDEFS  50000
+#define NUM_RUNS      11
+#define NUM_SCAN_RUNS 5 // the linear scan takes seconds at -O0
+
+static int build_wad(const char *path, int num_textures) {
+  bench_wad_t wad;
+  if (bench_wad_open(&wad, path) != 0) { return 1; }
+
+  uint32_t seed = 1;
+
+  bytearray_t bytes;
+  dynarray_init(bytes, 0);
+  bench_put_i32(&bytes, 1);
+  bench_put_name(&bytes, "PATCH0");
+  bench_wad_add_bytes(&wad, "PNAMES", &bytes);
+
+  char(*names)[9]           = malloc(sizeof(*names) * num_textures);
+  bench_texture_t *textures = malloc(sizeof(bench_texture_t) * num_textures);
+  for (int i = 0; i < num_textures; i++) {
+    snprintf(names[i], sizeof(names[i]), "TEX%05d", i);
+    textures[i] = (bench_texture_t){
+        .width       = 64,
+        .height      = 128,
+        .num_patches = 1,
+        .patches     = {{0, 0, 0}},
+    };
+    snprintf(textures[i].name, sizeof(textures[i].name), "%s", names[i]);
+  }
+  dynarray_init(bytes, 0);
+  bench_put_textures(&bytes, textures, num_textures);
+  bench_wad_add_bytes(&wad, "TEXTURE1", &bytes);
+
+  bench_add_map(&wad, "E1M1", NUM_SIDEDEFS, (const char (*)[9])names,
+                num_textures, &seed);
+
+  bench_wad_add(&wad, "P_START", NULL, 0);
+  dynarray_init(bytes, 0);
+  bench_put_patch(&bytes, 64, 128, &seed);
+  bench_wad_add_bytes(&wad, "PATCH0", &bytes);
+  bench_wad_add(&wad, "P_END", NULL, 0);
+
+  free(names);
+  free(textures);
+  return bench_wad_close(&wad);
+}
+
+static int linear_find(const char *name, const wall_tex_t *textures,
+                       size_t num) {
+  for (size_t i = 0; i < num; i++) {
+    if (strncmp_nocase(name, textures[i].name, 8) == 0) { return i; }
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <wad to write> [textures]\n", argv[0]);
+    return 1;
+  }
+
+  int num_textures = argc > 2 ? atoi(argv[2]) : 500;
+  if (num_textures < 1 || build_wad(argv[1], num_textures) != 0) {
+    fprintf(stderr, "Failed to write %s\n", argv[1]);
+    return 1;
+  }
+
+  wad_t wad;
+  if (wad_map_from_file(argv[1], &wad) != 0) { return 1; }
+
+  size_t       num;
+  wall_tex_t  *textures = wad_read_textures(&num, &wad);
+  name_table_t tex_names;
+  wad_index_textures(&tex_names, textures, num);
+
+  double samples[NUM_RUNS];
+  for (int i = 0; i < NUM_RUNS; i++) {
+    map_t  map;
+    double start = bench_time_ms();
+    if (wad_read_map("E1M1", &map, &wad, &tex_names) != 0) { return 1; }
+    samples[i] = bench_time_ms() - start;
+    wad_free_map(&map);
+  }
+  printf("%d sidedefs over %zu wall textures\n", NUM_SIDEDEFS, num);
+  printf("wad_read_map:     %8.2f ms\n", bench_median(samples, NUM_RUNS));
+
+  // The names exactly as the sidedefs hold them
+  const lump_t *sidedefs  = &wad.lumps[wad_find_lump("SIDEDEFS", &wad)];
+  size_t        num_names = sidedefs->size / 30 * 3;
+  char(*names)[9]         = calloc(num_names, sizeof(*names));
+  for (size_t i = 0; i < num_names; i++) {
+    memcpy(names[i], sidedefs->data + i / 3 * 30 + 4 + i % 3 * 8, 8);
+  }
+
+  int   *linear_found = malloc(sizeof(int) * num_names);
+  int   *hashed_found = malloc(sizeof(int) * num_names);
+  double linear[NUM_SCAN_RUNS], hashed[NUM_SCAN_RUNS];
+  for (int i = 0; i < NUM_SCAN_RUNS; i++) {
+    double start = bench_time_ms();
+    for (size_t j = 0; j < num_names; j++) {
+      linear_found[j] = linear_find(names[j], textures, num);
+    }
+    linear[i] = bench_time_ms() - start;
+
+    start = bench_time_ms();
+    for (size_t j = 0; j < num_names; j++) {
+      hashed_found[j] = wad_find_texture(names[j], &tex_names);
+    }
+    hashed[i] = bench_time_ms() - start;
+  }
+  printf("Resolving %zu names:\n", num_names);
+  printf("  linear scan:    %8.2f ms\n", bench_median(linear, NUM_SCAN_RUNS));
+  printf("  name table:     %8.2f ms\n", bench_median(hashed, NUM_SCAN_RUNS));
+
+  size_t mismatches = 0;
+  for (size_t j = 0; j < num_names; j++) {
+    if (linear_found[j] != hashed_found[j]) { mismatches++; }
+  }
+
+  free(linear_found);
+  free(hashed_found);
+  free(names);
+  name_table_free(&tex_names);
+  wad_free_wall_textures(textures, num);
+  wad_free(&wad);
+
+  if (mismatches > 0) {
+    fprintf(stderr,
+            "The name table and the linear scan disagree on %zu names\n",
+            mismatches);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,229 @@
+#include "bench.h"
+#include "gl_map.h"
+#include "jobs.h"
+#include "map.h"
+#include "name_table.h"
+#include "nodebuild.h"
+#include "wad.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Times nodebuild_build on a grid of square cells, each with a solid pillar
+// in the middle, once lined up with the axes (E1M1) and once rotated (E1M2).
+// At the default of 80x80 cells each grid has about 128k segs once built, and
+// 113x113 is the most that 16-bit vertex indices allow. Every map is built on
+// the main thread alone (-j 0) and then on the pool.
+
+#define CELL_SIZE   128
+#define PILLAR_SIZE 32
+#define NUM_CELLS   80
+#define MAX_CELLS   113
+#define NUM_RUNS    5
+
+static void add_grid(bench_wad_t *wad, const char *mapname, int num_cells,
+                     float angle) {
+  bytearray_t things, linedefs, sidedefs, vertices, sectors;
+  dynarray_init(things, 0);
+  dynarray_init(linedefs, 0);
+  dynarray_init(sidedefs, 0);
+  dynarray_init(vertices, 0);
+  dynarray_init(sectors, 0);
+
+  int16_t player_start[] = {CELL_SIZE / 8, CELL_SIZE / 8, 90, 1, 7};
+  bench_put(&things, player_start, sizeof(player_start));
+
+  // The cell corners come first, then the four pillar corners of each cell
+  float c = cosf(angle), s = sinf(angle);
+  int   num_corners = (num_cells + 1) * (num_cells + 1);
+  for (int i = 0; i < num_corners + num_cells * num_cells * 4; i++) {
+    float x, y;
+    if (i < num_corners) {
+      x = i % (num_cells + 1) * CELL_SIZE;
+      y = i / (num_cells + 1) * CELL_SIZE;
+    } else {
+      int cell = (i - num_corners) / 4, corner = (i - num_corners) % 4;
+      x = cell % num_cells * CELL_SIZE + CELL_SIZE / 2 +
+          (corner == 2 || corner == 3 ? PILLAR_SIZE : -PILLAR_SIZE);
+      y = cell / num_cells * CELL_SIZE + CELL_SIZE / 2 +
+          (corner == 1 || corner == 2 ? PILLAR_SIZE : -PILLAR_SIZE);
+    }
+    bench_put_i16(&vertices, lroundf(x * c - y * s));
+    bench_put_i16(&vertices, lroundf(x * s + y * c));
+  }
+
+  // Neighbouring cells differ in floor height, so the lines between them
+  // are two-sided with a lower wall
+  for (int i = 0; i < num_cells * num_cells; i++) {
+    int16_t heights[] = {(i % num_cells + i / num_cells) % 2 ? 16 : 0, 128};
+    bench_put(&sectors, heights, sizeof(heights));
+    bench_put_name(&sectors, "FLOOR0");
+    bench_put_name(&sectors, "FLOOR0");
+    int16_t light_special_tag[] = {160, 0, 0};
+    bench_put(&sectors, light_special_tag, sizeof(light_special_tag));
+  }
+
+  int num_sidedefs = 0;
+  for (int y = 0; y < num_cells; y++) {
+    for (int x = 0; x < num_cells; x++) {
+      int      sector = y * num_cells + x;
+      uint16_t v      = y * (num_cells + 1) + x;
+
+      // Bottom and left edges, and the top and right edges of the border.
+      // Each side faces into its cell.
+      struct {
+        uint16_t v1, v2;
+        int      back;
+        bool     is_edge;
+      } edges[] = {
+          {v + 1, v, sector - num_cells, y == 0},
+          {v, v + num_cells + 1, sector - 1, x == 0},
+          {v + num_cells + 1, v + num_cells + 2, -1, y == num_cells - 1},
+          {v + num_cells + 2, v + 1, -1, x == num_cells - 1},
+      };
+      for (int i = 0; i < 4; i++) {
+        if (i >= 2 && !edges[i].is_edge) { continue; }
+
+        bool     is_two_sided = !edges[i].is_edge;
+        uint16_t flags        = is_two_sided ? 4 : 1;
+        uint16_t back_side    = is_two_sided ? num_sidedefs + 1 : 0xffff;
+        uint16_t linedef[]    = {edges[i].v1,  edges[i].v2, flags, 0, 0,
+                                 num_sidedefs, back_side};
+        bench_put(&linedefs, linedef, sizeof(linedef));
+
+        int sides[] = {sector, edges[i].back};
+        for (int j = 0; j < (is_two_sided ? 2 : 1); j++) {
+          bench_put_i32(&sidedefs, 0);
+          bench_put_name(&sidedefs, "-");
+          bench_put_name(&sidedefs, is_two_sided ? "WALL" : "-");
+          bench_put_name(&sidedefs, is_two_sided ? "-" : "WALL");
+          bench_put_i16(&sidedefs, sides[j]);
+          num_sidedefs++;
+        }
+      }
+
+      // The pillar's walls face out, into the cell
+      uint16_t p = num_corners + sector * 4;
+      for (int i = 0; i < 4; i++) {
+        uint16_t linedef[] = {p + (4 - i) % 4, p + (3 - i), 1, 0, 0,
+                              num_sidedefs,    0xffff};
+        bench_put(&linedefs, linedef, sizeof(linedef));
+
+        bench_put_i32(&sidedefs, 0);
+        bench_put_name(&sidedefs, "-");
+        bench_put_name(&sidedefs, "-");
+        bench_put_name(&sidedefs, "WALL");
+        bench_put_i16(&sidedefs, sector);
+        num_sidedefs++;
+      }
+    }
+  }
+
+  bench_wad_add(wad, mapname, NULL, 0);
+  bench_wad_add_bytes(wad, "THINGS", &things);
+  bench_wad_add_bytes(wad, "LINEDEFS", &linedefs);
+  bench_wad_add_bytes(wad, "SIDEDEFS", &sidedefs);
+  bench_wad_add_bytes(wad, "VERTEXES", &vertices);
+  bench_wad_add(wad, "SEGS", NULL, 0);
+  bench_wad_add(wad, "SSECTORS", NULL, 0);
+  bench_wad_add(wad, "NODES", NULL, 0);
+  bench_wad_add_bytes(wad, "SECTORS", &sectors);
+  bench_wad_add(wad, "REJECT", NULL, 0);
+  bench_wad_add(wad, "BLOCKMAP", NULL, 0);
+}
+
+static int build_wad(const char *path, int num_cells) {
+  bench_wad_t wad;
+  if (bench_wad_open(&wad, path) != 0) { return 1; }
+
+  uint32_t seed = 1;
+
+  bytearray_t bytes;
+  dynarray_init(bytes, 0);
+  bench_put_i32(&bytes, 1);
+  bench_put_name(&bytes, "PATCH0");
+  bench_wad_add_bytes(&wad, "PNAMES", &bytes);
+
+  bench_texture_t texture = {"WALL", 64, 128, 1, {{0, 0, 0}}};
+  dynarray_init(bytes, 0);
+  bench_put_textures(&bytes, &texture, 1);
+  bench_wad_add_bytes(&wad, "TEXTURE1", &bytes);
+
+  add_grid(&wad, "E1M1", num_cells, 0.f);
+  add_grid(&wad, "E1M2", num_cells, M_PI / 6.f);
+
+  bench_wad_add(&wad, "P_START", NULL, 0);
+  dynarray_init(bytes, 0);
+  bench_put_patch(&bytes, 64, 128, &seed);
+  bench_wad_add_bytes(&wad, "PATCH0", &bytes);
+  bench_wad_add(&wad, "P_END", NULL, 0);
+
+  return bench_wad_close(&wad);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <wad to write> [cells per side] [threads]\n",
+            argv[0]);
+    return 1;
+  }
+
+  int num_cells   = argc > 2 ? atoi(argv[2]) : NUM_CELLS;
+  int num_threads = argc > 3 ? atoi(argv[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cells < 1 || num_cells > MAX_CELLS ||
+      build_wad(argv[1], num_cells) != 0) {
+    fprintf(stderr, "Failed to write %s\n", argv[1]);
+    return 1;
+  }
+
+  wad_t wad;
+  if (wad_map_from_file(argv[1], &wad) != 0) { return 1; }
+
+  size_t       num;
+  wall_tex_t  *textures = wad_read_textures(&num, &wad);
+  name_table_t tex_names;
+  wad_index_textures(&tex_names, textures, num);
+
+  printf("%dx%d cells, %d runs each\n", num_cells, num_cells, NUM_RUNS);
+  const char *mapnames[] = {"E1M1", "E1M2"};
+  for (int i = 0; i < 2; i++) {
+    map_t map;
+    if (wad_read_map(mapnames[i], &map, &wad, &tex_names) != 0) { return 1; }
+
+    int thread_counts[] = {0, num_threads};
+    for (int j = 0; j < 2; j++) {
+      jobs_init(thread_counts[j]);
+
+      double   samples[NUM_RUNS];
+      gl_map_t gl_map;
+      for (int k = 0; k < NUM_RUNS; k++) {
+        double start = bench_time_ms();
+        if (nodebuild_build(&map, &gl_map) != 0) {
+          fprintf(stderr, "Failed to build nodes for %s\n", mapnames[i]);
+          return 1;
+        }
+        samples[k] = bench_time_ms() - start;
+
+        if (k < NUM_RUNS - 1) { wad_free_gl_map(&gl_map); }
+      }
+      printf("%s%s, %zu linedefs -> %zu segs, %zu subsectors, -j %d: %8.2f "
+             "ms\n",
+             mapnames[i], i == 0 ? " (axis-aligned)" : " (rotated)",
+             map.num_linedefs, gl_map.num_segments, gl_map.num_subsectors,
+             thread_counts[j], bench_median(samples, NUM_RUNS));
+
+      wad_free_gl_map(&gl_map);
+      jobs_shutdown();
+    }
+
+    wad_free_map(&map);
+  }
+
+  name_table_free(&tex_names);
+  wad_free_wall_textures(textures, num);
+  wad_free(&wad);
+  return 0;
+}
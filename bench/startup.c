@@ -0,0 +1,192 @@
+#include "bench.h"
+#include "name_table.h"
+#include "util.h"
+#include "wad.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Compares startup from a large WAD loaded by copy (wad_load_from_file) and
+// mapped (wad_map_from_file). Most of the WAD is filler standing in for the
+// sounds, music and graphics that startup never reads. Each load runs in a
+// process of its own, so that the peak RSS is its alone, and then reads what
+// engine_load reads for a map.
+
+#define NUM_TEXTURES 100
+#define NUM_PATCHES  40
+#define NUM_FLATS    50
+#define NUM_SIDEDEFS 2000
+#define FILLER_SIZE  65536
+#define NUM_RUNS     11
+
+typedef struct sample {
+  double ms;
+  long   base_rss_kb, max_rss_kb;
+} sample_t;
+
+static int build_wad(const char *path, int filler_mb) {
+  bench_wad_t wad;
+  if (bench_wad_open(&wad, path) != 0) { return 1; }
+
+  uint32_t seed = 1;
+
+  uint8_t *buffer = calloc(1, FILLER_SIZE);
+  bench_wad_add(&wad, "PLAYPAL", buffer, 768 * 14);
+
+  bytearray_t bytes;
+  dynarray_init(bytes, 0);
+  bench_put_i32(&bytes, NUM_PATCHES);
+  for (int i = 0; i < NUM_PATCHES; i++) {
+    char name[9];
+    snprintf(name, sizeof(name), "PATCH%d", i);
+    bench_put_name(&bytes, name);
+  }
+  bench_wad_add_bytes(&wad, "PNAMES", &bytes);
+
+  char(*names)[9] = malloc(sizeof(*names) * NUM_TEXTURES);
+  bench_texture_t textures[NUM_TEXTURES];
+  for (int i = 0; i < NUM_TEXTURES; i++) {
+    snprintf(names[i], sizeof(names[i]), "TEX%d", i);
+    textures[i] = (bench_texture_t){
+        .width       = 128,
+        .height      = 128,
+        .num_patches = 2,
+        .patches     = {{0, 0, i % NUM_PATCHES},
+                        {64, 0, (i + 1) % NUM_PATCHES}},
+    };
+    snprintf(textures[i].name, sizeof(textures[i].name), "%s", names[i]);
+  }
+  dynarray_init(bytes, 0);
+  bench_put_textures(&bytes, textures, NUM_TEXTURES);
+  bench_wad_add_bytes(&wad, "TEXTURE1", &bytes);
+
+  bench_add_map(&wad, "E1M1", NUM_SIDEDEFS, (const char(*)[9])names,
+                NUM_TEXTURES, &seed);
+
+  bench_wad_add(&wad, "P_START", NULL, 0);
+  for (int i = 0; i < NUM_PATCHES; i++) {
+    char name[9];
+    snprintf(name, sizeof(name), "PATCH%d", i);
+    dynarray_init(bytes, 0);
+    bench_put_patch(&bytes, 64, 128, &seed);
+    bench_wad_add_bytes(&wad, name, &bytes);
+  }
+  bench_wad_add(&wad, "P_END", NULL, 0);
+
+  bench_wad_add(&wad, "F_START", NULL, 0);
+  bench_wad_add(&wad, "FLOOR0", buffer, 4096);
+  for (int i = 1; i < NUM_FLATS; i++) {
+    char name[9];
+    snprintf(name, sizeof(name), "FLAT%d", i);
+    bench_wad_add(&wad, name, buffer, 4096);
+  }
+  bench_wad_add(&wad, "F_END", NULL, 0);
+
+  for (int i = 0; i < FILLER_SIZE; i++) {
+    buffer[i] = bench_random(&seed);
+  }
+  for (int i = 0; i < filler_mb * (1 << 20) / FILLER_SIZE; i++) {
+    char name[9];
+    snprintf(name, sizeof(name), "DS%06d", i);
+    bench_wad_add(&wad, name, buffer, FILLER_SIZE);
+  }
+
+  free(buffer);
+  free(names);
+  return bench_wad_close(&wad);
+}
+
+static int load(const char *path, bool mapped) {
+  wad_t wad;
+  int   ret_code = mapped ? wad_map_from_file(path, &wad)
+                          : wad_load_from_file(path, &wad);
+  if (ret_code != 0) { return ret_code; }
+
+  size_t       num_palettes, num_flats, num_textures;
+  palette_t   *palettes = wad_read_playpal(&num_palettes, &wad);
+  flat_tex_t  *flats    = wad_read_flats(&num_flats, &wad);
+  wall_tex_t  *textures = wad_read_textures(&num_textures, &wad);
+  name_table_t tex_names;
+  wad_index_textures(&tex_names, textures, num_textures);
+  wad_composite_textures(textures, 0, num_textures, NULL, &wad);
+
+  map_t map;
+  ret_code = wad_read_map("E1M1", &map, &wad, &tex_names);
+  if (ret_code == 0) { wad_free_map(&map); }
+
+  name_table_free(&tex_names);
+  wad_free_wall_textures(textures, num_textures);
+  free(flats);
+  free(palettes);
+  wad_free(&wad);
+  return ret_code;
+}
+
+static int run(const char *path, bool mapped, sample_t *sample) {
+  int fds[2];
+  if (pipe(fds) != 0) { return 1; }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    sample_t child = {.base_rss_kb = usage.ru_maxrss};
+
+    double start = bench_time_ms();
+    child.ms     = load(path, mapped) == 0 ? bench_time_ms() - start : -1.0;
+
+    getrusage(RUSAGE_SELF, &usage);
+    child.max_rss_kb = usage.ru_maxrss;
+    write(fds[1], &child, sizeof(child));
+    _exit(0);
+  }
+
+  close(fds[1]);
+  ssize_t size = pid > 0 ? read(fds[0], sample, sizeof(*sample)) : 0;
+  close(fds[0]);
+  if (pid > 0) { waitpid(pid, NULL, 0); }
+
+  return size == sizeof(*sample) && sample->ms >= 0.0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <wad to write> [filler MB]\n", argv[0]);
+    return 1;
+  }
+
+  int filler_mb = argc > 2 ? atoi(argv[2]) : 100;
+  if (filler_mb < 0 || build_wad(argv[1], filler_mb) != 0) {
+    fprintf(stderr, "Failed to write %s\n", argv[1]);
+    return 1;
+  }
+
+  // The WAD was just written, so its pages are in the page cache for both
+  printf("WAD with %d MB of filler, %d runs each\n", filler_mb, NUM_RUNS);
+  const char *loaders[] = {"wad_load_from_file", "wad_map_from_file"};
+  for (int mapped = 0; mapped < 2; mapped++) {
+    double samples[NUM_RUNS];
+    long   base_rss_kb = 0, max_rss_kb = 0;
+    for (int i = 0; i < NUM_RUNS; i++) {
+      sample_t sample;
+      if (run(argv[1], mapped, &sample) != 0) {
+        fprintf(stderr, "Failed to load %s\n", argv[1]);
+        return 1;
+      }
+      samples[i]  = sample.ms;
+      base_rss_kb = sample.base_rss_kb;
+      max_rss_kb  = max(max_rss_kb, sample.max_rss_kb);
+    }
+    printf("%-18s %8.2f ms %8.1f MB peak RSS (%.1f MB before loading)\n",
+           loaders[mapped], bench_median(samples, NUM_RUNS),
+           max_rss_kb / 1024.0, base_rss_kb / 1024.0);
+  }
+
+  return 0;
+}
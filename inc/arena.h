@@ -0,0 +1,23 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+// Hands out memory from large blocks, for data that is all freed together.
+// Nothing is freed on its own, and it is not safe to use from more than one
+// thread at a time. Zero-initialize it.
+typedef struct arena_block arena_block_t;
+
+typedef struct arena {
+  arena_block_t *blocks; // the newest first
+  size_t         used;   // of the newest block
+} arena_t;
+
+// Zeroed and aligned for any type
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_copy(arena_t *arena, const void *data, size_t size);
+
+// Frees every block, after which the arena can be used again
+void arena_free(arena_t *arena);
+
+#endif // !_ARENA_H
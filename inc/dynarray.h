@@ -15,26 +15,23 @@
     array.count     = 0;                                                       \
     array.capacity  = init_cap;                                                \
     array.elem_size = sizeof(array.__dummy);                                   \
+    array.data      = NULL;                                                    \
     if (init_cap > 0) { array.data = malloc(array.elem_size * init_cap); }     \
   } while (0)
 
 #define dynarray_free(array)                                                   \
   do {                                                                         \
+    free(array.data);                                                          \
+    array.data     = NULL;                                                     \
     array.count    = 0;                                                        \
     array.capacity = 0;                                                        \
-    if (array.capacity > 0) { free(array.data); }                              \
   } while (0)
 
 #define dynarray_push(array, value)                                            \
   do {                                                                         \
     if (array.count >= array.capacity) {                                       \
-      if (array.capacity < 8) {                                                \
-        array.capacity = 8;                                                    \
-        array.data     = malloc(array.elem_size * array.capacity);             \
-      } else {                                                                 \
-        array.capacity *= 2;                                                   \
-        array.data = realloc(array.data, array.elem_size * array.capacity);    \
-      }                                                                        \
+      array.capacity = array.capacity < 8 ? 8 : array.capacity * 2;            \
+      array.data     = realloc(array.data, array.elem_size * array.capacity);  \
     }                                                                          \
     array.data[array.count++] = (value);                                       \
   } while (0)
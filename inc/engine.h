@@ -3,7 +3,26 @@
 
 #include "wad.h"
 
-void engine_init(wad_t *wad, const char *mapname);
+#include <stdbool.h>
+
+// Starts decoding the map's assets on the job pool; engine_init waits for
+// them and uploads the results, so a GL context is only needed by then.
+// With a cache directory, decoded assets and level meshes are read from and
+// written to a cache file there. engine_init returns non-zero when the map
+// could not be read; engine_unload still frees what was read of it.
+void engine_load(const wad_t *wad, const char *mapname, const char *cache_dir);
+int  engine_init();
+
+// Frees the level that was loaded, on the CPU and in GL, so that another can
+// be loaded in its place
+void engine_unload();
+
+// Culls in a compute shader instead of walking the draw tree on the CPU, if
+// the context has OpenGL 4.3. Needs to be set before engine_init.
+void engine_use_gpu_culling(bool enabled);
+
+// Prints how long culling took per frame on average
+void engine_print_cull_timing();
 void engine_update(float dt);
 void engine_render();
 
@@ -1,23 +1,19 @@
 #ifndef _ANIM_H
 #define _ANIM_H
 
-#include "mesh.h"
-#include <stddef.h>
-
 #define TEX_ANIM_TIME (8.f / 35.f)
 
-typedef struct tex_anim {
-  mesh_t *mesh;
-  size_t  vertex_index_start, vertex_index_end;
-  int     min_tex, max_tex;
-  float   time;
+// Animated textures are resolved by the shader through a frame table for flats
+// and one for wall textures, indexed by the texture a surface was given. Only
+// the tables change as the animations play, so the level mesh stays static.
 
-  struct tex_anim *next; // used as a linked link
-} flat_anim_t;
+// Sets every texture to its first frame. The frame tables belong to the level
+// and are freed by anim_free.
+void anim_init();
+void anim_free();
 
+// Moves every animation on by one frame each TEX_ANIM_TIME, all in step as in
+// the original
 void update_animation(float dt);
 
-void add_tex_anim(mesh_t *mesh, size_t vertex_index_start,
-                  size_t vertex_index_end, int min_tex, int max_tex);
-
 #endif // !_ANIM_H
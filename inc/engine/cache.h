@@ -0,0 +1,44 @@
+#ifndef _ENGINE_CACHE_H
+#define _ENGINE_CACHE_H
+
+#include "flat_texture.h"
+#include "mesh.h"
+#include "palette.h"
+#include "wad.h"
+#include "wall_texture.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The asset cache holds what engine_init would otherwise decode and build for
+// one map: palettes, flats, composited wall textures, the level meshes with
+// their draw tree, and the PVS. Its name carries a hash of the lumps those
+// come from, so editing any of them simply misses the cache.
+
+uint64_t cache_hash_inputs(const wad_t *wad, const char *mapname);
+
+// Maps the cache file at the path and checks it against the hash, and its wall
+// textures against the sizes in the WAD's texture directory
+bool cache_open(const char *path, uint64_t hash, const wall_tex_t *textures,
+                size_t num_textures);
+void cache_close();
+
+// Pointers returned by these stay valid until cache_close
+const palette_t  *cache_get_palettes(size_t *num);
+const flat_tex_t *cache_get_flats(size_t *num);
+const uint8_t    *cache_get_wall_texture(int index);
+
+// Recreates the level mesh, draw tree and PVS from the cache
+void cache_restore_level();
+
+// generate_meshes hands the level mesh to the recorder, so the level can be
+// written out once it is built
+void cache_begin_record();
+void cache_record_level(size_t num_vertices, const vertex_t *vertices,
+                        size_t num_indices, const uint32_t *indices);
+
+int cache_write(const char *path, uint64_t hash, const palette_t *palettes,
+                const flat_tex_t *flats, const wall_tex_t *textures);
+
+#endif // !_ENGINE_CACHE_H
@@ -1,6 +1,11 @@
 #ifndef _ENGINE_MESHGEN_H
 #define _ENGINE_MESHGEN_H
 
+// Builds the level geometry and draw tree from the map and its GL nodes. It
+// needs no GL context, so it runs as a job that splits the leaves into more.
 void generate_meshes();
 
+// Uploads the level geometry on the GL thread, once generate_meshes is done
+void upload_meshes();
+
 #endif // !_ENGINE_MESHGEN_H
@@ -1,46 +1,86 @@
 #ifndef _STATE_H
 #define _STATE_H
 
+#include "arena.h"
 #include "gl_map.h"
 #include "map.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "pvs.h"
 
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Leaves draw a range of the level mesh, which holds the whole level, for the
+// subsector they were made from, and list the merged walls their segs are part
+// of. Every node has the world space bounds of what its subtree draws, and
+// nodes with children keep their partition line, in map space, to find the
+// near child.
 typedef struct draw_node {
-  mesh_t           *mesh;
+  uint32_t          first_index, num_indices;
+  uint32_t          first_wall, num_walls; // into leaf_walls
+  uint32_t          subsector; // MAP_NO_INDEX for nodes with children
+  vec3_t            min, max;
+  vec2_t            partition, delta_partition;
   struct draw_node *front, *back;
 } draw_node_t;
 
-typedef struct stencil_node {
-  mat4_t               transformation;
-  struct stencil_node *next;
-} stencil_node_t;
+#define DRAW_NODE_EMPTY                                                        \
+  ((draw_node_t){                                                              \
+      .subsector = MAP_NO_INDEX,                                               \
+      .min       = {INFINITY, INFINITY, INFINITY},                             \
+      .max       = {-INFINITY, -INFINITY, -INFINITY},                          \
+  })
 
-typedef struct stencil_quad_list {
-  stencil_node_t *head, *tail;
-} stencil_list_t;
+// Segs of one sidedef that meet across subsectors are drawn as one wall, once
+// a frame when any of the leaves that list it is drawn
+typedef struct merged_wall {
+  uint32_t first_index, num_indices;
+  vec3_t   min, max;
+} merged_wall_t;
 
 typedef struct wall_tex_info {
   int width, height;
 } wall_tex_info_t;
 
+// The first and last frames of an animation, by name and then by index into
+// the flats or the wall textures
 typedef struct tex_anim_def {
   const char *end_name, *start_name;
+  bool        is_wall;
   int         start, end;
 } tex_anim_def_t;
 
+// Holds what the level allocates piecemeal, from the draw tree to the texture
+// sizes, until engine_unload frees it. While the load jobs run, only the one
+// that builds the level geometry uses it.
+extern arena_t level_arena;
+
 extern size_t           num_flats, num_wall_textures, num_palettes;
 extern wall_tex_info_t *wall_textures_info;
-extern vec2_t          *wall_max_coords;
+
+// Only the wall textures the map uses are uploaded, each to a layer of its own;
+// wall_max_coords is indexed by layer
+extern size_t   num_wall_layers;
+extern int32_t *wall_layers; // layer of every wall texture
+extern vec2_t  *wall_max_coords;
 
 extern map_t    map;
 extern gl_map_t gl_map;
+extern pvs_t    pvs; // empty when the map has none
 extern float    player_height;
 extern float    max_sector_height;
-extern int      sky_flat;
+extern int      sky_flat;    // INT_MIN when the WAD has no F_SKY1
+extern int      sky_texture; // -1 when the WAD has no SKY1
 
+extern mesh_t         level_mesh;
 extern draw_node_t   *root_draw_node;
-extern stencil_list_t stencil_list;
+extern merged_wall_t *merged_walls;
+extern size_t         num_merged_walls;
+extern uint32_t      *leaf_walls;
+extern size_t         num_leaf_walls;
+extern GLuint         palette_texture, flat_texture_array, wall_texture_array;
 
 extern tex_anim_def_t tex_anim_defs[];
 extern size_t         num_tex_anim_defs;
@@ -5,7 +5,9 @@
 #include "matrix.h"
 #include "vector.h"
 
-void      insert_stencil_quad(mat4_t transformation);
+#include <stdint.h>
+
+uint32_t  map_get_subsector(vec2_t position); // MAP_NO_INDEX outside the tree
 sector_t *map_get_sector(vec2_t position);
 
 #endif
@@ -0,0 +1,22 @@
+#ifndef _FRUSTUM_H
+#define _FRUSTUM_H
+
+#include "matrix.h"
+#include "vector.h"
+
+#include <stdbool.h>
+
+// Planes face inwards, so a point p is inside all of them when
+// dot(plane.xyz, p) + plane.w >= 0
+typedef struct frustum {
+  vec4_t planes[6];
+} frustum_t;
+
+// Takes the planes from a view * projection matrix
+frustum_t frustum_from_matrix(mat4_t m);
+
+// Returns false only for boxes that are entirely outside. An empty box, with
+// min above max, is always outside.
+bool frustum_test_box(const frustum_t *frustum, vec3_t min, vec3_t max);
+
+#endif // !_FRUSTUM_H
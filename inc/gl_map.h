@@ -4,22 +4,28 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "map.h"
 #include "vector.h"
 
-#define VERT_IS_GL (1 << 15)
+// Every node format is widened to these 32-bit flags when it is read. Vertex
+// ids with VERT_IS_GL set index the GL vertices instead of the map's, and
+// child ids with CHILD_IS_SUBSECTOR set index the subsectors.
+#define VERT_IS_GL         (1u << 31)
+#define CHILD_IS_SUBSECTOR (1u << 31)
 
 typedef struct gl_subsector {
-  uint16_t num_segs;
-  uint16_t first_seg;
+  uint32_t num_segs;
+  uint32_t first_seg;
 } gl_subsector_t;
 
 typedef struct gl_segment {
-  uint16_t start_vertex, end_vertex;
-  uint16_t linedef, side;
+  uint32_t start_vertex, end_vertex;
+  uint32_t linedef; // MAP_NO_INDEX for minisegs
+  uint16_t side;
 } gl_segment_t;
 
 typedef struct gl_node {
-  uint16_t front_child_id, back_child_id;
+  uint32_t front_child_id, back_child_id;
   vec2_t   partition, delta_partition;
   int16_t  front_bbox[4], back_bbox[4];
 } gl_node_t;
@@ -0,0 +1,38 @@
+#ifndef _GPU_CULL_H
+#define _GPU_CULL_H
+
+#include "frustum.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "vector.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A subsector's bounds and index range as the compute shader reads them, laid
+// out for std430
+typedef struct gpu_cull_leaf {
+  vec4_t   min, max; // w is unused
+  uint32_t first_index, num_indices;
+  uint32_t padding[2];
+} gpu_cull_leaf_t;
+
+// Compute shaders, storage buffers and indirect draws need OpenGL 4.3
+bool gpu_cull_is_supported();
+
+// Uploads the leaves, which stay on the GPU from then on
+void gpu_cull_init(size_t num_leaves, const gpu_cull_leaf_t *leaves);
+void gpu_cull_free();
+
+// Culls and draws the leaves in two passes. The first draws what was visible
+// last frame, if it is still in the frustum, and a depth pyramid is built from
+// the result. The second tests the rest against the frustum and the pyramid
+// and draws what passes. The CPU only issues the dispatches and the draws.
+void gpu_cull_draw(const mesh_t *mesh, mat4_t view_projection,
+                   const frustum_t *frustum);
+
+// Average GPU time of the culling work per frame so far, from timer queries
+double gpu_cull_average_ms();
+
+#endif // !_GPU_CULL_H
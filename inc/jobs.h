@@ -0,0 +1,29 @@
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <stddef.h>
+
+typedef void (*job_fn_t)(void *arg);
+
+// Counts the unfinished jobs of a group, so that a job can wait for the jobs
+// it submitted without waiting for the whole pool. Zero-initialize it.
+typedef struct jobs_group {
+  size_t pending;
+} jobs_group_t;
+
+// Starts the worker threads. With zero workers every job runs on the thread
+// that calls jobs_wait.
+void jobs_init(int num_threads);
+void jobs_shutdown();
+
+int jobs_num_threads();
+
+// Jobs may submit further jobs; jobs_wait returns once all of them are done
+void jobs_submit(job_fn_t fn, void *arg);
+void jobs_wait();
+
+// Like jobs_wait, the caller runs queued jobs until the group is done
+void jobs_submit_group(job_fn_t fn, void *arg, jobs_group_t *group);
+void jobs_wait_group(jobs_group_t *group);
+
+#endif // !_JOBS_H
@@ -10,6 +10,9 @@
 #define LINEDEF_FLAGS_UPPER_UNPEGGED 0x0008
 #define LINEDEF_FLAGS_LOWER_UNPEGGED 0x0010
 
+// Marks a missing sidedef or linedef
+#define MAP_NO_INDEX 0xffffffffu
+
 enum thing_types {
   THING_P1_START = 1,
 };
@@ -31,13 +34,13 @@ typedef struct sector {
 typedef struct sidedef {
   int16_t  x_off, y_off;
   int      upper, lower, middle;
-  uint16_t sector_idx;
+  uint32_t sector_idx;
 } sidedef_t;
 
 typedef struct linedef {
-  uint16_t start_idx, end_idx;
+  uint32_t start_idx, end_idx;
   uint16_t flags;
-  uint16_t front_sidedef, back_sidedef;
+  uint32_t front_sidedef, back_sidedef;
 } linedef_t;
 
 typedef struct thing {
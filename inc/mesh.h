@@ -9,28 +9,44 @@
 #include "dynarray.h"
 #include "vector.h"
 
+// Indices are uploaded as 16 bits when every vertex can be reached with them
 typedef struct mesh {
   GLuint vao, vbo, ebo;
   size_t num_indices;
+  GLenum index_type;
+  size_t index_size;
 } mesh_t;
 
+// Level vertices are packed into 20 bytes. Texture coordinates are in texels,
+// in steps of 1 / VERTEX_COORD_SCALE up to VERTEX_COORD_MAX either way, and
+// the texture index keeps the texture type in its top bits. The shader looks
+// up how big wall textures are.
+#define VERTEX_COORD_SCALE 4
+#define VERTEX_COORD_MAX   (INT16_MAX / VERTEX_COORD_SCALE)
+#define VERTEX_TYPE_SHIFT  14
+#define VERTEX_NO_TEXTURE  ((1 << VERTEX_TYPE_SHIFT) - 1)
+
 typedef struct vertex {
-  vec3_t position;
-  vec2_t tex_coords;
-  int    texture_index;
-  int    texture_type;
-  float  light;
-  vec2_t max_coords;
+  vec3_t   position;
+  int16_t  tex_coords[2];
+  uint16_t texture;
+  uint8_t  light; // the sector's light level
+  uint8_t  padding;
 } vertex_t;
 
+// Texture index -1 is no texture, which the shader discards
+vertex_t vertex_pack(vec3_t position, vec2_t tex_coords, int texture_index,
+                     int texture_type, int light);
+
 typedef enum vertex_layout {
   VERTEX_LAYOUT_PLAIN,
-  VERTEX_LAYOUT_FULL,
+  VERTEX_LAYOUT_PACKED,
 } vertex_layout_t;
 
 void mesh_create(mesh_t *mesh, vertex_layout_t vertex_layout,
                  size_t num_vertices, const void *vertices, size_t num_indices,
-                 const uint32_t *indices, bool is_dynamic);
+                 const uint32_t *indices);
+void mesh_free(mesh_t *mesh);
 
 typedef dynarray(vertex_t) vertexarray_t;
 typedef dynarray(uint32_t) indexarray_t;
@@ -0,0 +1,36 @@
+#ifndef _MESH_OPTIMIZE_H
+#define _MESH_OPTIMIZE_H
+
+#include "mesh.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The size of the post-transform cache the triangles are ordered for, and
+// measured against
+#define MESH_CACHE_SIZE 32
+
+// A range of indices that is drawn on its own, so its triangles only ever move
+// within it
+typedef struct index_range {
+  uint32_t first, count;
+} index_range_t;
+
+typedef struct mesh_stats {
+  size_t num_vertices;
+  float  acmr; // vertices transformed per triangle
+} mesh_stats_t;
+
+// Merges identical vertices, reorders the triangles of every range for the
+// post-transform cache with Tom Forsyth's linear-speed algorithm, and then
+// renumbers the vertices in the order the indices first use them. What every
+// range draws does not change.
+void mesh_optimize(vertexarray_t *vertices, indexarray_t *indices,
+                   const index_range_t *ranges, size_t num_ranges);
+
+// Vertex count and average cache miss ratio, with a FIFO cache of
+// MESH_CACHE_SIZE vertices as most hardware has
+mesh_stats_t mesh_measure(size_t num_vertices, const uint32_t *indices,
+                          size_t num_indices);
+
+#endif // !_MESH_OPTIMIZE_H
@@ -0,0 +1,26 @@
+#ifndef _NAME_TABLE_H
+#define _NAME_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Lump, texture and flat names are at most 8 characters and case-insensitive,
+// so they are packed upper-cased into a single integer and compared as one.
+typedef uint64_t name_key_t;
+
+typedef struct name_table {
+  name_key_t *keys;
+  int        *values; // -1 marks an empty slot
+  size_t      size;   // always a power of two
+} name_table_t;
+
+name_key_t name_to_key(const char *name);
+
+void name_table_init(name_table_t *table, size_t num_names);
+void name_table_free(name_table_t *table);
+
+// Returns the value previously stored under the key, or -1 if there was none
+int name_table_insert(name_table_t *table, name_key_t key, int value);
+int name_table_find(const name_table_t *table, name_key_t key);
+
+#endif // !_NAME_TABLE_H
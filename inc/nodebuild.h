@@ -0,0 +1,12 @@
+#ifndef _NODEBUILD_H
+#define _NODEBUILD_H
+
+#include "gl_map.h"
+#include "map.h"
+
+// Builds GL nodes for a map that comes without them: the BSP tree with its
+// bounding boxes, convex subsectors closed with minisegs, and the GL vertices
+// that splitting adds. Partition candidates are scored on the job pool.
+int nodebuild_build(const map_t *map, gl_map_t *gl_map);
+
+#endif // !_NODEBUILD_H
@@ -0,0 +1,35 @@
+#ifndef _OCCLUSION_H
+#define _OCCLUSION_H
+
+#include "vector.h"
+
+#include <stdbool.h>
+
+// Columns around the eye, like the fine angles of the original renderer
+#define OCCLUSION_COLUMNS 8192
+
+// A one dimensional coverage buffer in the style of the original renderer's
+// solid segs and clip lists, filled while walking the BSP front to back. Every
+// column is a direction around the eye, in map space, and keeps the window of
+// vertical slopes that sight can still pass through in that direction. As the
+// columns do not depend on the view direction, pitch does not matter.
+typedef struct occlusion {
+  vec3_t eye;
+  int    num_closed;
+  float  bottom[OCCLUSION_COLUMNS], top[OCCLUSION_COLUMNS];
+} occlusion_t;
+
+// Opens every column for a new frame
+void occlusion_begin(occlusion_t *occlusion, vec3_t eye);
+
+// Narrows the columns a wall spans, from start to end in map space, to the
+// opening between bottom and top. A wall that has no opening, with bottom at
+// or above top, closes them. Walls seen from behind are left out.
+void occlusion_add_wall(occlusion_t *occlusion, vec2_t start, vec2_t end,
+                        float bottom, float top);
+
+// Returns false only for boxes, in world space, that every column they span
+// hides
+bool occlusion_test_box(const occlusion_t *occlusion, vec3_t min, vec3_t max);
+
+#endif // !_OCCLUSION_H
@@ -0,0 +1,31 @@
+#ifndef _PVS_H
+#define _PVS_H
+
+#include "gl_map.h"
+#include "map.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The potentially visible set: for every subsector, a bit per subsector that
+// may be seen from anywhere inside it. Rows are stored with runs of zero
+// bytes packed into a zero and a count.
+typedef struct pvs {
+  size_t    num_subsectors, size;
+  uint32_t *offsets; // where each row starts in data, plus the end
+  uint8_t  *data;
+} pvs_t;
+
+// Finds the portals between subsectors and flows through them on the job
+// pool. One-sided walls are the only thing that blocks sight.
+int pvs_build(const map_t *map, const gl_map_t *gl_map, pvs_t *pvs);
+
+// Unpacks a row into (num_subsectors + 7) / 8 bytes
+void pvs_get_row(const pvs_t *pvs, uint32_t subsector, uint8_t *row);
+
+// The fraction of the map the rows leave out, averaged over all subsectors
+float pvs_culled_fraction(const pvs_t *pvs);
+
+void pvs_free(pvs_t *pvs);
+
+#endif // !_PVS_H
@@ -9,18 +9,56 @@ void renderer_init(int width, int height);
 void renderer_clear();
 
 void renderer_set_palette_texture(GLuint palette_texture);
-void renderer_set_palette_index(int index);
 void renderer_set_wall_texture(GLuint texture);
 void renderer_set_flat_texture(GLuint texture);
-void renderer_set_sky_texture(GLuint texture);
+
+// The frame that each flat and wall texture shows, indexed by the texture a
+// vertex was given. Called whenever the animations move on.
+void renderer_set_texture_frames(const int32_t *flat_frames, size_t num_flats,
+                                 const int32_t *wall_frames,
+                                 size_t         num_wall_textures);
+
+// How much of the texture array's layers each wall texture takes up
+void renderer_set_wall_max_coords(const vec2_t *max_coords,
+                                  size_t        num_wall_textures);
+
+// Camera, palette and time are shared by every shader through one uniform
+// buffer, written once per frame by the first flush after they changed
 void renderer_set_projection(mat4_t projection);
 void renderer_set_view(mat4_t view);
+void renderer_set_palette_index(int index);
+void renderer_set_time(float time);
 
 vec2_t renderer_get_size();
 
-enum { SHADER_DEFAULT, SHADER_SKY, SHADER_PLAIN, NUM_SHADERS };
+enum { SHADER_DEFAULT, NUM_SHADERS };
 
+// Draws are recorded and only issued by renderer_flush, sorted by program and
+// vertex array. Binds and uniforms that would not change anything are left
+// out. Whatever a recorded draw points to has to stay valid until the flush.
 void renderer_draw_mesh(const mesh_t *mesh, int shader, mat4_t transformation);
-void renderer_draw_sky();
+
+// Draws several index ranges of a mesh in one call. Offsets are in bytes.
+void renderer_draw_ranges(const mesh_t *mesh, int shader, mat4_t transformation,
+                          const GLsizei *counts, const void *const *offsets,
+                          size_t num_ranges);
+
+// Draws up to max_draws commands from the bound draw indirect buffer, starting
+// offset bytes in. With a count offset other than -1, the number of draws is
+// read from the bound parameter buffer there.
+void renderer_draw_indirect(const mesh_t *mesh, int shader,
+                            mat4_t transformation, GLintptr offset,
+                            GLsizei max_draws, GLintptr count_offset);
+
+void renderer_flush();
+
+// Binds a program, such as a compute shader, so that the renderer knows what
+// is bound
+void renderer_use_program(GLuint program);
+
+// GL state changes the renderer made since the frame was cleared
+size_t renderer_num_state_changes();
+// Draw calls issued since the frame was cleared. A multi-draw counts as one.
+size_t renderer_num_draw_calls();
 
 #endif // !_RENDERER_H
@@ -1,46 +1,93 @@
 #ifndef _WAD_H
 #define _WAD_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "flat_texture.h"
 #include "gl_map.h"
 #include "map.h"
+#include "name_table.h"
 #include "palette.h"
-#include "patch.h"
 #include "wall_texture.h"
 
+#include <stddef.h>
+
 typedef struct lump {
-  char    *name;
-  uint8_t *data;
-  uint32_t size;
+  char           name[9];
+  const uint8_t *data;
+  uint32_t       size;
 } lump_t;
 
+typedef enum wad_namespace {
+  WAD_NS_FLATS,
+  WAD_NS_PATCHES,
+  WAD_NS_SPRITES,
+  NUM_WAD_NAMESPACES,
+} wad_namespace_t;
+
+typedef struct wad_range {
+  int start, end; // indices of the start and end marker lumps
+} wad_range_t;
+
+typedef struct wad_file {
+  uint8_t *mapping;
+  size_t   size;
+} wad_file_t;
+
 typedef struct wad {
   char    *id;
   uint32_t num_lumps;
 
   lump_t *lumps;
+
+  // Index over the lump names. It maps a name to the last lump with that name,
+  // and lump_prev chains back to the earlier lumps it overrides (including
+  // those of earlier files in a stack).
+  name_table_t lump_names;
+  int         *lump_prev;
+
+  wad_range_t namespaces[NUM_WAD_NAMESPACES];
+
+  // The memory-mapped files the directory was merged from. Every lump's data
+  // is a view into one of them instead of its own allocation, so its bytes
+  // are only read in when the lump is first used. Empty when loaded by copy.
+  wad_file_t *files;
+  int         num_files;
 } wad_t;
 
 int  wad_load_from_file(const char *filename, wad_t *wad);
+int  wad_map_from_file(const char *filename, wad_t *wad);
 void wad_free(wad_t *wad);
 
+// Maps a stack of files (an IWAD followed by PWADs) into one merged directory.
+// Later files override lumps of earlier ones by name, and the flat, patch and
+// sprite namespaces of every file are merged into a single range each.
+int wad_map_stack(const char **filenames, int num_files, wad_t *wad);
+
 int wad_find_lump(const char *lumpname, const wad_t *wad);
-int wad_read_gl_map(const char *gl_mapname, gl_map_t *map, const wad_t *wad);
+int wad_find_lump_in_namespace(const char *lumpname, wad_namespace_t ns,
+                               const wad_t *wad);
+// Reads the GL nodes of a map, either ZDoom's extended nodes from its SSECTORS
+// lump or glBSP's (v2, v3 or v5) from the GL_ lumps that follow it
+int wad_read_gl_map(const char *mapname, gl_map_t *map, const wad_t *wad);
 int wad_read_map(const char *mapname, map_t *map, const wad_t *wad,
-                 const wall_tex_t *tex, int num_tex);
+                 const name_table_t *tex_names);
 
-int wad_read_patch(patch_t *patch, const char *patch_name, const wad_t *wad);
 palette_t  *wad_read_playpal(size_t *num, const wad_t *wad);
 flat_tex_t *wad_read_flats(size_t *num, const wad_t *wad);
-patch_t    *wad_read_patches(size_t *num, const wad_t *wad);
-wall_tex_t *wad_read_textures(size_t *num, const char *lumpname,
-                              const wad_t *wad);
+// Texture directories list TEXTURE1 followed by TEXTURE2 (when present)
+wall_tex_t *wad_read_textures(size_t *num, const wad_t *wad);
+// Indexes the textures by name. A name that is listed twice finds the first
+// texture with it, which is the one sidedefs get too.
+void wad_index_textures(name_table_t *tex_names, const wall_tex_t *textures,
+                        size_t num);
+int  wad_find_texture(const char *name, const name_table_t *tex_names);
+int wad_composite_textures(wall_tex_t *textures, size_t start, size_t end,
+                           const bool *used, const wad_t *wad);
 
 void wad_free_map(map_t *map);
 void wad_free_gl_map(gl_map_t *map);
-void wad_free_patches(patch_t *patches, size_t num);
 void wad_free_wall_textures(wall_tex_t *textures, size_t num);
 
 #endif // !_WAD_H
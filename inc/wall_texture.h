@@ -13,10 +13,12 @@ typedef struct wall_tex {
   uint8_t *data;
 } wall_tex_t;
 
+// Uploads the textures that have data into consecutive layers. layers gets the
+// layer of every texture, and max_coords and num_layers describe the layers.
 GLuint generate_wall_texture_array(const wall_tex_t *textures,
                                    size_t            num_textures,
-                                   vec2_t           *max_coords_array);
-
-GLuint generate_texture_cubemap(const wall_tex_t *texture);
+                                   int32_t          *layers,
+                                   vec2_t           *max_coords_array,
+                                   size_t           *num_layers);
 
 #endif // !_WALL_TEXTURE_H
@@ -0,0 +1,49 @@
+#include "arena.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT  16
+
+struct arena_block {
+  arena_block_t *next;
+  size_t         size;
+  _Alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
+
+void *arena_alloc(arena_t *arena, size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+  // Allocations larger than a block get a block of their own
+  arena_block_t *block = arena->blocks;
+  if (block == NULL || arena->used + size > block->size) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block             = malloc(sizeof(arena_block_t) + block_size);
+    block->size       = block_size;
+    block->next       = arena->blocks;
+    arena->blocks     = block;
+    arena->used       = 0;
+  }
+
+  void *data = block->data + arena->used;
+  arena->used += size;
+  memset(data, 0, size);
+  return data;
+}
+
+void *arena_copy(arena_t *arena, const void *data, size_t size) {
+  void *copy = arena_alloc(arena, size);
+  if (size > 0) { memcpy(copy, data, size); }
+  return copy;
+}
+
+void arena_free(arena_t *arena) {
+  while (arena->blocks) {
+    arena_block_t *next = arena->blocks->next;
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+  arena->used = 0;
+}
@@ -1,38 +1,64 @@
 #include "engine/anim.h"
-#include "mesh.h"
+#include "engine/state.h"
+#include "renderer.h"
 
 #include <stddef.h>
-#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 
-flat_anim_t *flat_anim = NULL, **flat_anim_ptr = &flat_anim;
+static int32_t *flat_frames, *wall_frames;
+static float    elapsed;
+static int      step;
 
-void update_animation(float dt) {
-  for (flat_anim_t *anim = flat_anim; anim != NULL; anim = anim->next) {
-    anim->time += dt;
-    if (anim->time < TEX_ANIM_TIME) continue;
+static void update_frames() {
+  for (size_t i = 0; i < num_tex_anim_defs; i++) {
+    const tex_anim_def_t *def = &tex_anim_defs[i];
+    if (def->start < 0 || def->end < def->start) { continue; }
 
-    anim->time -= TEX_ANIM_TIME;
+    int32_t *frames     = def->is_wall ? wall_frames : flat_frames;
+    int      num_frames = def->end - def->start + 1;
+    for (int tex = def->start; tex <= def->end; tex++) {
+      int frame   = def->start + (tex - def->start + step) % num_frames;
+      frames[tex] = def->is_wall ? wall_layers[frame] : frame;
+    }
+  }
 
-    glBindBuffer(GL_ARRAY_BUFFER, anim->mesh->vbo);
-    void *ptr = glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE);
+  renderer_set_texture_frames(flat_frames, num_flats, wall_frames,
+                              num_wall_textures);
+}
 
-    for (size_t i = anim->vertex_index_start; i < anim->vertex_index_end; i++) {
-      int *tex = ptr + i * sizeof(vertex_t) + offsetof(vertex_t, texture_index);
-      if (++*tex > anim->max_tex) *tex = anim->min_tex;
-    }
+void anim_init() {
+  anim_free();
+  flat_frames = malloc(sizeof(int32_t) * num_flats);
+  wall_frames = malloc(sizeof(int32_t) * num_wall_textures);
 
-    glUnmapBuffer(GL_ARRAY_BUFFER);
+  for (size_t i = 0; i < num_flats; i++) {
+    flat_frames[i] = i;
+  }
+  for (size_t i = 0; i < num_wall_textures; i++) {
+    wall_frames[i] = wall_layers[i];
   }
+
+  elapsed = 0.f;
+  step = 0;
+  update_frames();
+}
+
+void anim_free() {
+  free(flat_frames);
+  free(wall_frames);
+  flat_frames = wall_frames = NULL;
 }
 
-void add_tex_anim(mesh_t *mesh, size_t vertex_index_start,
-                  size_t vertex_index_end, int min_tex, int max_tex) {
-  flat_anim_t *anim = malloc(sizeof(flat_anim_t));
-  *flat_anim_ptr    = anim;
-  flat_anim_ptr     = &anim->next;
+void update_animation(float dt) {
+  if (!flat_frames) { return; }
+
+  elapsed += dt;
+  if (elapsed < TEX_ANIM_TIME) { return; }
 
-  *anim = (flat_anim_t){
-      mesh, vertex_index_start, vertex_index_end, min_tex, max_tex, 0.f, NULL,
-  };
+  while (elapsed >= TEX_ANIM_TIME) {
+    elapsed -= TEX_ANIM_TIME;
+    step++;
+  }
+  update_frames();
 }
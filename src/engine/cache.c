@@ -0,0 +1,516 @@
+#include "engine/cache.h"
+#include "arena.h"
+#include "dynarray.h"
+#include "engine/state.h"
+#include "flat_texture.h"
+#include "mesh.h"
+#include "palette.h"
+#include "util.h"
+#include "wad.h"
+#include "wall_texture.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC   "DOOMCACH"
+#define CACHE_VERSION 11
+
+#define MAP_LUMPS    10 // THINGS through BLOCKMAP
+#define GL_MAP_LUMPS 4  // GL_VERT through GL_NODES
+
+enum { TREE_NODE, TREE_LEAF, TREE_EMPTY_LEAF };
+
+typedef struct cache_header {
+  char     magic[8];
+  uint32_t version, vertex_size;
+  uint64_t hash;
+
+  uint32_t num_palettes, num_flats, num_wall_textures;
+  float    max_sector_height;
+  uint32_t num_tree_nodes;
+  uint32_t num_vertices, num_indices;
+  uint32_t num_merged_walls, num_leaf_walls;
+  uint32_t num_pvs_subsectors, pvs_size;
+
+  uint64_t palettes_offset, flats_offset;
+  uint64_t wall_textures_offset;
+  uint64_t tree_offset;
+  uint64_t vertices_offset, indices_offset;
+  uint64_t merged_walls_offset, leaf_walls_offset;
+  uint64_t pvs_offsets_offset, pvs_data_offset;
+} cache_header_t;
+
+typedef struct cache_texture {
+  uint64_t offset; // 0 when the texture was not composited
+} cache_texture_t;
+
+// A draw tree node, stored in the order of a front first walk
+typedef struct cache_node {
+  uint32_t type, first_index, num_indices, subsector;
+  uint32_t first_wall, num_walls;
+  vec2_t   partition, delta_partition;
+  vec3_t   min, max;
+} cache_node_t;
+
+typedef dynarray(cache_node_t) nodearray_t;
+
+typedef struct recorded_mesh {
+  size_t    num_vertices, num_indices;
+  vertex_t *vertices;
+  uint32_t *indices;
+} recorded_mesh_t;
+
+static uint8_t              *mapping;
+static size_t                mapping_size;
+static const cache_header_t *header;
+
+static bool            recording;
+static recorded_mesh_t recorded_level;
+
+static uint64_t hash_bytes(uint64_t hash, const uint8_t *data, size_t size) {
+  // FNV-1a
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+static uint64_t hash_lump(uint64_t hash, const wad_t *wad, int index) {
+  if (index < 0 || index >= wad->num_lumps) { return hash; }
+
+  uint32_t size = wad->lumps[index].size;
+  hash          = hash_bytes(hash, (const uint8_t *)&size, sizeof(size));
+  return hash_bytes(hash, wad->lumps[index].data, size);
+}
+
+uint64_t cache_hash_inputs(const wad_t *wad, const char *mapname) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  hash = hash_lump(hash, wad, wad_find_lump("PLAYPAL", wad));
+  hash = hash_lump(hash, wad, wad_find_lump("TEXTURE1", wad));
+  hash = hash_lump(hash, wad, wad_find_lump("TEXTURE2", wad));
+
+  int pnames = wad_find_lump("PNAMES", wad);
+  hash       = hash_lump(hash, wad, pnames);
+  if (pnames >= 0) {
+    const lump_t *lump        = &wad->lumps[pnames];
+    uint32_t      num_patches = lump->size / 8;
+    for (uint32_t i = 0; i < num_patches; i++) {
+      char name[9] = {0};
+      memcpy(name, lump->data + 4 + i * 8, 8);
+      hash = hash_lump(hash, wad, wad_find_lump(name, wad));
+    }
+  }
+
+  wad_range_t flats = wad->namespaces[WAD_NS_FLATS];
+  for (int i = flats.start; i >= 0 && i <= flats.end; i++) {
+    hash = hash_lump(hash, wad, i);
+  }
+
+  char gl_mapname[16];
+  snprintf(gl_mapname, sizeof(gl_mapname), "GL_%s", mapname);
+
+  int map_index = wad_find_lump(mapname, wad);
+  for (int i = 1; map_index >= 0 && i <= MAP_LUMPS; i++) {
+    hash = hash_lump(hash, wad, map_index + i);
+  }
+
+  int gl_map_index = wad_find_lump(gl_mapname, wad);
+  for (int i = 1; gl_map_index >= 0 && i <= GL_MAP_LUMPS; i++) {
+    hash = hash_lump(hash, wad, gl_map_index + i);
+  }
+
+  return hash;
+}
+
+// Returns a pointer into the mapping, or NULL if the range is outside of it
+static const void *section(uint64_t offset, uint64_t size) {
+  if (offset > mapping_size || size > mapping_size - offset) { return NULL; }
+  return mapping + offset;
+}
+
+// Wall textures have to hold all of the pixels the WAD says they have, as they
+// are uploaded straight from the mapping
+static bool validate(const wall_tex_t *wad_textures, size_t num_wad_textures) {
+  if (mapping_size < sizeof(cache_header_t)) { return false; }
+
+  if (memcmp(header->magic, CACHE_MAGIC, 8) != 0 ||
+      header->version != CACHE_VERSION ||
+      header->vertex_size != sizeof(vertex_t)) {
+    return false;
+  }
+
+  if (!section(header->vertices_offset,
+               sizeof(vertex_t) * header->num_vertices) ||
+      !section(header->indices_offset,
+               sizeof(uint32_t) * header->num_indices)) {
+    return false;
+  }
+
+  const merged_wall_t *walls =
+      section(header->merged_walls_offset,
+              sizeof(merged_wall_t) * header->num_merged_walls);
+  const uint32_t *leaf_walls = section(
+      header->leaf_walls_offset, sizeof(uint32_t) * header->num_leaf_walls);
+  if (walls == NULL || leaf_walls == NULL) { return false; }
+  for (uint32_t i = 0; i < header->num_merged_walls; i++) {
+    if (walls[i].first_index > header->num_indices ||
+        walls[i].num_indices > header->num_indices - walls[i].first_index) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < header->num_leaf_walls; i++) {
+    if (leaf_walls[i] >= header->num_merged_walls) { return false; }
+  }
+
+  const cache_node_t *tree = section(
+      header->tree_offset, sizeof(cache_node_t) * header->num_tree_nodes);
+  if (tree == NULL) { return false; }
+  for (uint32_t i = 0; i < header->num_tree_nodes; i++) {
+    if (tree[i].type > TREE_EMPTY_LEAF ||
+        tree[i].first_index > header->num_indices ||
+        tree[i].num_indices > header->num_indices - tree[i].first_index ||
+        tree[i].first_wall > header->num_leaf_walls ||
+        tree[i].num_walls > header->num_leaf_walls - tree[i].first_wall) {
+      return false;
+    }
+    if (header->num_pvs_subsectors > 0 && tree[i].subsector != MAP_NO_INDEX &&
+        tree[i].subsector >= header->num_pvs_subsectors) {
+      return false;
+    }
+  }
+
+  // A map without a PVS has no offsets, not even the end one
+  size_t num_pvs_offsets =
+      header->num_pvs_subsectors ? header->num_pvs_subsectors + 1 : 0;
+  const uint32_t *pvs_offsets = section(header->pvs_offsets_offset,
+                                        sizeof(uint32_t) * num_pvs_offsets);
+  if (pvs_offsets == NULL ||
+      !section(header->pvs_data_offset, header->pvs_size)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < header->num_pvs_subsectors; i++) {
+    if (pvs_offsets[i] > pvs_offsets[i + 1] ||
+        pvs_offsets[i + 1] > header->pvs_size) {
+      return false;
+    }
+  }
+
+  const cache_texture_t *textures =
+      section(header->wall_textures_offset,
+              sizeof(cache_texture_t) * header->num_wall_textures);
+  if (textures == NULL || header->num_wall_textures != num_wad_textures) {
+    return false;
+  }
+  for (uint32_t i = 0; i < header->num_wall_textures; i++) {
+    size_t size = (size_t)wad_textures[i].width * wad_textures[i].height;
+    if (textures[i].offset && !section(textures[i].offset, size)) {
+      return false;
+    }
+  }
+
+  return section(header->palettes_offset,
+                 sizeof(palette_t) * header->num_palettes) &&
+         section(header->flats_offset, sizeof(flat_tex_t) * header->num_flats);
+}
+
+bool cache_open(const char *path, uint64_t hash, const wall_tex_t *textures,
+                size_t num_textures) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { return false; }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) { return false; }
+
+  mapping      = ptr;
+  mapping_size = st.st_size;
+  header       = ptr;
+
+  if (!validate(textures, num_textures) || header->hash != hash) {
+    cache_close();
+    return false;
+  }
+
+  return true;
+}
+
+void cache_close() {
+  if (mapping) { munmap(mapping, mapping_size); }
+
+  mapping      = NULL;
+  mapping_size = 0;
+  header       = NULL;
+}
+
+const palette_t *cache_get_palettes(size_t *num) {
+  *num = header->num_palettes;
+  return section(header->palettes_offset, sizeof(palette_t) * *num);
+}
+
+const flat_tex_t *cache_get_flats(size_t *num) {
+  *num = header->num_flats;
+  return section(header->flats_offset, sizeof(flat_tex_t) * *num);
+}
+
+const uint8_t *cache_get_wall_texture(int index) {
+  if (index < 0 || index >= header->num_wall_textures) { return NULL; }
+
+  const cache_texture_t *textures =
+      section(header->wall_textures_offset,
+              sizeof(cache_texture_t) * header->num_wall_textures);
+  return textures[index].offset ? mapping + textures[index].offset : NULL;
+}
+
+// The nodes are stored in the order of a front first walk. Deep trees would
+// overflow the call stack, so the pointers still to be filled in are kept on
+// an explicit one, every front child above its back sibling.
+static void restore_tree(const cache_node_t *tree) {
+  draw_node_t ***stack = malloc(sizeof(draw_node_t **) *
+                                (header->num_tree_nodes + 1));
+  size_t         count = 0;
+  uint32_t       next  = 0;
+
+  stack[count++] = &root_draw_node;
+  while (count > 0) {
+    draw_node_t **draw_node_ptr = stack[--count];
+
+    draw_node_t *draw_node = arena_alloc(&level_arena, sizeof(draw_node_t));
+    *draw_node             = DRAW_NODE_EMPTY;
+    *draw_node_ptr         = draw_node;
+
+    // A tree that ends early leaves the rest of its nodes empty
+    if (next >= header->num_tree_nodes) { continue; }
+
+    const cache_node_t *node   = &tree[next++];
+    draw_node->min             = node->min;
+    draw_node->max             = node->max;
+    draw_node->partition       = node->partition;
+    draw_node->delta_partition = node->delta_partition;
+
+    switch (node->type) {
+    case TREE_NODE:
+      stack[count++] = &draw_node->back;
+      stack[count++] = &draw_node->front;
+      break;
+    case TREE_LEAF:
+      draw_node->first_index = node->first_index;
+      draw_node->num_indices = node->num_indices;
+      draw_node->first_wall  = node->first_wall;
+      draw_node->num_walls   = node->num_walls;
+      draw_node->subsector   = node->subsector;
+      break;
+    case TREE_EMPTY_LEAF: break;
+    }
+  }
+
+  free(stack);
+}
+
+void cache_restore_level() {
+  max_sector_height = header->max_sector_height;
+
+  mesh_create(&level_mesh, VERTEX_LAYOUT_PACKED, header->num_vertices,
+              mapping + header->vertices_offset, header->num_indices,
+              (const uint32_t *)(mapping + header->indices_offset));
+
+  // The merged walls outlive the mapping too
+  num_merged_walls = header->num_merged_walls;
+  num_leaf_walls   = header->num_leaf_walls;
+  merged_walls     = arena_copy(&level_arena,
+                                mapping + header->merged_walls_offset,
+                                sizeof(merged_wall_t) * num_merged_walls);
+  leaf_walls       = arena_copy(&level_arena,
+                                mapping + header->leaf_walls_offset,
+                                sizeof(uint32_t) * num_leaf_walls);
+
+  if (header->num_tree_nodes > 0) {
+    restore_tree(section(header->tree_offset, 0));
+  }
+
+  // The PVS outlives the mapping, so it is copied out
+  pvs = (pvs_t){0};
+  if (header->num_pvs_subsectors > 0) {
+    size_t offsets_size = sizeof(uint32_t) * (header->num_pvs_subsectors + 1);
+    pvs = (pvs_t){header->num_pvs_subsectors, header->pvs_size,
+                  malloc(offsets_size), malloc(header->pvs_size)};
+    memcpy(pvs.offsets, mapping + header->pvs_offsets_offset, offsets_size);
+    memcpy(pvs.data, mapping + header->pvs_data_offset, header->pvs_size);
+  }
+}
+
+void cache_begin_record() {
+  recording      = true;
+  recorded_level = (recorded_mesh_t){0};
+}
+
+void cache_record_level(size_t num_vertices, const vertex_t *vertices,
+                        size_t num_indices, const uint32_t *indices) {
+  if (!recording) { return; }
+
+  recorded_level = (recorded_mesh_t){
+      num_vertices,
+      num_indices,
+      malloc(sizeof(vertex_t) * num_vertices),
+      malloc(sizeof(uint32_t) * num_indices),
+  };
+  memcpy(recorded_level.vertices, vertices, sizeof(vertex_t) * num_vertices);
+  memcpy(recorded_level.indices, indices, sizeof(uint32_t) * num_indices);
+}
+
+// Appends the data at a 16-byte aligned offset and returns that offset
+static uint64_t write_section(FILE *fp, const void *data, size_t size) {
+  static const uint8_t zeros[16] = {0};
+
+  long offset = ftell(fp);
+  if (offset % 16) { fwrite(zeros, 1, 16 - offset % 16, fp); }
+
+  offset = ftell(fp);
+  if (size > 0) { fwrite(data, 1, size, fp); }
+  return offset;
+}
+
+// A front first walk, from an explicit stack like restore_tree's
+static void write_tree(nodearray_t *tree, const draw_node_t *root) {
+  dynarray(const draw_node_t *) stack;
+  dynarray_init(stack, 0);
+  dynarray_push(stack, root);
+
+  while (stack.count > 0) {
+    const draw_node_t *node = stack.data[--stack.count];
+
+    cache_node_t cache_node = {
+        .type            = TREE_EMPTY_LEAF,
+        .subsector       = node->subsector,
+        .partition       = node->partition,
+        .delta_partition = node->delta_partition,
+        .min             = node->min,
+        .max             = node->max,
+    };
+
+    if (node->front || node->back) {
+      cache_node.type = TREE_NODE;
+    } else if (node->num_indices > 0) {
+      cache_node.type        = TREE_LEAF;
+      cache_node.first_index = node->first_index;
+      cache_node.num_indices = node->num_indices;
+      cache_node.first_wall  = node->first_wall;
+      cache_node.num_walls   = node->num_walls;
+    }
+    dynarray_push((*tree), cache_node);
+
+    if (cache_node.type == TREE_NODE) {
+      dynarray_push(stack, node->back);
+      dynarray_push(stack, node->front);
+    }
+  }
+
+  free(stack.data);
+}
+
+int cache_write(const char *path, uint64_t hash, const palette_t *palettes,
+                const flat_tex_t *flats, const wall_tex_t *textures) {
+  recording = false;
+
+  // Written to a temporary file first so that a crash never leaves a
+  // truncated cache behind under the real name
+  char *tmp_path = malloc(strlen(path) + 5);
+  sprintf(tmp_path, "%s.tmp", path);
+
+  FILE *fp = fopen(tmp_path, "wb");
+  if (fp == NULL) {
+    free(tmp_path);
+    return 1;
+  }
+
+  cache_header_t header = {
+      .magic             = CACHE_MAGIC,
+      .version           = CACHE_VERSION,
+      .vertex_size       = sizeof(vertex_t),
+      .hash              = hash,
+      .num_palettes      = num_palettes,
+      .num_flats         = num_flats,
+      .num_wall_textures = num_wall_textures,
+      .max_sector_height = max_sector_height,
+  };
+  fwrite(&header, sizeof(header), 1, fp);
+
+  header.palettes_offset =
+      write_section(fp, palettes, sizeof(palette_t) * num_palettes);
+  header.flats_offset =
+      write_section(fp, flats, sizeof(flat_tex_t) * num_flats);
+
+  cache_texture_t *cache_textures =
+      calloc(num_wall_textures, sizeof(cache_texture_t));
+  for (int i = 0; i < num_wall_textures; i++) {
+    if (textures[i].data == NULL) { continue; }
+    cache_textures[i].offset = write_section(
+        fp, textures[i].data, textures[i].width * textures[i].height);
+  }
+  header.wall_textures_offset = write_section(
+      fp, cache_textures, sizeof(cache_texture_t) * num_wall_textures);
+  free(cache_textures);
+
+  nodearray_t tree;
+  dynarray_init(tree, 0);
+  if (root_draw_node) { write_tree(&tree, root_draw_node); }
+
+  header.num_tree_nodes = tree.count;
+  header.tree_offset =
+      write_section(fp, tree.data, sizeof(cache_node_t) * tree.count);
+
+  header.num_vertices    = recorded_level.num_vertices;
+  header.num_indices     = recorded_level.num_indices;
+  header.vertices_offset = write_section(
+      fp, recorded_level.vertices, sizeof(vertex_t) * header.num_vertices);
+  header.indices_offset = write_section(
+      fp, recorded_level.indices, sizeof(uint32_t) * header.num_indices);
+
+  header.num_merged_walls    = num_merged_walls;
+  header.num_leaf_walls      = num_leaf_walls;
+  header.merged_walls_offset = write_section(
+      fp, merged_walls, sizeof(merged_wall_t) * num_merged_walls);
+  header.leaf_walls_offset =
+      write_section(fp, leaf_walls, sizeof(uint32_t) * num_leaf_walls);
+
+  header.num_pvs_subsectors = pvs.num_subsectors;
+  header.pvs_size           = pvs.size;
+  header.pvs_offsets_offset = write_section(
+      fp, pvs.offsets,
+      pvs.offsets ? sizeof(uint32_t) * (pvs.num_subsectors + 1) : 0);
+  header.pvs_data_offset = write_section(fp, pvs.data, pvs.size);
+
+  fseek(fp, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, fp);
+  int failed = ferror(fp);
+  fclose(fp);
+
+  free(recorded_level.vertices);
+  free(recorded_level.indices);
+  recorded_level = (recorded_mesh_t){0};
+  free(tree.data);
+
+  if (failed || rename(tmp_path, path) != 0) {
+    remove(tmp_path);
+    free(tmp_path);
+    return 2;
+  }
+
+  free(tmp_path);
+  return 0;
+}
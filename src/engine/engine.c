@@ -1,22 +1,32 @@
 #include "engine.h"
+#include "arena.h"
 #include "camera.h"
+#include "dynarray.h"
 #include "engine/anim.h"
+#include "engine/cache.h"
 #include "engine/meshgen.h"
 #include "engine/state.h"
 #include "engine/util.h"
 #include "flat_texture.h"
+#include "frustum.h"
 #include "gl_map.h"
+#include "gpu_cull.h"
 #include "input.h"
+#include "jobs.h"
 #include "map.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "nodebuild.h"
+#include "occlusion.h"
 #include "palette.h"
+#include "pvs.h"
 #include "renderer.h"
 #include "util.h"
 #include "vector.h"
 #include "wad.h"
 #include "wall_texture.h"
 
+#include <limits.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -24,26 +34,63 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #define FOV               (M_PI / 3.f)
 #define PLAYER_SPEED      (500.f)
 #define MOUSE_SENSITIVITY (.05f)
 
-static void render_node(draw_node_t *node);
+static void render_node(draw_node_t *root);
 
-size_t           num_flats, num_wall_textures, num_palettes;
+typedef dynarray(gpu_cull_leaf_t) leafarray_t;
+static void collect_leaves(draw_node_t *root, leafarray_t *leaves);
+
+arena_t level_arena;
+
+size_t           num_flats, num_wall_textures, num_wall_layers, num_palettes;
 wall_tex_info_t *wall_textures_info;
+int32_t         *wall_layers;
 vec2_t          *wall_max_coords;
 
 map_t    map;
 gl_map_t gl_map;
+pvs_t    pvs;
 float    player_height;
 float    max_sector_height;
 int      sky_flat;
+int      sky_texture;
 
+mesh_t         level_mesh;
 draw_node_t   *root_draw_node;
-stencil_list_t stencil_list;
-mesh_t         quad_mesh;
+merged_wall_t *merged_walls;
+size_t         num_merged_walls;
+uint32_t      *leaf_walls;
+size_t         num_leaf_walls;
+GLuint         palette_texture, flat_texture_array, wall_texture_array;
+
+// Index ranges of the level mesh that are drawn this frame. Ranges that follow
+// on from each other are merged, so an unculled level is a single range.
+static dynarray(GLsizei) draw_counts;
+static dynarray(const void *) draw_offsets;
+static size_t draw_end;
+
+// Nodes still to visit in the walks of the draw tree, kept between frames
+static dynarray(draw_node_t *) node_stack;
+
+// The frame every merged wall was last drawn in, so that it is drawn once
+static uint32_t *wall_frames;
+static uint32_t  draw_frame;
+
+// The camera subsector's row of the PVS, or NULL to draw every subsector
+static uint8_t *visible;
+static uint32_t visible_subsector;
+
+// Whether culling runs in a compute shader, and how long the CPU walk of the
+// draw tree took when it does not
+static bool   use_gpu_culling;
+static double cpu_cull_ms;
+static size_t num_cpu_culled_frames;
 
 size_t         num_tex_anim_defs;
 tex_anim_def_t tex_anim_defs[] = {
@@ -52,74 +99,279 @@ tex_anim_def_t tex_anim_defs[] = {
     {"SWATER4", "SWATER1"},
     {"LAVA4",   "LAVA1"  },
     {"BLOOD3",  "BLOOD1" },
+
+    {"BLODGR4",  "BLODGR1",  true},
+    {"SLADRIP3", "SLADRIP1", true},
+    {"BLODRIP4", "BLODRIP1", true},
+    {"FIREWALL", "FIREWALA", true},
+    {"GSTFONT3", "GSTFONT1", true},
+    {"FIRELAVA", "FIRELAV3", true},
+    {"FIREMAG3", "FIREMAG1", true},
+    {"FIREBLU2", "FIREBLU1", true},
+    {"ROCKRED3", "ROCKRED1", true},
+    {"BFALL4",   "BFALL1",   true},
+    {"SFALL4",   "SFALL1",   true},
+    {"WFALL4",   "WFALL1",   true},
+    {"DBRAIN4",  "DBRAIN1",  true},
 };
 
-static camera_t camera;
+static camera_t  camera;
+static mat4_t    projection;
+static frustum_t frustum;
+static occlusion_t occlusion;
 static vec2_t   last_mouse;
 
-void engine_init(wad_t *wad, const char *mapname) {
-  vec2_t size       = renderer_get_size();
-  mat4_t projection = mat4_perspective(FOV, size.x / size.y, .1f, 10000.f);
-  renderer_set_projection(projection);
+#define TEXTURES_PER_JOB 64
+
+static double get_time_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// CPU-side products of the asset decode jobs, consumed by engine_init
+static struct {
+  const wad_t *wad;
+  const char  *mapname;
+  bool         map_failed, gl_map_failed;
+
+  char    *cache_path; // NULL when the asset cache is disabled
+  uint64_t cache_hash;
+  bool     cache_hit;
+
+  palette_t  *palettes;
+  flat_tex_t *flats;
+  wall_tex_t  *textures;
+  name_table_t texture_names;
+  bool        *used_textures;
+} loader;
+
+static void load_palettes(void *arg) {
+  loader.palettes = wad_read_playpal(&num_palettes, loader.wad);
+}
 
-  char *gl_mapname = malloc(strlen(mapname) + 4);
-  gl_mapname[0]    = 'G';
-  gl_mapname[1]    = 'L';
-  gl_mapname[2]    = '_';
-  gl_mapname[3]    = 0;
-  strcat(gl_mapname, mapname);
+// engine_load sets num_flats up front, since the level geometry job reads it
+static void load_flats(void *arg) {
+  size_t num;
+  loader.flats = wad_read_flats(&num, loader.wad);
+}
+
+static void composite_textures(void *arg) {
+  size_t start = (uintptr_t)arg;
+  size_t end   = min(start + TEXTURES_PER_JOB, num_wall_textures);
+  wad_composite_textures(loader.textures, start, end, loader.used_textures,
+                         loader.wad);
+}
+
+static void build_meshes(void *arg) { generate_meshes(); }
+
+// Needs the map, since nodes are built from it when the WAD has none. The
+// level geometry and PVS are built from the nodes unless the cache has them.
+static void load_gl_map(void *arg) {
+  if (wad_read_gl_map(loader.mapname, &gl_map, loader.wad) != 0) {
+    printf("Building GL nodes for %s\n", loader.mapname);
+    if (nodebuild_build(&map, &gl_map) != 0) {
+      loader.gl_map_failed = true;
+      return;
+    }
+  }
 
-  if (wad_read_gl_map(gl_mapname, &gl_map, wad) != 0) {
-    fprintf(stderr, "Failed to read GL info for map (%s) from WAD file\n",
-            mapname);
+  if (!loader.cache_hit) { jobs_submit(build_meshes, NULL); }
+
+  pvs = (pvs_t){0};
+  if (!loader.cache_hit && pvs_build(&map, &gl_map, &pvs) != 0) {
+    fprintf(stderr, "Failed to build PVS for %s\n", loader.mapname);
+  }
+}
+
+static void load_map(void *arg) {
+  if (wad_read_map(loader.mapname, &map, loader.wad, &loader.texture_names) !=
+      0) {
+    loader.map_failed = true;
     return;
   }
 
-  palette_t *palettes    = wad_read_playpal(&num_palettes, wad);
-  GLuint palette_texture = palettes_generate_texture(palettes, num_palettes);
+  jobs_submit(load_gl_map, NULL);
+
+  // The composited textures come straight from the cache
+  if (loader.cache_hit) { return; }
+
+  // Only the textures this map's sidedefs refer to (and the sky) are
+  // composited; the rest keep their size but no pixel data
+  bool *used_textures = calloc(num_wall_textures, sizeof(bool));
+  for (int i = 0; i < map.num_sidedefs; i++) {
+    sidedef_t *sidedef = &map.sidedefs[i];
+    if (sidedef->upper >= 0) { used_textures[sidedef->upper] = true; }
+    if (sidedef->lower >= 0) { used_textures[sidedef->lower] = true; }
+    if (sidedef->middle >= 0) { used_textures[sidedef->middle] = true; }
+  }
+
+  if (sky_texture >= 0) { used_textures[sky_texture] = true; }
+
+  // Every frame of an animation that is used is needed
+  for (int i = 0; i < num_tex_anim_defs; i++) {
+    const tex_anim_def_t *def = &tex_anim_defs[i];
+    if (!def->is_wall || def->start < 0) { continue; }
+
+    bool is_used = false;
+    for (int tex = def->start; tex <= def->end; tex++) {
+      is_used = is_used || used_textures[tex];
+    }
+    for (int tex = def->start; is_used && tex <= def->end; tex++) {
+      used_textures[tex] = true;
+    }
+  }
+  loader.used_textures = used_textures;
+
+  for (size_t i = 0; i < num_wall_textures; i += TEXTURES_PER_JOB) {
+    jobs_submit(composite_textures, (void *)(uintptr_t)i);
+  }
+}
+
+void engine_load(const wad_t *wad, const char *mapname,
+                 const char *cache_dir) {
+  loader = (typeof(loader)){.wad = wad, .mapname = mapname};
 
-  sky_flat = wad_find_lump("F_SKY1", wad) - wad_find_lump("F_START", wad) - 1;
+  // Flat indices are offsets into the F_START..F_END range, which is how
+  // read_sectors resolves them too
+  int f_start = wad->namespaces[WAD_NS_FLATS].start;
+  int f_end   = wad->namespaces[WAD_NS_FLATS].end;
+  num_flats   = f_start >= 0 && f_end >= 0 ? f_end - f_start - 1 : 0;
+
+  // Unresolved flats are -1, which no sector may match as the sky
+  int sky_lump = wad_find_lump_in_namespace("F_SKY1", WAD_NS_FLATS, wad);
+  sky_flat     = sky_lump >= 0 ? sky_lump - f_start - 1 : INT_MIN;
 
   num_tex_anim_defs = sizeof tex_anim_defs / sizeof tex_anim_defs[0];
   for (int i = 0; i < num_tex_anim_defs; i++) {
-    tex_anim_defs[i].start = tex_anim_defs[i].end = -1;
+    if (tex_anim_defs[i].is_wall) { continue; }
+
+    int start = wad_find_lump_in_namespace(tex_anim_defs[i].start_name,
+                                           WAD_NS_FLATS, wad);
+    int end   = wad_find_lump_in_namespace(tex_anim_defs[i].end_name,
+                                           WAD_NS_FLATS, wad);
+
+    tex_anim_defs[i].start = start >= 0 ? start - f_start - 1 : -1;
+    tex_anim_defs[i].end   = end >= 0 ? end - f_start - 1 : -1;
   }
 
-  flat_tex_t *flats         = wad_read_flats(&num_flats, wad);
-  GLuint flat_texture_array = generate_flat_texture_array(flats, num_flats);
-  for (int i = 0; i < num_flats; i++) {
-    for (int j = 0; j < num_tex_anim_defs; j++) {
-      if (strcmp_nocase(flats[i].name, tex_anim_defs[j].start_name) == 0) {
-        tex_anim_defs[j].start = i;
-      }
+  // The texture directory only holds names and sizes, which the map needs to
+  // resolve its sidedefs; the pixels are composited by the jobs
+  num_wall_textures = 0;
+  loader.textures   = wad_read_textures(&num_wall_textures, wad);
+
+  wall_textures_info =
+      arena_alloc(&level_arena, sizeof(wall_tex_info_t) * num_wall_textures);
+  wall_layers        =
+      arena_alloc(&level_arena, sizeof(int32_t) * num_wall_textures);
+  wall_max_coords    =
+      arena_alloc(&level_arena, sizeof(vec2_t) * num_wall_textures);
+  for (int i = 0; i < num_wall_textures; i++) {
+    wall_textures_info[i] = (wall_tex_info_t){loader.textures[i].width,
+                                              loader.textures[i].height};
+  }
 
-      if (strcmp_nocase(flats[i].name, tex_anim_defs[j].end_name) == 0) {
-        tex_anim_defs[j].end = i;
-      }
+  // Named textures resolve the same way as the sidedefs' do
+  wad_index_textures(&loader.texture_names, loader.textures, num_wall_textures);
+  const name_table_t *names = &loader.texture_names;
+
+  sky_texture = wad_find_texture("SKY1", names);
+  for (int i = 0; i < num_tex_anim_defs; i++) {
+    if (!tex_anim_defs[i].is_wall) { continue; }
+
+    tex_anim_defs[i].start =
+        wad_find_texture(tex_anim_defs[i].start_name, names);
+    tex_anim_defs[i].end = wad_find_texture(tex_anim_defs[i].end_name, names);
+    if (tex_anim_defs[i].end < tex_anim_defs[i].start) {
+      tex_anim_defs[i].start = tex_anim_defs[i].end = -1;
     }
   }
-  free(flats);
 
-  wall_tex_t *textures = wad_read_textures(&num_wall_textures, "TEXTURE1", wad);
-  wall_textures_info   = malloc(sizeof(wall_tex_info_t) * num_wall_textures);
-  wall_max_coords      = malloc(sizeof(vec2_t) * num_wall_textures);
-  for (int i = 0; i < num_wall_textures; i++) {
-    if (strcmp_nocase(textures[i].name, "SKY1") == 0) {
-      renderer_set_sky_texture(generate_texture_cubemap(&textures[i]));
+  // The cached wall textures are checked against the texture directory
+  if (cache_dir) {
+    mkdir(cache_dir, 0755);
+
+    loader.cache_hash = cache_hash_inputs(wad, mapname);
+    loader.cache_path = malloc(strlen(cache_dir) + strlen(mapname) + 32);
+    sprintf(loader.cache_path, "%s/%s-%016llx.cache", cache_dir, mapname,
+            (unsigned long long)loader.cache_hash);
+
+    loader.cache_hit = cache_open(loader.cache_path, loader.cache_hash,
+                                  loader.textures, num_wall_textures);
+  }
+
+  if (!loader.cache_hit) {
+    jobs_submit(load_palettes, NULL);
+    jobs_submit(load_flats, NULL);
+  }
+  jobs_submit(load_map, NULL);
+}
+
+// Frees what the loader decoded once it has been uploaded, or when the load
+// failed. Wall textures read from a cache hit point into its mapping.
+static void free_loader() {
+  if (loader.cache_hit) {
+    for (int i = 0; loader.textures && i < num_wall_textures; i++) {
+      loader.textures[i].data = NULL;
     }
+    cache_close();
+  }
 
-    wall_textures_info[i] =
-        (wall_tex_info_t){textures[i].width, textures[i].height};
+  free(loader.palettes);
+  free(loader.flats);
+  if (loader.textures) {
+    wad_free_wall_textures(loader.textures, num_wall_textures);
   }
-  GLuint wall_texture_array =
-      generate_wall_texture_array(textures, num_wall_textures, wall_max_coords);
-  wad_free_wall_textures(textures, num_wall_textures);
+  free(loader.textures);
+  free(loader.used_textures);
+  free(loader.cache_path);
+  name_table_free(&loader.texture_names);
+
+  loader.palettes      = NULL;
+  loader.flats         = NULL;
+  loader.textures      = NULL;
+  loader.used_textures = NULL;
+  loader.cache_path    = NULL;
+  loader.cache_hit     = false;
+}
 
-  if (wad_read_map(mapname, &map, wad, textures, num_wall_textures) != 0) {
-    fprintf(stderr, "Failed to read map (%s) from WAD file\n", mapname);
-    return;
+int engine_init() {
+  vec2_t size = renderer_get_size();
+  projection  = mat4_perspective(FOV, size.x / size.y, .1f, 10000.f);
+  renderer_set_projection(projection);
+
+  // Everything below this point only uploads what the jobs decoded
+  jobs_wait();
+
+  if (loader.gl_map_failed || loader.map_failed) {
+    if (loader.gl_map_failed) {
+      fprintf(stderr, "Failed to read GL info for map (%s) from WAD file\n",
+              loader.mapname);
+    } else {
+      fprintf(stderr, "Failed to read map (%s) from WAD file\n",
+              loader.mapname);
+    }
+    free_loader();
+    return 1;
   }
 
+  const palette_t  *palettes = loader.palettes;
+  const flat_tex_t *flats    = loader.flats;
+  if (loader.cache_hit) {
+    palettes = cache_get_palettes(&num_palettes);
+    flats    = cache_get_flats(&num_flats);
+    for (int i = 0; i < num_wall_textures; i++) {
+      loader.textures[i].data = (uint8_t *)cache_get_wall_texture(i);
+    }
+  }
+
+  palette_texture    = palettes_generate_texture(palettes, num_palettes);
+  flat_texture_array = generate_flat_texture_array(flats, num_flats);
+  wall_texture_array =
+      generate_wall_texture_array(loader.textures, num_wall_textures,
+                                  wall_layers, wall_max_coords,
+                                  &num_wall_layers);
+
   for (int i = 0; i < map.num_things; i++) {
     thing_t *thing = &map.things[i];
 
@@ -145,28 +397,118 @@ void engine_init(wad_t *wad, const char *mapname) {
     }
   }
 
-  stencil_list = (stencil_list_t){NULL, NULL};
-  generate_meshes();
+  if (loader.cache_hit) {
+    cache_restore_level();
+  } else {
+    if (loader.cache_path) { cache_begin_record(); }
+    upload_meshes();
+
+    if (loader.cache_path &&
+        cache_write(loader.cache_path, loader.cache_hash, palettes, flats,
+                    loader.textures) != 0) {
+      fprintf(stderr, "Failed to write asset cache (%s)\n", loader.cache_path);
+    }
+  }
+
+  free_loader();
 
   renderer_set_flat_texture(flat_texture_array);
   renderer_set_wall_texture(wall_texture_array);
+  renderer_set_wall_max_coords(wall_max_coords, num_wall_layers);
   renderer_set_palette_texture(palette_texture);
+  anim_init();
+
+  dynarray_init(draw_counts, 0);
+  dynarray_init(draw_offsets, 0);
+  dynarray_init(node_stack, 0);
+  wall_frames =
+      arena_alloc(&level_arena, sizeof(uint32_t) * (num_merged_walls + 1));
+  draw_frame  = 0;
+
+  visible           = NULL;
+  visible_subsector = MAP_NO_INDEX;
+  if (pvs.num_subsectors > 0 && pvs.num_subsectors == gl_map.num_subsectors) {
+    visible = arena_alloc(&level_arena, (pvs.num_subsectors + 7) / 8);
+    printf("PVS culls %.1f%% of subsectors on average\n",
+           100.f * pvs_culled_fraction(&pvs));
+  }
 
-  vec3_t stencil_quad_vertices[] = {
-      {0.f, 0.f, 0.f},
-      {0.f, 1.f, 0.f},
-      {1.f, 1.f, 0.f},
-      {1.f, 0.f, 0.f},
-  };
+  if (use_gpu_culling && !gpu_cull_is_supported()) {
+    fprintf(stderr, "GPU culling needs OpenGL 4.3, culling on the CPU\n");
+    use_gpu_culling = false;
+  }
 
-  uint32_t stencil_quad_indices[] = {0, 2, 1, 0, 3, 2};
+  if (use_gpu_culling) {
+    leafarray_t leaves;
+    dynarray_init(leaves, 0);
+    if (root_draw_node) { collect_leaves(root_draw_node, &leaves); }
+
+    // Merged walls are culled on their own, by their own bounds
+    for (size_t i = 0; i < num_merged_walls; i++) {
+      merged_wall_t  *wall = &merged_walls[i];
+      gpu_cull_leaf_t leaf = {
+          .min         = {wall->min.x, wall->min.y, wall->min.z, 0.f},
+          .max         = {wall->max.x, wall->max.y, wall->max.z, 0.f},
+          .first_index = wall->first_index,
+          .num_indices = wall->num_indices,
+      };
+      if (wall->num_indices > 0) { dynarray_push(leaves, leaf); }
+    }
+    gpu_cull_init(leaves.count, leaves.data);
+    free(leaves.data);
+  }
 
-  mesh_create(&quad_mesh, VERTEX_LAYOUT_PLAIN, 4, stencil_quad_vertices, 6,
-              stencil_quad_indices, false);
+  return 0;
 }
 
-static int palette_index = 0;
-void       engine_update(float dt) {
+void engine_unload() {
+  // A load that engine_init never waited for is still filling the level in
+  jobs_wait();
+  free_loader();
+
+  mesh_free(&level_mesh);
+  GLuint textures[] = {palette_texture, flat_texture_array, wall_texture_array};
+  glDeleteTextures(sizeof textures / sizeof textures[0], textures);
+  palette_texture = flat_texture_array = wall_texture_array = 0;
+  gpu_cull_free();
+  anim_free();
+
+  wad_free_map(&map);
+  wad_free_gl_map(&gl_map);
+  pvs_free(&pvs);
+  dynarray_free(draw_counts);
+  dynarray_free(draw_offsets);
+  dynarray_free(node_stack);
+
+  arena_free(&level_arena);
+  wall_textures_info = NULL;
+  wall_layers        = NULL;
+  wall_max_coords    = NULL;
+  num_wall_layers    = 0;
+  root_draw_node     = NULL;
+  merged_walls       = NULL;
+  num_merged_walls   = 0;
+  leaf_walls         = NULL;
+  num_leaf_walls     = 0;
+  wall_frames        = NULL;
+  visible            = NULL;
+}
+
+void engine_use_gpu_culling(bool enabled) { use_gpu_culling = enabled; }
+
+void engine_print_cull_timing() {
+  if (use_gpu_culling) {
+    printf("Culling took %.3f ms per frame on the GPU\n",
+           gpu_cull_average_ms());
+  } else if (num_cpu_culled_frames > 0) {
+    printf("Culling took %.3f ms per frame on the CPU\n",
+           cpu_cull_ms / num_cpu_culled_frames);
+  }
+}
+
+static int   palette_index = 0;
+static float elapsed_time;
+void         engine_update(float dt) {
   if (is_button_just_pressed(KEY_O)) { palette_index--; }
   if (is_button_just_pressed(KEY_P)) { palette_index++; }
 
@@ -228,6 +570,7 @@ void       engine_update(float dt) {
   }
 
   update_animation(dt);
+  elapsed_time += dt;
 }
 
 void engine_render() {
@@ -235,25 +578,165 @@ void engine_render() {
       camera.position, vec3_add(camera.position, camera.forward), camera.up);
   renderer_set_view(view);
 
+  mat4_t view_projection = mat4_mul(view, projection);
+  frustum                = frustum_from_matrix(view_projection);
+
   renderer_set_palette_index(palette_index);
+  renderer_set_time(elapsed_time);
+
+  if (use_gpu_culling) {
+    gpu_cull_draw(&level_mesh, view_projection, &frustum);
+  } else {
+    double start = get_time_ms();
+
+    uint32_t subsector =
+        map_get_subsector((vec2_t){camera.position.x, camera.position.z});
+    if (visible && subsector != visible_subsector &&
+        subsector != MAP_NO_INDEX) {
+      pvs_get_row(&pvs, subsector, visible);
+      visible_subsector = subsector;
+    }
+
+    occlusion_begin(&occlusion, camera.position);
+
+    draw_counts.count = draw_offsets.count = 0;
+    draw_frame++;
+    if (root_draw_node) { render_node(root_draw_node); }
 
-  glStencilMask(0x00);
-  render_node(root_draw_node);
+    cpu_cull_ms += get_time_ms() - start;
+    num_cpu_culled_frames++;
 
-  glStencilMask(0xff);
-  for (stencil_node_t *node = stencil_list.head; node != NULL;
-       node                 = node->next) {
-    renderer_draw_mesh(&quad_mesh, SHADER_PLAIN, node->transformation);
+    renderer_draw_ranges(&level_mesh, SHADER_DEFAULT, mat4_identity(),
+                         draw_counts.data, draw_offsets.data,
+                         draw_counts.count);
   }
 
-  renderer_draw_sky();
+  renderer_flush();
 }
 
-void render_node(draw_node_t *node) {
-  if (node->mesh) {
-    renderer_draw_mesh(node->mesh, SHADER_DEFAULT, mat4_identity());
+static vec2_t vertex_position(uint32_t id) {
+  return id & VERT_IS_GL ? gl_map.vertices[id & ~VERT_IS_GL] : map.vertices[id];
+}
+
+// Hands the walls of a drawn subsector to the occlusion buffer. One-sided
+// walls close the columns behind them, and two-sided ones leave the opening
+// between the higher floor and the lower ceiling. Above two sky ceilings no
+// upper wall is drawn, so nothing is hidden there.
+static void add_occluders(uint32_t id) {
+  if (id >= gl_map.num_subsectors) { return; }
+
+  gl_subsector_t *subsector = &gl_map.subsectors[id];
+  for (uint32_t i = 0; i < subsector->num_segs; i++) {
+    gl_segment_t *segment = &gl_map.segments[subsector->first_seg + i];
+    if (segment->linedef == MAP_NO_INDEX) { continue; }
+
+    linedef_t *linedef = &map.linedefs[segment->linedef];
+    vec2_t     start   = vertex_position(segment->start_vertex);
+    vec2_t     end     = vertex_position(segment->end_vertex);
+
+    if (!(linedef->flags & LINEDEF_FLAGS_TWO_SIDED)) {
+      occlusion_add_wall(&occlusion, start, end, 0.f, 0.f);
+      continue;
+    }
+
+    uint32_t front_sidedef = linedef->front_sidedef;
+    uint32_t back_sidedef  = linedef->back_sidedef;
+    if (segment->side) {
+      front_sidedef = linedef->back_sidedef;
+      back_sidedef  = linedef->front_sidedef;
+    }
+
+    sector_t *front = &map.sectors[map.sidedefs[front_sidedef].sector_idx];
+    sector_t *back  = &map.sectors[map.sidedefs[back_sidedef].sector_idx];
+
+    float bottom = max(front->floor, back->floor);
+    float top    = min(front->ceiling, back->ceiling);
+    if (front->ceiling_tex == sky_flat && back->ceiling_tex == sky_flat) {
+      top = INFINITY;
+    }
+
+    occlusion_add_wall(&occlusion, start, end, bottom, top);
+  }
+}
+
+static void draw_range(uint32_t first_index, uint32_t num_indices) {
+  if (draw_counts.count > 0 && draw_end == first_index) {
+    draw_counts.data[draw_counts.count - 1] += num_indices;
+  } else {
+    const void *offset = (const void *)(level_mesh.index_size * first_index);
+    dynarray_push(draw_counts, num_indices);
+    dynarray_push(draw_offsets, offset);
+  }
+  draw_end = first_index + num_indices;
+}
+
+// Subtrees outside the frustum, subsectors outside the camera subsector's PVS
+// and subtrees behind walls that were drawn already are skipped. The child on
+// the camera's side of the partition goes first, so that nearer walls fill
+// the depth buffer and the occlusion buffer. The walk runs from an explicit
+// stack, like restore_tree's, since the tree is as deep as the BSP.
+void render_node(draw_node_t *root) {
+  vec2_t position = {camera.position.x, camera.position.z};
+
+  node_stack.count = 0;
+  dynarray_push(node_stack, root);
+  while (node_stack.count > 0) {
+    draw_node_t *node = node_stack.data[--node_stack.count];
+    if (!frustum_test_box(&frustum, node->min, node->max)) { continue; }
+
+    uint32_t id = node->subsector;
+    if (visible && visible_subsector != MAP_NO_INDEX && id != MAP_NO_INDEX &&
+        (visible[id / 8] & (1 << (id % 8))) == 0) {
+      continue;
+    }
+
+    if (!occlusion_test_box(&occlusion, node->min, node->max)) { continue; }
+
+    if (node->num_indices > 0) {
+      draw_range(node->first_index, node->num_indices);
+
+      for (uint32_t i = 0; i < node->num_walls; i++) {
+        uint32_t wall = leaf_walls[node->first_wall + i];
+        if (wall_frames[wall] == draw_frame) { continue; }
+
+        wall_frames[wall] = draw_frame;
+        draw_range(merged_walls[wall].first_index,
+                   merged_walls[wall].num_indices);
+      }
+
+      add_occluders(id);
+    }
+
+    vec2_t delta      = vec2_sub(position, node->partition);
+    bool   is_on_back = (delta.x * node->delta_partition.y -
+                       delta.y * node->delta_partition.x) <= 0.f;
+
+    // The far child is pushed first, so that the near one is popped first
+    draw_node_t *near = is_on_back ? node->back : node->front;
+    draw_node_t *far  = is_on_back ? node->front : node->back;
+    if (far) { dynarray_push(node_stack, far); }
+    if (near) { dynarray_push(node_stack, near); }
   }
+}
 
-  if (node->front) { render_node(node->front); }
-  if (node->back) { render_node(node->back); }
+// Gathers the leaves that draw anything, in tree order, for GPU culling
+void collect_leaves(draw_node_t *root, leafarray_t *leaves) {
+  node_stack.count = 0;
+  dynarray_push(node_stack, root);
+  while (node_stack.count > 0) {
+    draw_node_t *node = node_stack.data[--node_stack.count];
+
+    if (node->num_indices > 0) {
+      gpu_cull_leaf_t leaf = {
+          .min         = {node->min.x, node->min.y, node->min.z, 0.f},
+          .max         = {node->max.x, node->max.y, node->max.z, 0.f},
+          .first_index = node->first_index,
+          .num_indices = node->num_indices,
+      };
+      dynarray_push((*leaves), leaf);
+    }
+
+    if (node->back) { dynarray_push(node_stack, node->back); }
+    if (node->front) { dynarray_push(node_stack, node->front); }
+  }
 }
@@ -1,21 +1,94 @@
 #include "engine/meshgen.h"
+#include "arena.h"
 #include "dynarray.h"
-#include "engine/anim.h"
+#include "engine/cache.h"
 #include "engine/state.h"
-#include "engine/util.h"
 #include "flat_texture.h"
 #include "gl_map.h"
+#include "jobs.h"
 #include "map.h"
-#include "matrix.h"
+#include "mesh_optimize.h"
+#include "util.h"
 #include "vector.h"
 
 #include <GL/glew.h>
 #include <math.h>
 #include <stdbool.h>
-
-static void generate_node(draw_node_t **draw_node_ptr, size_t id);
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Leaves are generated by jobs of this many
+#define LEAVES_PER_JOB 256
+
+static void find_wall_runs();
+static void generate_tree();
+static void find_run_owners();
+static void generate_leaves(void *arg);
+static void join_arenas();
+static void grow_tree_bounds();
+
+// Every job generates its leaves into an arena of its own, with vertices,
+// indices and ranges counted from the start of the arena. The arenas are then
+// joined in leaf order, which gives the same mesh as one walk of the tree.
+typedef struct mesh_arena {
+  vertexarray_t vertices;
+  indexarray_t  indices;
+  dynarray(index_range_t) ranges;
+  dynarray(uint32_t) wall_refs;
+  dynarray(uint32_t) generated; // merged walls, whose ranges move along too
+  size_t num_wall_quads, num_unmerged_quads;
+  size_t num_clamped_flats;
+} mesh_arena_t;
+
+typedef struct leaf_job {
+  size_t       first, count; // into leaves
+  mesh_arena_t arena;
+  double       cpu_ms;
+} leaf_job_t;
+
+// The joined level mesh, and the range of every leaf and merged wall in it,
+// kept from generate_meshes until upload_meshes
+static vertexarray_t vertices;
+static indexarray_t  indices;
+static dynarray(index_range_t) ranges;
+
+// Every node, parents before children, and the leaves with a subsector in the
+// order of a front first walk
+static dynarray(draw_node_t *) nodes;
+static dynarray(draw_node_t *) leaves;
+static leaf_job_t *jobs;
+static size_t      num_jobs;
+
+// Segs of one sidedef that follow on from each other, in whichever subsectors
+// they are, make a run that is drawn as a single merged wall. The merged wall
+// has the run's index, and is generated by the first leaf to list it.
+typedef struct wall_run {
+  vec2_t   start, end;
+  float    offset;  // along the sidedef, of the start
+  uint32_t segment; // any seg of the run, for its line and side
+  uint32_t num_segs;
+  uint32_t owner; // the leaf that generates it
+} wall_run_t;
+
+static dynarray(wall_run_t) runs;
+static uint32_t *segment_runs; // MAP_NO_INDEX for segs not in a run
+static dynarray(merged_wall_t) walls;
+static dynarray(uint32_t) wall_refs;
+static size_t num_wall_quads, num_unmerged_quads, num_clamped_flats;
+
+// Mesh generation runs alongside the PVS jobs, and waiting for its own jobs
+// can run theirs on the same thread, so it is timed by the CPU time of its
+// own work rather than by the clock
+static double get_cpu_time_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
 
 void generate_meshes() {
+  double start_time = get_cpu_time_ms();
+
   max_sector_height = 0.f;
   for (int i = 0; i < map.num_sectors; i++) {
     if (map.sectors[i].ceiling > max_sector_height) {
@@ -24,313 +97,805 @@ void generate_meshes() {
   }
   max_sector_height += 1.f;
 
-  float  width = map.max.x - map.min.x, height = map.max.y - map.min.y;
-  vec3_t translate = {map.min.x, max_sector_height, map.max.y};
+  dynarray_init(walls, 0);
+  find_wall_runs();
+  generate_tree();
+  find_run_owners();
+  double cpu_ms = get_cpu_time_ms() - start_time;
 
-  mat4_t scale       = mat4_scale((vec3_t){width, height, 1.f});
-  mat4_t translation = mat4_translate(translate);
-  mat4_t rotation    = mat4_rotate((vec3_t){1.f, 0.f, 0.f}, M_PI / 2.f);
-  mat4_t model       = mat4_mul(scale, mat4_mul(rotation, translation));
-  insert_stencil_quad(model);
+  num_jobs = (leaves.count + LEAVES_PER_JOB - 1) / LEAVES_PER_JOB;
+  jobs     = calloc(num_jobs + 1, sizeof(leaf_job_t));
 
-  generate_node(&root_draw_node, gl_map.num_nodes - 1);
+  jobs_group_t group = {0};
+  for (size_t i = 0; i < num_jobs; i++) {
+    jobs[i].first = i * LEAVES_PER_JOB;
+    jobs[i].count = min(leaves.count - jobs[i].first, LEAVES_PER_JOB);
+
+    if (jobs_num_threads() > 0) {
+      jobs_submit_group(generate_leaves, &jobs[i], &group);
+    } else {
+      generate_leaves(&jobs[i]);
+    }
+  }
+  if (jobs_num_threads() > 0) { jobs_wait_group(&group); }
+
+  start_time = get_cpu_time_ms();
+  for (size_t i = 0; i < num_jobs; i++) {
+    cpu_ms += jobs[i].cpu_ms;
+  }
+
+  join_arenas();
+  grow_tree_bounds();
+
+  printf("Walls merged from %zu to %zu quads, level mesh has %zu triangles\n",
+         num_unmerged_quads, num_wall_quads, indices.count / 3);
+  if (num_clamped_flats > 0) {
+    fprintf(stderr, "Flat texture coordinates clamp in %zu subsectors\n",
+            num_clamped_flats);
+  }
+
+  mesh_stats_t before =
+      mesh_measure(vertices.count, indices.data, indices.count);
+  mesh_optimize(&vertices, &indices, ranges.data, ranges.count);
+  mesh_stats_t after =
+      mesh_measure(vertices.count, indices.data, indices.count);
+  printf("Level mesh welded from %zu to %zu vertices, ACMR %.3f to %.3f\n",
+         before.num_vertices, after.num_vertices, before.acmr, after.acmr);
+
+  // The merged walls and the lists of them stay with the level
+  num_merged_walls = walls.count;
+  num_leaf_walls   = wall_refs.count;
+  merged_walls     = arena_copy(&level_arena, walls.data,
+                                sizeof(merged_wall_t) * num_merged_walls);
+  leaf_walls       = arena_copy(&level_arena, wall_refs.data,
+                                sizeof(uint32_t) * num_leaf_walls);
+
+  free(walls.data);
+  free(wall_refs.data);
+  free(jobs);
+  free(nodes.data);
+  free(leaves.data);
+  free(ranges.data);
+  free(runs.data);
+  free(segment_runs);
+
+  cpu_ms += get_cpu_time_ms() - start_time;
+  printf("Level geometry took %.1f ms of CPU time in %zu jobs\n", cpu_ms,
+         num_jobs);
 }
 
-void generate_node(draw_node_t **draw_node_ptr, size_t id) {
-  draw_node_t *draw_node = malloc(sizeof(draw_node_t));
-  *draw_node             = (draw_node_t){NULL, NULL, NULL};
-  *draw_node_ptr         = draw_node;
+void upload_meshes() {
+  mesh_create(&level_mesh, VERTEX_LAYOUT_PACKED, vertices.count, vertices.data,
+              indices.count, indices.data);
+  cache_record_level(vertices.count, vertices.data, indices.count,
+                     indices.data);
 
-  if (id & 0x8000) {
-    gl_subsector_t *subsector = &gl_map.subsectors[id & 0x7fff];
-    draw_node->mesh           = malloc(sizeof(mesh_t));
+  free(vertices.data);
+  free(indices.data);
+}
 
-    vertexarray_t vertices;
-    indexarray_t  indices;
-    dynarray_init(vertices, 0);
-    dynarray_init(indices, 0);
+static void grow_bounds(vec3_t *box_min, vec3_t *box_max, vec3_t min,
+                        vec3_t max) {
+  box_min->x = min(box_min->x, min.x);
+  box_min->y = min(box_min->y, min.y);
+  box_min->z = min(box_min->z, min.z);
+  box_max->x = max(box_max->x, max.x);
+  box_max->y = max(box_max->y, max.y);
+  box_max->z = max(box_max->z, max.z);
+}
+
+static vec2_t vertex_position(uint32_t id) {
+  return id & VERT_IS_GL ? gl_map.vertices[id & ~VERT_IS_GL] : map.vertices[id];
+}
 
-    sector_t *the_sector = NULL;
-    size_t    n_vertices = subsector->num_segs;
-    if (n_vertices < 3) { return; }
+// How far along its sidedef a seg starts. Back sidedefs run from the end of
+// the line.
+static float segment_offset(const gl_segment_t *segment, vec2_t start) {
+  linedef_t *linedef = &map.linedefs[segment->linedef];
+  vec2_t     origin =
+      map.vertices[segment->side ? linedef->end_idx : linedef->start_idx];
 
-    vertex_t *floor_vertices = malloc(sizeof(vertex_t) * n_vertices);
-    vertex_t *ceil_vertices  = malloc(sizeof(vertex_t) * n_vertices);
+  vec2_t delta = vec2_sub(start, origin);
+  return sqrtf(delta.x * delta.x + delta.y * delta.y);
+}
 
-    size_t start_idx = 0;
-    for (int j = 0; j < subsector->num_segs; j++) {
-      gl_segment_t *segment = &gl_map.segments[j + subsector->first_seg];
+typedef struct segment_key {
+  uint32_t linedef, side;
+  float    offset;
+  uint32_t segment;
+} segment_key_t;
 
-      vec2_t start, end;
-      if (segment->start_vertex & VERT_IS_GL) {
-        start = gl_map.vertices[segment->start_vertex & 0x7fff];
-      } else {
-        start = map.vertices[segment->start_vertex];
+static int compare_segment_keys(const void *a, const void *b) {
+  const segment_key_t *key_a = a, *key_b = b;
+  if (key_a->linedef != key_b->linedef) {
+    return key_a->linedef < key_b->linedef ? -1 : 1;
+  }
+  if (key_a->side != key_b->side) { return key_a->side < key_b->side ? -1 : 1; }
+  if (key_a->offset != key_b->offset) {
+    return key_a->offset < key_b->offset ? -1 : 1;
+  }
+  return 0;
+}
+
+// Sorts the segs along their sidedefs, and makes a run of every two or more
+// that meet end to start. Segs of the same sidedef have the same walls, so
+// only where they meet matters.
+void find_wall_runs() {
+  segment_key_t *keys = malloc(sizeof(segment_key_t) * gl_map.num_segments);
+  size_t         num_keys = 0;
+
+  segment_runs = malloc(sizeof(uint32_t) * gl_map.num_segments);
+  for (size_t i = 0; i < gl_map.num_segments; i++) {
+    gl_segment_t *segment = &gl_map.segments[i];
+    segment_runs[i]       = MAP_NO_INDEX;
+    if (segment->linedef == MAP_NO_INDEX) { continue; }
+
+    vec2_t start     = vertex_position(segment->start_vertex);
+    keys[num_keys++] = (segment_key_t){segment->linedef, segment->side,
+                                       segment_offset(segment, start), i};
+  }
+  qsort(keys, num_keys, sizeof(segment_key_t), compare_segment_keys);
+
+  dynarray_init(runs, 0);
+  for (size_t i = 0, next; i < num_keys; i = next) {
+    vec2_t end = vertex_position(gl_map.segments[keys[i].segment].end_vertex);
+    for (next = i + 1; next < num_keys; next++) {
+      gl_segment_t *segment = &gl_map.segments[keys[next].segment];
+      vec2_t        start   = vertex_position(segment->start_vertex);
+      if (keys[next].linedef != keys[i].linedef ||
+          keys[next].side != keys[i].side || start.x != end.x ||
+          start.y != end.y) {
+        break;
       }
+      end = vertex_position(segment->end_vertex);
+    }
+    if (next - i < 2) { continue; }
 
-      if (segment->end_vertex & VERT_IS_GL) {
-        end = gl_map.vertices[segment->end_vertex & 0x7fff];
-      } else {
-        end = map.vertices[segment->end_vertex];
+    for (size_t j = i; j < next; j++) {
+      segment_runs[keys[j].segment] = runs.count;
+    }
+
+    gl_segment_t *first = &gl_map.segments[keys[i].segment];
+    wall_run_t    run   = {
+        .start    = vertex_position(first->start_vertex),
+        .end      = end,
+        .offset   = keys[i].offset,
+        .segment  = keys[i].segment,
+        .num_segs = next - i,
+        .owner    = MAP_NO_INDEX,
+    };
+    dynarray_push(runs, run);
+
+    merged_wall_t wall = {0};
+    dynarray_push(walls, wall);
+  }
+
+  free(keys);
+}
+
+// What the walls of a seg in a run take up, which its subsector's bounds have
+// to cover even though the merged wall is generated elsewhere
+static void grow_segment_bounds(draw_node_t *draw_node,
+                                const gl_segment_t *segment, vec2_t start,
+                                vec2_t end) {
+  linedef_t *linedef = &map.linedefs[segment->linedef];
+  bool       two_sided = linedef->flags & LINEDEF_FLAGS_TWO_SIDED;
+
+  uint32_t front_sidedef = linedef->front_sidedef;
+  uint32_t back_sidedef  = linedef->back_sidedef;
+  if (segment->side && two_sided) {
+    front_sidedef = linedef->back_sidedef;
+    back_sidedef  = linedef->front_sidedef;
+  }
+
+  sector_t *front  = &map.sectors[map.sidedefs[front_sidedef].sector_idx];
+  float     bottom = front->floor, top = front->ceiling;
+  if (two_sided) {
+    sector_t *back = &map.sectors[map.sidedefs[back_sidedef].sector_idx];
+    bottom         = min(bottom, back->floor);
+    top            = max(top, back->ceiling);
+  }
+  if (front->ceiling_tex == sky_flat) { top = max_sector_height; }
+
+  grow_bounds(&draw_node->min, &draw_node->max,
+              (vec3_t){min(start.x, end.x), bottom, min(start.y, end.y)},
+              (vec3_t){max(start.x, end.x), top, max(start.y, end.y)});
+}
+
+// The BSP of a large map can be deeper than the call stack allows, so the tree
+// is built from an explicit stack. Front children are popped first, which
+// keeps the leaves in the same order as a recursive walk.
+void generate_tree() {
+  typedef struct pending {
+    draw_node_t **draw_node_ptr;
+    uint32_t      id;
+  } pending_t;
+
+  // Every node pushes two children for the one it pops, so the stack never
+  // holds more than one entry per node plus the root
+  pending_t *stack = malloc(sizeof(pending_t) * (gl_map.num_nodes + 2));
+  size_t     count = 0;
+
+  dynarray_init(nodes, 0);
+  dynarray_init(leaves, 0);
+
+  uint32_t root_id = CHILD_IS_SUBSECTOR; // a map without nodes is one subsector
+  if (gl_map.num_nodes > 0) { root_id = gl_map.num_nodes - 1; }
+  stack[count++] = (pending_t){&root_draw_node, root_id};
+
+  while (count > 0) {
+    pending_t pending = stack[--count];
+
+    draw_node_t *draw_node = arena_alloc(&level_arena, sizeof(draw_node_t));
+    *draw_node             = DRAW_NODE_EMPTY;
+    *pending.draw_node_ptr = draw_node;
+    dynarray_push(nodes, draw_node);
+
+    if (pending.id & CHILD_IS_SUBSECTOR) {
+      uint32_t id = pending.id & ~CHILD_IS_SUBSECTOR;
+      if (id < gl_map.num_subsectors) {
+        draw_node->subsector = id;
+        dynarray_push(leaves, draw_node);
       }
+    } else if (pending.id < gl_map.num_nodes) {
+      gl_node_t *node            = &gl_map.nodes[pending.id];
+      draw_node->partition       = node->partition;
+      draw_node->delta_partition = node->delta_partition;
 
-      if (the_sector == NULL && segment->linedef != 0xffff) {
-        linedef_t *linedef    = &map.linedefs[segment->linedef];
-        int        sector_idx = -1;
-        if (linedef->flags & LINEDEF_FLAGS_TWO_SIDED && segment->side == 1) {
-          sector_idx = map.sidedefs[linedef->back_sidedef].sector_idx;
-        } else {
-          sector_idx = map.sidedefs[linedef->front_sidedef].sector_idx;
-        }
+      stack[count++] = (pending_t){&draw_node->back, node->back_child_id};
+      stack[count++] = (pending_t){&draw_node->front, node->front_child_id};
+    }
+  }
+
+  free(stack);
+}
 
-        if (sector_idx >= 0) { the_sector = &map.sectors[sector_idx]; }
+// A run's wall is generated by the first leaf with one of its segs, as it
+// would be by a serial walk of the tree
+void find_run_owners() {
+  for (size_t i = 0; i < leaves.count; i++) {
+    gl_subsector_t *subsector = &gl_map.subsectors[leaves.data[i]->subsector];
+    if (subsector->num_segs < 3) { continue; }
+
+    for (uint32_t j = 0; j < subsector->num_segs; j++) {
+      uint32_t run = segment_runs[subsector->first_seg + j];
+      if (run != MAP_NO_INDEX && runs.data[run].owner == MAP_NO_INDEX) {
+        runs.data[run].owner = i;
       }
+    }
+  }
+}
 
-      floor_vertices[j] = ceil_vertices[j] = (vertex_t){
-          .position     = {start.x, 0.f, start.y},
-          .tex_coords   = {start.x / FLAT_TEXTURE_SIZE,
-                           -start.y / FLAT_TEXTURE_SIZE},
-          .texture_type = 1,
-      };
+// Children are created after their parents, so going through the nodes
+// backwards grows every child's bounds before its parent's
+void grow_tree_bounds() {
+  for (size_t i = nodes.count; i-- > 0;) {
+    draw_node_t *draw_node = nodes.data[i];
+    if (draw_node->front) {
+      grow_bounds(&draw_node->min, &draw_node->max, draw_node->front->min,
+                  draw_node->front->max);
+    }
+    if (draw_node->back) {
+      grow_bounds(&draw_node->min, &draw_node->max, draw_node->back->min,
+                  draw_node->back->max);
+    }
+  }
+}
+
+static void push_quad(mesh_arena_t *arena, const vertex_t v[4]) {
+  arena->num_wall_quads++;
 
-      if (segment->linedef == 0xffff) { continue; }
-      linedef_t *linedef = &map.linedefs[segment->linedef];
+  size_t start_idx = arena->vertices.count;
+  for (int i = 0; i < 4; i++) {
+    dynarray_push(arena->vertices, v[i]);
+  }
+
+  dynarray_push(arena->indices, start_idx + 0);
+  dynarray_push(arena->indices, start_idx + 1);
+  dynarray_push(arena->indices, start_idx + 3);
+  dynarray_push(arena->indices, start_idx + 1);
+  dynarray_push(arena->indices, start_idx + 2);
+  dynarray_push(arena->indices, start_idx + 3);
+}
 
-      sidedef_t *front_sidedef = &map.sidedefs[linedef->front_sidedef];
-      sidedef_t *back_sidedef  = &map.sidedefs[linedef->back_sidedef];
+// Walls run from p[0], at the bottom of their start, round to p[3], with
+// texture coordinates in repeats of the texture. Whole repeats are taken off,
+// which the shader's wrapping does not see, so that the texels fit the packed
+// vertex.
+static void add_wall_piece(mesh_arena_t *arena, const vec3_t p[4], vec2_t t0,
+                           vec2_t t1, int texture, int light) {
+  float tw = wall_textures_info[texture].width;
+  float th = wall_textures_info[texture].height;
+
+  float repeat_x = floorf(min(t0.x, t1.x)), repeat_y = floorf(min(t0.y, t1.y));
+  t0 = (vec2_t){(t0.x - repeat_x) * tw, (t0.y - repeat_y) * th};
+  t1 = (vec2_t){(t1.x - repeat_x) * tw, (t1.y - repeat_y) * th};
+
+  vertex_t v[] = {
+      vertex_pack(p[0], t0, texture, 2, light),
+      vertex_pack(p[1], (vec2_t){t1.x, t0.y}, texture, 2, light),
+      vertex_pack(p[2], t1, texture, 2, light),
+      vertex_pack(p[3], (vec2_t){t0.x, t1.y}, texture, 2, light),
+  };
+  push_quad(arena, v);
+}
+
+// How many pieces a wall spanning this many texels is split into. A piece
+// starts and ends at whole repeats, up to half a repeat further out than an
+// even split, and once the whole repeats are taken off it starts up to one
+// repeat in.
+static int wall_pieces(float span, float size) {
+  float limit = VERTEX_COORD_MAX - 2.f * size - 1.f;
+  if (limit < size) { return 1; }
+  return max((int)ceilf(span / limit), 1);
+}
+
+// How far from t0 to t1 the k-th of n pieces starts, with the texture
+// coordinate it starts at in repeats
+static float wall_split(float t0, float t1, int k, int n, float *t) {
+  if (k == 0) {
+    *t = t0;
+    return 0.f;
+  }
+  if (k == n) {
+    *t = t1;
+    return 1.f;
+  }
+
+  *t = roundf(t0 + (t1 - t0) * k / n);
+  return (*t - t0) / (t1 - t0);
+}
+
+// The point of a wall at a fraction of the way along it and up it
+static vec3_t wall_point(const vec3_t p[4], float along, float up) {
+  vec3_t bottom = vec3_add(p[0], vec3_scale(vec3_sub(p[1], p[0]), along));
+  vec3_t top    = vec3_add(p[3], vec3_scale(vec3_sub(p[2], p[3]), along));
+  return vec3_add(bottom, vec3_scale(vec3_sub(top, bottom), up));
+}
 
-      if (segment->side) {
-        sidedef_t *tmp = front_sidedef;
-        front_sidedef  = back_sidedef;
-        back_sidedef   = tmp;
+// Walls too long or too tall for their texels to fit the packed vertex are
+// split into pieces that fit
+static void add_wall(mesh_arena_t *arena, const vec3_t p[4], vec2_t t0,
+                     vec2_t t1, int texture, int light) {
+  float tw = wall_textures_info[texture].width;
+  float th = wall_textures_info[texture].height;
+
+  int pieces_x = wall_pieces(fabsf(t1.x - t0.x) * tw, tw);
+  int pieces_y = wall_pieces(fabsf(t1.y - t0.y) * th, th);
+  if (pieces_x == 1 && pieces_y == 1) {
+    add_wall_piece(arena, p, t0, t1, texture, light);
+    return;
+  }
+
+  for (int i = 0; i < pieces_x; i++) {
+    vec2_t piece_t0, piece_t1;
+    float  x0 = wall_split(t0.x, t1.x, i, pieces_x, &piece_t0.x);
+    float  x1 = wall_split(t0.x, t1.x, i + 1, pieces_x, &piece_t1.x);
+
+    for (int j = 0; j < pieces_y; j++) {
+      float y0 = wall_split(t0.y, t1.y, j, pieces_y, &piece_t0.y);
+      float y1 = wall_split(t0.y, t1.y, j + 1, pieces_y, &piece_t1.y);
+
+      vec3_t piece[] = {wall_point(p, x0, y0), wall_point(p, x1, y0),
+                        wall_point(p, x1, y1), wall_point(p, x0, y1)};
+      add_wall_piece(arena, piece, piece_t0, piece_t1, texture, light);
+    }
+  }
+}
+
+// Texture type 3 is the sky, which the shader looks up by direction in the sky
+// texture, at full brightness. Without a sky texture it is left out.
+static vertex_t sky_vertex(vec3_t position) {
+  return vertex_pack(position, (vec2_t){0.f, 0.f}, sky_texture, 3, 0);
+}
+
+// Walls of sectors with a sky ceiling go on up to the top of the map as sky,
+// which hides whatever is taller behind them
+static void add_sky_wall(mesh_arena_t *arena, vec2_t start, vec2_t end,
+                         float bottom) {
+  vec3_t p0 = {start.x, bottom, start.y};
+  vec3_t p1 = {end.x, bottom, end.y};
+  vec3_t p2 = {end.x, max_sector_height, end.y};
+  vec3_t p3 = {start.x, max_sector_height, start.y};
+
+  vertex_t v[] = {sky_vertex(p0), sky_vertex(p1), sky_vertex(p2),
+                  sky_vertex(p3)};
+  push_quad(arena, v);
+}
+
+// Walls of one seg, or of a run of segs, from start to end. The offset is how
+// far along the sidedef the start is, which continues its texture.
+static void add_segment_walls(mesh_arena_t *arena, const gl_segment_t *segment,
+                              vec2_t start, vec2_t end, float offset) {
+  linedef_t *linedef = &map.linedefs[segment->linedef];
+
+  bool       two_sided     = linedef->flags & LINEDEF_FLAGS_TWO_SIDED;
+  sidedef_t *front_sidedef = &map.sidedefs[linedef->front_sidedef];
+  sidedef_t *back_sidedef  = NULL;
+  if (two_sided) { back_sidedef = &map.sidedefs[linedef->back_sidedef]; }
+
+  if (segment->side && two_sided) {
+    sidedef_t *tmp = front_sidedef;
+    front_sidedef  = back_sidedef;
+    back_sidedef   = tmp;
+  }
+
+  // One-sided lines have no back sidedef, so they have no back sector
+  sector_t *front_sector = &map.sectors[front_sidedef->sector_idx];
+  sector_t *back_sector  = NULL;
+  if (two_sided) { back_sector = &map.sectors[back_sidedef->sector_idx]; }
+
+  sidedef_t *sidedef = front_sidedef;
+  sector_t  *sector  = front_sector;
+
+  if (two_sided) {
+    if (sidedef->lower >= 0 && front_sector->floor < back_sector->floor) {
+      vec3_t p0 = {start.x, front_sector->floor, start.y};
+      vec3_t p1 = {end.x, front_sector->floor, end.y};
+      vec3_t p2 = {end.x, back_sector->floor, end.y};
+      vec3_t p3 = {start.x, back_sector->floor, start.y};
+
+      const float x = p1.x - p0.x, y = p1.z - p0.z;
+      const float width = sqrtf(x * x + y * y), height = fabsf(p3.y - p0.y);
+
+      float tw = wall_textures_info[sidedef->lower].width;
+      float th = wall_textures_info[sidedef->lower].height;
+
+      float w = width / tw, h = height / th;
+      float x_off = (sidedef->x_off + offset) / tw;
+      float y_off = sidedef->y_off / th;
+      if (linedef->flags & LINEDEF_FLAGS_LOWER_UNPEGGED) {
+        y_off += (front_sector->ceiling - back_sector->floor) / th;
       }
 
-      sector_t *front_sector = &map.sectors[front_sidedef->sector_idx];
-      sector_t *back_sector  = &map.sectors[back_sidedef->sector_idx];
-
-      sidedef_t *sidedef = front_sidedef;
-      sector_t  *sector  = front_sector;
-
-      if (linedef->flags & LINEDEF_FLAGS_TWO_SIDED) {
-        if (sidedef->lower >= 0 && front_sector->floor < back_sector->floor) {
-          vec3_t p0 = {start.x, front_sector->floor, start.y};
-          vec3_t p1 = {end.x, front_sector->floor, end.y};
-          vec3_t p2 = {end.x, back_sector->floor, end.y};
-          vec3_t p3 = {start.x, back_sector->floor, start.y};
-
-          const float x = p1.x - p0.x, y = p1.z - p0.z;
-          const float width = sqrtf(x * x + y * y), height = fabsf(p3.y - p0.y);
-
-          float tw = wall_textures_info[sidedef->lower].width;
-          float th = wall_textures_info[sidedef->lower].height;
-
-          float w = width / tw, h = height / th;
-          float x_off = sidedef->x_off / tw, y_off = sidedef->y_off / th;
-          if (linedef->flags & LINEDEF_FLAGS_LOWER_UNPEGGED) {
-            y_off += (front_sector->ceiling - back_sector->floor) / th;
-          }
-
-          float tx0 = x_off, ty0 = y_off + h;
-          float tx1 = x_off + w, ty1 = y_off;
-
-          vec2_t max_coords = wall_max_coords[sidedef->lower];
-          tx0 *= max_coords.x, tx1 *= max_coords.x;
-          ty0 *= max_coords.y, ty1 *= max_coords.y;
-
-          float    light = front_sector->light_level / 256.f;
-          vertex_t v[]   = {
-              {p0, {tx0, ty0}, sidedef->lower, 2, light, max_coords},
-              {p1, {tx1, ty0}, sidedef->lower, 2, light, max_coords},
-              {p2, {tx1, ty1}, sidedef->lower, 2, light, max_coords},
-              {p3, {tx0, ty1}, sidedef->lower, 2, light, max_coords},
-          };
-
-          start_idx = vertices.count;
-          for (int i = 0; i < 4; i++) {
-            dynarray_push(vertices, v[i]);
-          }
-
-          dynarray_push(indices, start_idx + 0);
-          dynarray_push(indices, start_idx + 1);
-          dynarray_push(indices, start_idx + 3);
-          dynarray_push(indices, start_idx + 1);
-          dynarray_push(indices, start_idx + 2);
-          dynarray_push(indices, start_idx + 3);
-        }
+      float tx0 = x_off, ty0 = y_off + h;
+      float tx1 = x_off + w, ty1 = y_off;
 
-        if (sidedef->upper >= 0 &&
-            front_sector->ceiling > back_sector->ceiling &&
-            !(front_sector->ceiling_tex == sky_flat &&
-              back_sector->ceiling_tex == sky_flat)) {
-          vec3_t p0 = {start.x, back_sector->ceiling, start.y};
-          vec3_t p1 = {end.x, back_sector->ceiling, end.y};
-          vec3_t p2 = {end.x, front_sector->ceiling, end.y};
-          vec3_t p3 = {start.x, front_sector->ceiling, start.y};
-
-          const float x = p1.x - p0.x, y = p1.z - p0.z;
-          const float width  = sqrtf(x * x + y * y),
-                      height = -fabsf(p3.y - p0.y);
-
-          float tw = wall_textures_info[sidedef->upper].width;
-          float th = wall_textures_info[sidedef->upper].height;
-
-          float w = width / tw, h = height / th;
-          float x_off = sidedef->x_off / tw, y_off = sidedef->y_off / th;
-          if (linedef->flags & LINEDEF_FLAGS_UPPER_UNPEGGED) { y_off -= h; }
-
-          float tx0 = x_off, ty0 = y_off;
-          float tx1 = x_off + w, ty1 = y_off + h;
-
-          vec2_t max_coords = wall_max_coords[sidedef->upper];
-          tx0 *= max_coords.x, tx1 *= max_coords.x;
-          ty0 *= max_coords.y, ty1 *= max_coords.y;
-
-          float    light = front_sector->light_level / 256.f;
-          vertex_t v[]   = {
-              {p0, {tx0, ty0}, sidedef->upper, 2, light, max_coords},
-              {p1, {tx1, ty0}, sidedef->upper, 2, light, max_coords},
-              {p2, {tx1, ty1}, sidedef->upper, 2, light, max_coords},
-              {p3, {tx0, ty1}, sidedef->upper, 2, light, max_coords},
-          };
-
-          start_idx = vertices.count;
-          for (int i = 0; i < 4; i++) {
-            dynarray_push(vertices, v[i]);
-          }
-
-          dynarray_push(indices, start_idx + 0);
-          dynarray_push(indices, start_idx + 1);
-          dynarray_push(indices, start_idx + 3);
-          dynarray_push(indices, start_idx + 1);
-          dynarray_push(indices, start_idx + 2);
-          dynarray_push(indices, start_idx + 3);
-
-          if (sector->ceiling_tex == sky_flat) {
-            float  quad_height = max_sector_height - p3.y;
-            mat4_t scale       = mat4_scale((vec3_t){width, quad_height, 1.f});
-            mat4_t translation = mat4_translate(p3);
-            mat4_t rotation =
-                mat4_rotate((vec3_t){0.f, 1.f, 0.f}, atan2f(y, x));
-            mat4_t model = mat4_mul(scale, mat4_mul(rotation, translation));
-
-            insert_stencil_quad(model);
-          }
-        }
-      } else {
-        vec3_t p0 = {start.x, sector->floor, start.y};
-        vec3_t p1 = {end.x, sector->floor, end.y};
-        vec3_t p2 = {end.x, sector->ceiling, end.y};
-        vec3_t p3 = {start.x, sector->ceiling, start.y};
-
-        const float x = p1.x - p0.x, y = p1.z - p0.z;
-        const float width = sqrtf(x * x + y * y), height = p3.y - p0.y;
-
-        float tw = wall_textures_info[sidedef->middle].width;
-        float th = wall_textures_info[sidedef->middle].height;
-
-        float w = width / tw, h = height / th;
-        float x_off = sidedef->x_off / tw, y_off = sidedef->y_off / th;
-        if (linedef->flags & LINEDEF_FLAGS_LOWER_UNPEGGED) { y_off -= h; }
-
-        float tx0 = x_off, ty0 = y_off + h;
-        float tx1 = x_off + w, ty1 = y_off;
-
-        vec2_t max_coords = wall_max_coords[sidedef->middle];
-        tx0 *= max_coords.x, tx1 *= max_coords.x;
-        ty0 *= max_coords.y, ty1 *= max_coords.y;
-
-        float    light = sector->light_level / 256.f;
-        vertex_t v[]   = {
-            {p0, {tx0, ty0}, sidedef->middle, 2, light, max_coords},
-            {p1, {tx1, ty0}, sidedef->middle, 2, light, max_coords},
-            {p2, {tx1, ty1}, sidedef->middle, 2, light, max_coords},
-            {p3, {tx0, ty1}, sidedef->middle, 2, light, max_coords},
-        };
-
-        start_idx = vertices.count;
-        for (int i = 0; i < 4; i++) {
-          dynarray_push(vertices, v[i]);
-        }
+      vec3_t p[] = {p0, p1, p2, p3};
+      add_wall(arena, p, (vec2_t){tx0, ty0}, (vec2_t){tx1, ty1}, sidedef->lower,
+               front_sector->light_level);
+    }
 
-        dynarray_push(indices, start_idx + 0);
-        dynarray_push(indices, start_idx + 1);
-        dynarray_push(indices, start_idx + 3);
-        dynarray_push(indices, start_idx + 1);
-        dynarray_push(indices, start_idx + 2);
-        dynarray_push(indices, start_idx + 3);
-
-        if (sector->ceiling_tex == sky_flat) {
-          float  quad_height = max_sector_height - p3.y;
-          mat4_t scale       = mat4_scale((vec3_t){width, quad_height, 1.f});
-          mat4_t translation = mat4_translate(p3);
-          mat4_t rotation = mat4_rotate((vec3_t){0.f, 1.f, 0.f}, atan2f(y, x));
-          mat4_t model    = mat4_mul(scale, mat4_mul(rotation, translation));
-
-          insert_stencil_quad(model);
-        }
+    if (sidedef->upper >= 0 &&
+        front_sector->ceiling > back_sector->ceiling &&
+        !(front_sector->ceiling_tex == sky_flat &&
+          back_sector->ceiling_tex == sky_flat)) {
+      vec3_t p0 = {start.x, back_sector->ceiling, start.y};
+      vec3_t p1 = {end.x, back_sector->ceiling, end.y};
+      vec3_t p2 = {end.x, front_sector->ceiling, end.y};
+      vec3_t p3 = {start.x, front_sector->ceiling, start.y};
+
+      const float x = p1.x - p0.x, y = p1.z - p0.z;
+      const float width  = sqrtf(x * x + y * y),
+                  height = -fabsf(p3.y - p0.y);
+
+      float tw = wall_textures_info[sidedef->upper].width;
+      float th = wall_textures_info[sidedef->upper].height;
+
+      float w = width / tw, h = height / th;
+      float x_off = (sidedef->x_off + offset) / tw;
+      float y_off = sidedef->y_off / th;
+      if (linedef->flags & LINEDEF_FLAGS_UPPER_UNPEGGED) { y_off -= h; }
+
+      float tx0 = x_off, ty0 = y_off;
+      float tx1 = x_off + w, ty1 = y_off + h;
+
+      vec3_t p[] = {p0, p1, p2, p3};
+      add_wall(arena, p, (vec2_t){tx0, ty0}, (vec2_t){tx1, ty1}, sidedef->upper,
+               front_sector->light_level);
+
+      if (sector->ceiling_tex == sky_flat) {
+        add_sky_wall(arena, start, end, p3.y);
       }
     }
+  } else {
+    vec3_t p0 = {start.x, sector->floor, start.y};
+    vec3_t p1 = {end.x, sector->floor, end.y};
+    vec3_t p2 = {end.x, sector->ceiling, end.y};
+    vec3_t p3 = {start.x, sector->ceiling, start.y};
+
+    const float x = p1.x - p0.x, y = p1.z - p0.z;
+    const float width = sqrtf(x * x + y * y), height = p3.y - p0.y;
+
+    float tw = wall_textures_info[sidedef->middle].width;
+    float th = wall_textures_info[sidedef->middle].height;
 
-    int floor_tex = the_sector->floor_tex, ceil_tex = the_sector->ceiling_tex;
-    for (int i = 0; i < n_vertices; i++) {
-      floor_vertices[i].position.y = the_sector->floor;
-      floor_vertices[i].texture_index =
-          floor_tex >= 0 && floor_tex < num_flats ? floor_tex : -1;
+    float w = width / tw, h = height / th;
+    float x_off = (sidedef->x_off + offset) / tw;
+    float y_off = sidedef->y_off / th;
+    if (linedef->flags & LINEDEF_FLAGS_LOWER_UNPEGGED) { y_off -= h; }
 
-      ceil_vertices[i].position.y = the_sector->ceiling;
-      ceil_vertices[i].texture_index =
-          ceil_tex >= 0 && ceil_tex < num_flats ? ceil_tex : -1;
+    float tx0 = x_off, ty0 = y_off + h;
+    float tx1 = x_off + w, ty1 = y_off;
 
-      floor_vertices[i].light = ceil_vertices[i].light =
-          the_sector->light_level / 256.f;
+    vec3_t p[] = {p0, p1, p2, p3};
+    add_wall(arena, p, (vec2_t){tx0, ty0}, (vec2_t){tx1, ty1}, sidedef->middle,
+             sector->light_level);
+
+    if (sector->ceiling_tex == sky_flat) {
+      add_sky_wall(arena, start, end, p3.y);
     }
+  }
+}
+
+// Generates a run's walls from its start to its end, as its own range
+static void generate_merged_wall(mesh_arena_t *arena, uint32_t id) {
+  wall_run_t    *run  = &runs.data[id];
+  merged_wall_t *wall = &walls.data[id];
+
+  size_t first_index  = arena->indices.count;
+  size_t first_vertex = arena->vertices.count;
+  size_t num_quads    = arena->num_wall_quads;
+  add_segment_walls(arena, &gl_map.segments[run->segment], run->start,
+                    run->end, run->offset);
+  arena->num_unmerged_quads +=
+      (arena->num_wall_quads - num_quads) * run->num_segs;
+
+  *wall = (merged_wall_t){
+      .first_index = first_index,
+      .num_indices = arena->indices.count - first_index,
+      .min         = {INFINITY, INFINITY, INFINITY},
+      .max         = {-INFINITY, -INFINITY, -INFINITY},
+  };
+  for (size_t i = first_vertex; i < arena->vertices.count; i++) {
+    vec3_t position = arena->vertices.data[i].position;
+    grow_bounds(&wall->min, &wall->max, position, position);
+  }
 
-    start_idx = vertices.count;
-    for (int i = 0; i < n_vertices; i++) {
-      dynarray_push(vertices, floor_vertices[i]);
+  if (wall->num_indices > 0) {
+    index_range_t range = {wall->first_index, wall->num_indices};
+    dynarray_push(arena->ranges, range);
+  }
+  dynarray_push(arena->generated, id);
+}
+
+// The whole repeat of a flat that a point is in
+static vec2_t flat_origin(vec2_t point) {
+  return (vec2_t){floorf(point.x / FLAT_TEXTURE_SIZE) * FLAT_TEXTURE_SIZE,
+                  floorf(point.y / FLAT_TEXTURE_SIZE) * FLAT_TEXTURE_SIZE};
+}
+
+static bool flat_fits(vec2_t box_min, vec2_t box_max, vec2_t origin) {
+  return box_min.x - origin.x >= -VERTEX_COORD_MAX &&
+         box_max.x - origin.x <= VERTEX_COORD_MAX &&
+         box_min.y - origin.y >= -VERTEX_COORD_MAX &&
+         box_max.y - origin.y <= VERTEX_COORD_MAX;
+}
+
+// Generates a leaf's flats and unmerged walls as its range, followed by the
+// merged walls it owns
+static void generate_subsector(mesh_arena_t *arena, draw_node_t *draw_node,
+                               uint32_t leaf) {
+  gl_subsector_t *subsector = &gl_map.subsectors[draw_node->subsector];
+
+  sector_t *the_sector = NULL;
+  size_t    n_vertices = subsector->num_segs;
+  if (n_vertices < 3) { return; }
+
+  size_t first_index  = arena->indices.count;
+  size_t first_vertex = arena->vertices.count;
+
+  vertex_t *floor_vertices = malloc(sizeof(vertex_t) * n_vertices);
+  vertex_t *ceil_vertices  = malloc(sizeof(vertex_t) * n_vertices);
+
+  // Runs the segs belong to, each once
+  uint32_t *listed     = malloc(sizeof(uint32_t) * n_vertices);
+  size_t    num_listed = 0;
+
+  size_t start_idx = 0;
+  for (int j = 0; j < subsector->num_segs; j++) {
+    gl_segment_t *segment = &gl_map.segments[j + subsector->first_seg];
+
+    vec2_t start = vertex_position(segment->start_vertex);
+    vec2_t end   = vertex_position(segment->end_vertex);
+
+    if (the_sector == NULL && segment->linedef != MAP_NO_INDEX) {
+      linedef_t *linedef    = &map.linedefs[segment->linedef];
+      int        sector_idx = -1;
+      if (linedef->flags & LINEDEF_FLAGS_TWO_SIDED && segment->side == 1) {
+        sector_idx = map.sidedefs[linedef->back_sidedef].sector_idx;
+      } else {
+        sector_idx = map.sidedefs[linedef->front_sidedef].sector_idx;
+      }
+
+      if (sector_idx >= 0) { the_sector = &map.sectors[sector_idx]; }
     }
 
-    for (int i = 0; i < n_vertices; i++) {
-      dynarray_push(vertices, ceil_vertices[i]);
+    floor_vertices[j].position = (vec3_t){start.x, 0.f, start.y};
+
+    if (segment->linedef == MAP_NO_INDEX) { continue; }
+
+    uint32_t run = segment_runs[j + subsector->first_seg];
+    if (run == MAP_NO_INDEX) {
+      size_t num_quads = arena->num_wall_quads;
+      add_segment_walls(arena, segment, start, end,
+                        segment_offset(segment, start));
+      arena->num_unmerged_quads += arena->num_wall_quads - num_quads;
+      continue;
     }
 
-    for (int i = 0; i < num_tex_anim_defs; i++) {
-      if (floor_tex >= tex_anim_defs[i].start &&
-          floor_tex <= tex_anim_defs[i].end) {
-        add_tex_anim(draw_node->mesh, start_idx, start_idx + n_vertices,
-                     tex_anim_defs[i].start, tex_anim_defs[i].end);
-      }
+    grow_segment_bounds(draw_node, segment, start, end);
 
-      if (ceil_tex >= tex_anim_defs[i].start &&
-          ceil_tex <= tex_anim_defs[i].end) {
-        add_tex_anim(draw_node->mesh, start_idx + n_vertices,
-                     start_idx + 2 * n_vertices, tex_anim_defs[i].start,
-                     tex_anim_defs[i].end);
-      }
+    bool is_listed = false;
+    for (size_t i = 0; i < num_listed; i++) {
+      is_listed = is_listed || listed[i] == run;
+    }
+    if (!is_listed) { listed[num_listed++] = run; }
+  }
+
+  int floor_tex = the_sector->floor_tex, ceil_tex = the_sector->ceiling_tex;
+  if (floor_tex < 0 || floor_tex >= num_flats) { floor_tex = -1; }
+  if (ceil_tex < 0 || ceil_tex >= num_flats) { ceil_tex = -1; }
+
+  // Flat texels are map units, so whole repeats are taken off here too. When
+  // that leaves texels too far from the first vertex for the packed vertex,
+  // they are taken from around the middle of the subsector instead, which
+  // only clamps on subsectors over twice VERTEX_COORD_MAX across.
+  vec2_t flat_min = {INFINITY, INFINITY}, flat_max = {-INFINITY, -INFINITY};
+  for (int i = 0; i < n_vertices; i++) {
+    vec3_t position = floor_vertices[i].position;
+    flat_min.x      = min(flat_min.x, position.x);
+    flat_min.y      = min(flat_min.y, -position.z);
+    flat_max.x      = max(flat_max.x, position.x);
+    flat_max.y      = max(flat_max.y, -position.z);
+  }
+
+  vec2_t origin = {floor_vertices[0].position.x,
+                   -floor_vertices[0].position.z};
+  if (!flat_fits(flat_min, flat_max, flat_origin(origin))) {
+    origin = (vec2_t){(flat_min.x + flat_max.x) / 2.f,
+                      (flat_min.y + flat_max.y) / 2.f};
+    if (!flat_fits(flat_min, flat_max, flat_origin(origin))) {
+      arena->num_clamped_flats++;
     }
+  }
+  origin = flat_origin(origin);
+
+  int light = the_sector->light_level;
+  for (int i = 0; i < n_vertices; i++) {
+    vec3_t floor_position = floor_vertices[i].position;
+    floor_position.y      = the_sector->floor;
+    vec3_t ceil_position  = floor_position;
+    ceil_position.y       = the_sector->ceiling;
+
+    vec2_t tex_coords = {floor_position.x - origin.x,
+                         -floor_position.z - origin.y};
+    floor_vertices[i] =
+        vertex_pack(floor_position, tex_coords, floor_tex, 1, light);
+    ceil_vertices[i] =
+        the_sector->ceiling_tex == sky_flat
+            ? sky_vertex(ceil_position)
+            : vertex_pack(ceil_position, tex_coords, ceil_tex, 1, light);
+  }
 
-    // Triangulation will form (n - 2) triangles, so 2*3*(n - 2) indices are
-    // required
-    for (int j = 0, k = 1; j < n_vertices - 2; j++, k++) {
-      dynarray_push(indices, start_idx + 0);
-      dynarray_push(indices, start_idx + k + 1);
-      dynarray_push(indices, start_idx + k);
+  start_idx = arena->vertices.count;
+  for (int i = 0; i < n_vertices; i++) {
+    dynarray_push(arena->vertices, floor_vertices[i]);
+  }
+
+  for (int i = 0; i < n_vertices; i++) {
+    dynarray_push(arena->vertices, ceil_vertices[i]);
+  }
 
-      dynarray_push(indices, start_idx + n_vertices);
-      dynarray_push(indices, start_idx + n_vertices + k);
-      dynarray_push(indices, start_idx + n_vertices + k + 1);
+  // Triangulation will form (n - 2) triangles, so 2*3*(n - 2) indices are
+  // required
+  for (int j = 0, k = 1; j < n_vertices - 2; j++, k++) {
+    dynarray_push(arena->indices, start_idx + 0);
+    dynarray_push(arena->indices, start_idx + k + 1);
+    dynarray_push(arena->indices, start_idx + k);
+
+    dynarray_push(arena->indices, start_idx + n_vertices);
+    dynarray_push(arena->indices, start_idx + n_vertices + k);
+    dynarray_push(arena->indices, start_idx + n_vertices + k + 1);
+  }
+
+  free(floor_vertices);
+  free(ceil_vertices);
+
+  draw_node->first_index = first_index;
+  draw_node->num_indices = arena->indices.count - first_index;
+
+  index_range_t range = {draw_node->first_index, draw_node->num_indices};
+  dynarray_push(arena->ranges, range);
+
+  for (size_t i = first_vertex; i < arena->vertices.count; i++) {
+    vec3_t position = arena->vertices.data[i].position;
+    grow_bounds(&draw_node->min, &draw_node->max, position, position);
+  }
+
+  // A merged wall follows the range of the first leaf that lists it, so that
+  // the two are usually drawn together. Until the arenas are joined, leaves
+  // list their walls in their arena.
+  draw_node->first_wall = arena->wall_refs.count;
+  for (size_t i = 0; i < num_listed; i++) {
+    if (runs.data[listed[i]].owner == leaf) {
+      generate_merged_wall(arena, listed[i]);
     }
+    dynarray_push(arena->wall_refs, listed[i]);
+  }
+  draw_node->num_walls = arena->wall_refs.count - draw_node->first_wall;
 
-    free(floor_vertices);
-    free(ceil_vertices);
+  free(listed);
+}
 
-    mesh_create(draw_node->mesh, VERTEX_LAYOUT_FULL, vertices.count,
-                vertices.data, indices.count, indices.data, true);
-    dynarray_free(vertices);
-    dynarray_free(indices);
-  } else {
-    gl_node_t *node = &gl_map.nodes[id];
-    generate_node(&draw_node->front, node->front_child_id);
-    generate_node(&draw_node->back, node->back_child_id);
+static void generate_leaves(void *arg) {
+  leaf_job_t   *job        = arg;
+  mesh_arena_t *arena      = &job->arena;
+  double        start_time = get_cpu_time_ms();
+
+  dynarray_init(arena->vertices, 0);
+  dynarray_init(arena->indices, 0);
+  dynarray_init(arena->ranges, 0);
+  dynarray_init(arena->wall_refs, 0);
+  dynarray_init(arena->generated, 0);
+
+  for (size_t i = job->first; i < job->first + job->count; i++) {
+    generate_subsector(arena, leaves.data[i], i);
+  }
+
+  job->cpu_ms = get_cpu_time_ms() - start_time;
+}
+
+// Appends the arenas in leaf order, moving what they index along by what the
+// arenas before them hold. Every merged wall is generated by now, so the empty
+// ones are left off the leaves' lists here.
+void join_arenas() {
+  size_t total_vertices = 0, total_indices = 0, total_ranges = 0;
+  for (size_t i = 0; i < num_jobs; i++) {
+    total_vertices += jobs[i].arena.vertices.count;
+    total_indices += jobs[i].arena.indices.count;
+    total_ranges += jobs[i].arena.ranges.count;
+  }
+
+  dynarray_init(vertices, total_vertices + 1);
+  dynarray_init(indices, total_indices + 1);
+  dynarray_init(ranges, total_ranges + 1);
+  dynarray_init(wall_refs, 0);
+  num_wall_quads = num_unmerged_quads = num_clamped_flats = 0;
+
+  for (size_t i = 0; i < num_jobs; i++) {
+    mesh_arena_t *arena = &jobs[i].arena;
+
+    uint32_t vertex_offset = vertices.count, index_offset = indices.count;
+    memcpy(&vertices.data[vertices.count], arena->vertices.data,
+           sizeof(vertex_t) * arena->vertices.count);
+    vertices.count += arena->vertices.count;
+
+    for (size_t j = 0; j < arena->indices.count; j++) {
+      indices.data[indices.count++] = arena->indices.data[j] + vertex_offset;
+    }
+    for (size_t j = 0; j < arena->ranges.count; j++) {
+      index_range_t range = arena->ranges.data[j];
+      range.first += index_offset;
+      ranges.data[ranges.count++] = range;
+    }
+    for (size_t j = 0; j < arena->generated.count; j++) {
+      walls.data[arena->generated.data[j]].first_index += index_offset;
+    }
+
+    for (size_t j = jobs[i].first; j < jobs[i].first + jobs[i].count; j++) {
+      draw_node_t *leaf = leaves.data[j];
+      if (leaf->num_indices > 0) { leaf->first_index += index_offset; }
+
+      uint32_t first_wall = leaf->first_wall;
+      leaf->first_wall    = wall_refs.count;
+      for (uint32_t k = 0; k < leaf->num_walls; k++) {
+        uint32_t wall = arena->wall_refs.data[first_wall + k];
+        if (walls.data[wall].num_indices > 0) {
+          dynarray_push(wall_refs, wall);
+        }
+      }
+      leaf->num_walls = wall_refs.count - leaf->first_wall;
+    }
+
+    num_wall_quads += arena->num_wall_quads;
+    num_unmerged_quads += arena->num_unmerged_quads;
+    num_clamped_flats += arena->num_clamped_flats;
+
+    free(arena->vertices.data);
+    free(arena->indices.data);
+    free(arena->ranges.data);
+    free(arena->wall_refs.data);
+    free(arena->generated.data);
   }
 }
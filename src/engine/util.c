@@ -6,24 +6,12 @@
 
 #include <stdbool.h>
 
-void insert_stencil_quad(mat4_t transformation) {
-  if (stencil_list.head == NULL) {
-    stencil_list.head  = malloc(sizeof(stencil_node_t));
-    *stencil_list.head = (stencil_node_t){transformation, NULL};
+uint32_t map_get_subsector(vec2_t position) {
+  uint32_t id = CHILD_IS_SUBSECTOR; // a map without nodes is one subsector
+  if (gl_map.num_nodes > 0) { id = gl_map.num_nodes - 1; }
 
-    stencil_list.tail = stencil_list.head;
-  } else {
-    stencil_list.tail->next  = malloc(sizeof(stencil_node_t));
-    *stencil_list.tail->next = (stencil_node_t){transformation, NULL};
-
-    stencil_list.tail = stencil_list.tail->next;
-  }
-}
-
-sector_t *map_get_sector(vec2_t position) {
-  uint16_t id = gl_map.num_nodes - 1;
-  while ((id & 0x8000) == 0) {
-    if (id > gl_map.num_nodes) { return NULL; }
+  while ((id & CHILD_IS_SUBSECTOR) == 0) {
+    if (id >= gl_map.num_nodes) { return MAP_NO_INDEX; }
 
     gl_node_t *node = &gl_map.nodes[id];
 
@@ -38,18 +26,27 @@ sector_t *map_get_sector(vec2_t position) {
     }
   }
 
-  if ((id & 0x7fff) >= gl_map.num_subsectors) { return NULL; }
+  id &= ~CHILD_IS_SUBSECTOR;
+  return id < gl_map.num_subsectors ? id : MAP_NO_INDEX;
+}
+
+sector_t *map_get_sector(vec2_t position) {
+  uint32_t id = map_get_subsector(position);
+  if (id == MAP_NO_INDEX) { return NULL; }
+
+  // The first seg may be a miniseg, which has no linedef to take the sector of
+  gl_subsector_t *subsector = &gl_map.subsectors[id];
+  for (uint32_t i = 0; i < subsector->num_segs; i++) {
+    gl_segment_t *segment = &gl_map.segments[subsector->first_seg + i];
+    if (segment->linedef == MAP_NO_INDEX) { continue; }
 
-  gl_subsector_t *subsector = &gl_map.subsectors[id & 0x7fff];
-  gl_segment_t   *segment   = &gl_map.segments[subsector->first_seg];
-  linedef_t      *linedef   = &map.linedefs[segment->linedef];
+    linedef_t *linedef = &map.linedefs[segment->linedef];
+    uint32_t   sidedef_idx =
+        segment->side == 0 ? linedef->front_sidedef : linedef->back_sidedef;
+    if (sidedef_idx == MAP_NO_INDEX) { continue; }
 
-  sidedef_t *sidedef;
-  if (segment->side == 0) {
-    sidedef = &map.sidedefs[linedef->front_sidedef];
-  } else {
-    sidedef = &map.sidedefs[linedef->back_sidedef];
+    return &map.sectors[map.sidedefs[sidedef_idx].sector_idx];
   }
 
-  return &map.sectors[sidedef->sector_idx];
+  return NULL;
 }
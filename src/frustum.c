@@ -0,0 +1,51 @@
+#include "frustum.h"
+#include "matrix.h"
+#include "vector.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+static vec4_t normalize_plane(vec4_t plane) {
+  float l = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+  return (vec4_t){plane.x / l, plane.y / l, plane.z / l, plane.w / l};
+}
+
+frustum_t frustum_from_matrix(mat4_t m) {
+  frustum_t frustum;
+
+  // Points are row vectors, so clip space coordinate j is the dot product with
+  // column j. Each plane is the w column plus or minus one of the others.
+  for (int i = 0; i < 6; i++) {
+    int   column = i / 2;
+    float sign   = i % 2 ? -1.f : 1.f;
+
+    vec4_t plane;
+    for (int j = 0; j < 4; j++) {
+      plane.v[j] = m.m[j][3] + sign * m.m[j][column];
+    }
+    frustum.planes[i] = normalize_plane(plane);
+  }
+
+  return frustum;
+}
+
+bool frustum_test_box(const frustum_t *frustum, vec3_t min, vec3_t max) {
+  if (min.x > max.x || min.y > max.y || min.z > max.z) { return false; }
+
+  for (int i = 0; i < 6; i++) {
+    const vec4_t *plane = &frustum->planes[i];
+
+    // The corner furthest along the plane's normal
+    vec3_t p = {
+        plane->x >= 0.f ? max.x : min.x,
+        plane->y >= 0.f ? max.y : min.y,
+        plane->z >= 0.f ? max.z : min.z,
+    };
+
+    if (plane->x * p.x + plane->y * p.y + plane->z * p.z + plane->w < 0.f) {
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,378 @@
+#include "gpu_cull.h"
+#include "frustum.h"
+#include "gl_helpers.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "renderer.h"
+#include "util.h"
+#include "vector.h"
+
+#include <GL/glew.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CULL_GROUP_SIZE    64
+#define PYRAMID_GROUP_SIZE 8
+
+// Frames of timer queries in flight, so that results are read without waiting
+#define NUM_QUERY_FRAMES 4
+
+// Enough for a 65536 pixel wide screen
+#define MAX_LEVELS 17
+
+// Matches DrawElementsIndirectCommand
+typedef struct draw_command {
+  GLuint count, instance_count, first_index;
+  GLint  base_vertex;
+  GLuint base_instance;
+} draw_command_t;
+
+// Phase 0 draws the leaves that were visible last frame and are still in the
+// frustum. Phase 1 tests every leaf against the frustum and the depth pyramid,
+// keeps the result for the next frame and draws the visible leaves that phase
+// 0 did not. Each phase writes its commands to its own half of the command
+// buffer and its count to its own counter.
+static const char *cull_src =
+    "#version 430 core\n"
+    "layout (local_size_x = 64) in;\n"
+    "struct Leaf {\n"
+    "  vec4 min_bounds, max_bounds;\n"
+    "  uint first_index, num_indices, padding[2];\n"
+    "};\n"
+    "struct Command {\n"
+    "  uint count, instance_count, first_index;\n"
+    "  int base_vertex;\n"
+    "  uint base_instance;\n"
+    "};\n"
+    "layout (std430, binding = 0) readonly buffer Leaves { Leaf leaves[]; };\n"
+    "layout (std430, binding = 1) buffer Visible { uint visible[]; };\n"
+    "layout (std430, binding = 2) writeonly buffer Commands {\n"
+    "  Command commands[];\n"
+    "};\n"
+    "layout (std430, binding = 3) buffer Counts { uint counts[2]; };\n"
+    "layout (std430, binding = 4) readonly buffer Pyramid { float depth[]; };\n"
+    "uniform mat4 view_projection;\n"
+    "uniform vec4 planes[6];\n"
+    "uniform uint num_leaves;\n"
+    "uniform int phase;\n"
+    "uniform int num_levels;\n"
+    "uniform ivec4 levels[17];\n"
+    "uniform ivec2 screen_size;\n"
+    "bool in_frustum(vec3 lo, vec3 hi) {\n"
+    "  for (int i = 0; i < 6; i++) {\n"
+    "    vec3 p = mix(lo, hi, greaterThanEqual(planes[i].xyz, vec3(0.0)));\n"
+    "    if (dot(planes[i].xyz, p) + planes[i].w < 0.0) { return false; }\n"
+    "  }\n"
+    "  return true;\n"
+    "}\n"
+    "bool is_hidden(vec3 lo, vec3 hi) {\n"
+    "  vec2 low = vec2(1.0), high = vec2(-1.0);\n"
+    "  float nearest = 1.0;\n"
+    "  for (int i = 0; i < 8; i++) {\n"
+    "    vec3 corner = mix(lo, hi, bvec3(i & 1, i & 2, i & 4));\n"
+    "    vec4 clip = view_projection * vec4(corner, 1.0);\n"
+    "    if (clip.w <= 0.0) { return false; }\n"
+    "    vec3 ndc = clip.xyz / clip.w;\n"
+    "    low = min(low, ndc.xy);\n"
+    "    high = max(high, ndc.xy);\n"
+    "    nearest = min(nearest, ndc.z);\n"
+    "  }\n"
+    "  if (nearest <= -1.0) { return false; }\n"
+    "  vec2 size = vec2(screen_size);\n"
+    "  vec2 a = clamp((low * 0.5 + 0.5) * size, vec2(0.0), size - 1.0);\n"
+    "  vec2 b = clamp((high * 0.5 + 0.5) * size, vec2(0.0), size - 1.0);\n"
+    "  float extent = max(max(b.x - a.x, b.y - a.y), 1.0);\n"
+    "  int level = clamp(int(ceil(log2(extent))) - 1, 0, num_levels - 1);\n"
+    "  ivec4 info = levels[level];\n"
+    "  ivec2 first = min(ivec2(a) >> (level + 1), info.xy - 1);\n"
+    "  ivec2 last = min(ivec2(b) >> (level + 1), info.xy - 1);\n"
+    "  float far = max(max(depth[info.z + first.y * info.x + first.x],\n"
+    "                      depth[info.z + first.y * info.x + last.x]),\n"
+    "                  max(depth[info.z + last.y * info.x + first.x],\n"
+    "                      depth[info.z + last.y * info.x + last.x]));\n"
+    "  return nearest * 0.5 + 0.5 > far;\n"
+    "}\n"
+    "void main() {\n"
+    "  uint id = gl_GlobalInvocationID.x;\n"
+    "  if (id >= num_leaves) { return; }\n"
+    "  Leaf leaf = leaves[id];\n"
+    "  bool is_visible = in_frustum(leaf.min_bounds.xyz, "
+    "leaf.max_bounds.xyz);\n"
+    "  bool was_drawn = visible[id] != 0u && is_visible;\n"
+    "  if (phase == 0) {\n"
+    "    if (!was_drawn) { return; }\n"
+    "  } else {\n"
+    "    is_visible = is_visible &&\n"
+    "                 !is_hidden(leaf.min_bounds.xyz, leaf.max_bounds.xyz);\n"
+    "    visible[id] = is_visible ? 1u : 0u;\n"
+    "    if (!is_visible || was_drawn) { return; }\n"
+    "  }\n"
+    "  uint slot = atomicAdd(counts[phase], 1u);\n"
+    "  commands[uint(phase) * num_leaves + slot] =\n"
+    "      Command(leaf.num_indices, 1u, leaf.first_index, 0, 0u);\n"
+    "}\n";
+
+// Every texel of a level keeps the farthest depth of the texels it covers in
+// the level before, or in the depth buffer for the first level. Sizes are
+// halved and rounded down, so the last row and column also take in an odd row
+// or column that would be left over.
+static const char *reduce_src =
+    "#version 430 core\n"
+    "layout (local_size_x = 8, local_size_y = 8) in;\n"
+    "layout (std430, binding = 4) buffer Pyramid { float depth[]; };\n"
+    "uniform sampler2D depth_buffer;\n"
+    "uniform bool is_first;\n"
+    "uniform ivec4 source, destination;\n"
+    "float source_depth(int x, int y) {\n"
+    "  if (is_first) { return texelFetch(depth_buffer, ivec2(x, y), 0).r; }\n"
+    "  return depth[source.z + y * source.x + x];\n"
+    "}\n"
+    "void main() {\n"
+    "  ivec2 p = ivec2(gl_GlobalInvocationID.xy);\n"
+    "  if (any(greaterThanEqual(p, destination.xy))) { return; }\n"
+    "  ivec2 first = p * source.xy / destination.xy;\n"
+    "  ivec2 last = (p + 1) * source.xy / destination.xy - 1;\n"
+    "  float far = 0.0;\n"
+    "  for (int y = first.y; y <= last.y; y++) {\n"
+    "    for (int x = first.x; x <= last.x; x++) {\n"
+    "      far = max(far, source_depth(x, y));\n"
+    "    }\n"
+    "  }\n"
+    "  depth[destination.z + p.y * destination.x + p.x] = far;\n"
+    "}\n";
+
+static GLuint cull_program, reduce_program;
+static GLint  view_projection_location, planes_location, num_leaves_location;
+static GLint  phase_location, num_levels_location, levels_location;
+static GLint  screen_size_location;
+static GLint  is_first_location, source_location, destination_location;
+
+static GLuint leaves_buffer, visible_buffer, commands_buffer, counts_buffer;
+static GLuint pyramid_buffer, depth_texture;
+static size_t num_leaves;
+static int    width, height, num_levels;
+
+// Width, height and offset into the pyramid buffer of every level. The first
+// level is half the size of the screen, and every texel of level i covers up
+// to 2^(i + 1) pixels across. Levels are kept in a storage buffer rather than
+// the mipmaps of a texture, as sampling mipmaps that compute shaders wrote is
+// not reliable on every driver.
+static GLint levels[MAX_LEVELS][4];
+
+static GLuint queries[NUM_QUERY_FRAMES][4];
+static int    frame;
+static double total_ms;
+static size_t num_timed_frames;
+
+static GLuint create_program(const char *src) {
+  GLuint shader  = compile_shader(GL_COMPUTE_SHADER, src);
+  GLuint program = link_program(1, shader);
+  glDeleteShader(shader);
+  return program;
+}
+
+static GLuint create_buffer(GLsizeiptr size, const void *data) {
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_DRAW);
+  return buffer;
+}
+
+static GLuint groups(int count, int group_size) {
+  return (count + group_size - 1) / group_size;
+}
+
+bool gpu_cull_is_supported() { return GLEW_VERSION_4_3; }
+
+void gpu_cull_init(size_t count, const gpu_cull_leaf_t *leaves) {
+  num_leaves = count;
+
+  cull_program   = create_program(cull_src);
+  reduce_program = create_program(reduce_src);
+
+  view_projection_location =
+      glGetUniformLocation(cull_program, "view_projection");
+  planes_location     = glGetUniformLocation(cull_program, "planes");
+  num_leaves_location = glGetUniformLocation(cull_program, "num_leaves");
+  phase_location      = glGetUniformLocation(cull_program, "phase");
+  num_levels_location = glGetUniformLocation(cull_program, "num_levels");
+  levels_location     = glGetUniformLocation(cull_program, "levels");
+  screen_size_location = glGetUniformLocation(cull_program, "screen_size");
+
+  is_first_location    = glGetUniformLocation(reduce_program, "is_first");
+  source_location      = glGetUniformLocation(reduce_program, "source");
+  destination_location = glGetUniformLocation(reduce_program, "destination");
+
+  renderer_use_program(reduce_program);
+  glUniform1i(glGetUniformLocation(reduce_program, "depth_buffer"), 4);
+
+  // Every leaf counts as visible in the first frame, so that it starts with
+  // whatever is in the frustum
+  uint32_t one = 1;
+  leaves_buffer =
+      create_buffer(sizeof(gpu_cull_leaf_t) * max(num_leaves, 1), leaves);
+  visible_buffer = create_buffer(sizeof(uint32_t) * max(num_leaves, 1), NULL);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                    GL_UNSIGNED_INT, &one);
+  commands_buffer =
+      create_buffer(sizeof(draw_command_t) * 2 * max(num_leaves, 1), NULL);
+  counts_buffer = create_buffer(sizeof(uint32_t) * 2, NULL);
+
+  vec2_t size = renderer_get_size();
+  width       = size.x;
+  height      = size.y;
+  num_levels  = min(max((int)log2f(max(width, height)), 1), MAX_LEVELS);
+
+  GLint pyramid_size = 0;
+  for (int i = 0; i < num_levels; i++) {
+    levels[i][0] = max(width >> (i + 1), 1);
+    levels[i][1] = max(height >> (i + 1), 1);
+    levels[i][2] = pyramid_size;
+    levels[i][3] = 0;
+    pyramid_size += levels[i][0] * levels[i][1];
+  }
+  pyramid_buffer = create_buffer(sizeof(float) * pyramid_size, NULL);
+
+  glActiveTexture(GL_TEXTURE4);
+  glGenTextures(1, &depth_texture);
+  glBindTexture(GL_TEXTURE_2D, depth_texture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glGenQueries(NUM_QUERY_FRAMES * 4, &queries[0][0]);
+  frame            = 0;
+  total_ms         = 0.0;
+  num_timed_frames = 0;
+}
+
+void gpu_cull_free() {
+  if (!cull_program) { return; } // gpu_cull_init never ran
+
+  GLuint buffers[] = {leaves_buffer, visible_buffer, commands_buffer,
+                      counts_buffer, pyramid_buffer};
+  glDeleteBuffers(sizeof buffers / sizeof buffers[0], buffers);
+  glDeleteTextures(1, &depth_texture);
+  glDeleteQueries(NUM_QUERY_FRAMES * 4, &queries[0][0]);
+  memset(queries, 0, sizeof queries);
+  glDeleteProgram(cull_program);
+  glDeleteProgram(reduce_program);
+
+  leaves_buffer  = visible_buffer = commands_buffer = counts_buffer = 0;
+  pyramid_buffer = depth_texture = 0;
+  cull_program   = reduce_program = 0;
+  num_leaves     = 0;
+}
+
+// Adds up the culling time of a frame whose queries have finished, if the
+// queries of this slot were issued before
+static void read_queries(GLuint *slot) {
+  if (frame < NUM_QUERY_FRAMES) { return; }
+
+  GLint available;
+  glGetQueryObjectiv(slot[3], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available) { return; }
+
+  GLuint64 t[4];
+  for (int i = 0; i < 4; i++) {
+    glGetQueryObjectui64v(slot[i], GL_QUERY_RESULT, &t[i]);
+  }
+  total_ms += ((t[1] - t[0]) + (t[3] - t[2])) / 1e6;
+  num_timed_frames++;
+}
+
+static void dispatch_cull(int phase) {
+  renderer_use_program(cull_program);
+  glUniform1i(phase_location, phase);
+  glDispatchCompute(groups(num_leaves, CULL_GROUP_SIZE), 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Issued right away, as the next dispatch depends on what it draws
+static void draw_phase(const mesh_t *mesh, int phase) {
+  GLintptr offset = sizeof(draw_command_t) * num_leaves * phase;
+  if (GLEW_ARB_indirect_parameters) {
+    renderer_draw_indirect(mesh, SHADER_DEFAULT, mat4_identity(), offset,
+                           num_leaves, sizeof(uint32_t) * phase);
+  } else {
+    // Commands past the count were cleared, and draw nothing
+    renderer_draw_indirect(mesh, SHADER_DEFAULT, mat4_identity(), offset,
+                           num_leaves, -1);
+  }
+  renderer_flush();
+}
+
+static void build_pyramid() {
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_2D, depth_texture);
+  glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+  GLint screen[4] = {width, height, 0, 0};
+  renderer_use_program(reduce_program);
+  for (int i = 0; i < num_levels; i++) {
+    glUniform1i(is_first_location, i == 0);
+    glUniform4iv(source_location, 1, i == 0 ? screen : levels[i - 1]);
+    glUniform4iv(destination_location, 1, levels[i]);
+    glDispatchCompute(groups(levels[i][0], PYRAMID_GROUP_SIZE),
+                      groups(levels[i][1], PYRAMID_GROUP_SIZE), 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  }
+}
+
+void gpu_cull_draw(const mesh_t *mesh, mat4_t view_projection,
+                   const frustum_t *frustum) {
+  if (num_leaves == 0) { return; }
+
+  GLuint *slot = queries[frame % NUM_QUERY_FRAMES];
+  read_queries(slot);
+
+  renderer_use_program(cull_program);
+  glUniformMatrix4fv(view_projection_location, 1, GL_FALSE,
+                     view_projection.v);
+  glUniform4fv(planes_location, 6, frustum->planes[0].v);
+  glUniform1ui(num_leaves_location, num_leaves);
+  glUniform1i(num_levels_location, num_levels);
+  glUniform4iv(levels_location, num_levels, levels[0]);
+  glUniform2i(screen_size_location, width, height);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, leaves_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commands_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, counts_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, pyramid_buffer);
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counts_buffer);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                    GL_UNSIGNED_INT, NULL);
+  if (!GLEW_ARB_indirect_parameters) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, commands_buffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                      GL_UNSIGNED_INT, NULL);
+  }
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_buffer);
+  if (GLEW_ARB_indirect_parameters) {
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, counts_buffer);
+  }
+
+  glQueryCounter(slot[0], GL_TIMESTAMP);
+  dispatch_cull(0);
+  glQueryCounter(slot[1], GL_TIMESTAMP);
+  draw_phase(mesh, 0);
+
+  glQueryCounter(slot[2], GL_TIMESTAMP);
+  build_pyramid();
+  dispatch_cull(1);
+  glQueryCounter(slot[3], GL_TIMESTAMP);
+  draw_phase(mesh, 1);
+
+  frame++;
+}
+
+double gpu_cull_average_ms() {
+  return num_timed_frames > 0 ? total_ms / num_timed_frames : 0.0;
+}
@@ -0,0 +1,136 @@
+#include "jobs.h"
+#include "dynarray.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+typedef struct job {
+  job_fn_t      fn;
+  void         *arg;
+  jobs_group_t *group;
+} job_t;
+
+static struct {
+  pthread_t *threads;
+  int        num_threads;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t  job_ready, all_done, group_done;
+
+  dynarray(job_t) queue;
+  size_t head, pending;
+  bool   quit;
+} pool;
+
+// Must be called with the mutex held and at least one job queued
+static job_t take_job() {
+  job_t job = pool.queue.data[pool.head++];
+  if (pool.head == pool.queue.count) { pool.head = pool.queue.count = 0; }
+  return job;
+}
+
+static void finish_job(job_t job) {
+  if (job.group && --job.group->pending == 0) {
+    pthread_cond_broadcast(&pool.group_done);
+  }
+  if (--pool.pending == 0) { pthread_cond_broadcast(&pool.all_done); }
+}
+
+static void *worker(void *arg) {
+  pthread_mutex_lock(&pool.mutex);
+  for (;;) {
+    while (pool.head == pool.queue.count && !pool.quit) {
+      pthread_cond_wait(&pool.job_ready, &pool.mutex);
+    }
+    if (pool.head == pool.queue.count) { break; }
+
+    job_t job = take_job();
+    pthread_mutex_unlock(&pool.mutex);
+    job.fn(job.arg);
+    pthread_mutex_lock(&pool.mutex);
+    finish_job(job);
+  }
+  pthread_mutex_unlock(&pool.mutex);
+
+  return NULL;
+}
+
+void jobs_init(int num_threads) {
+  pthread_mutex_init(&pool.mutex, NULL);
+  pthread_cond_init(&pool.job_ready, NULL);
+  pthread_cond_init(&pool.all_done, NULL);
+  pthread_cond_init(&pool.group_done, NULL);
+  dynarray_init(pool.queue, 0);
+
+  pool.head = pool.pending = 0;
+  pool.quit = false;
+
+  pool.num_threads = num_threads > 0 ? num_threads : 0;
+  pool.threads     = malloc(sizeof(pthread_t) * pool.num_threads);
+  for (int i = 0; i < pool.num_threads; i++) {
+    pthread_create(&pool.threads[i], NULL, worker, NULL);
+  }
+}
+
+void jobs_shutdown() {
+  pthread_mutex_lock(&pool.mutex);
+  pool.quit = true;
+  pthread_cond_broadcast(&pool.job_ready);
+  pthread_mutex_unlock(&pool.mutex);
+
+  for (int i = 0; i < pool.num_threads; i++) {
+    pthread_join(pool.threads[i], NULL);
+  }
+
+  free(pool.threads);
+  free(pool.queue.data);
+  pool.num_threads = 0;
+}
+
+int jobs_num_threads() { return pool.num_threads; }
+
+void jobs_submit(job_fn_t fn, void *arg) { jobs_submit_group(fn, arg, NULL); }
+
+void jobs_submit_group(job_fn_t fn, void *arg, jobs_group_t *group) {
+  pthread_mutex_lock(&pool.mutex);
+  dynarray_push(pool.queue, ((job_t){fn, arg, group}));
+  if (group) { group->pending++; }
+  pool.pending++;
+  pthread_cond_signal(&pool.job_ready);
+  pthread_mutex_unlock(&pool.mutex);
+}
+
+void jobs_wait() {
+  // The waiting thread runs queued jobs itself instead of idling
+  pthread_mutex_lock(&pool.mutex);
+  while (pool.pending > 0) {
+    if (pool.head < pool.queue.count) {
+      job_t job = take_job();
+      pthread_mutex_unlock(&pool.mutex);
+      job.fn(job.arg);
+      pthread_mutex_lock(&pool.mutex);
+      finish_job(job);
+    } else {
+      pthread_cond_wait(&pool.all_done, &pool.mutex);
+    }
+  }
+  pthread_mutex_unlock(&pool.mutex);
+}
+
+void jobs_wait_group(jobs_group_t *group) {
+  pthread_mutex_lock(&pool.mutex);
+  while (group->pending > 0) {
+    if (pool.head < pool.queue.count) {
+      job_t job = take_job();
+      pthread_mutex_unlock(&pool.mutex);
+      job.fn(job.arg);
+      pthread_mutex_lock(&pool.mutex);
+      finish_job(job);
+    } else {
+      pthread_cond_wait(&pool.group_done, &pool.mutex);
+    }
+  }
+  pthread_mutex_unlock(&pool.mutex);
+}
@@ -1,26 +1,84 @@
 #include "engine.h"
 #include "input.h"
+#include "jobs.h"
 #include "renderer.h"
 #include "wad.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #define WIDTH  1280
 #define HEIGHT 800
 
+static double get_time_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
 int main(int argc, char **argv) {
+  double start_time = get_time_ms();
+
+  // Every argument that is not an option names a WAD file: the IWAD first,
+  // then any PWADs that override it
+  int          num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char  *cache_dir   = NULL;
+  bool         gpu_culling = false;
+  const char **wad_files   = malloc(sizeof(char *) * argc);
+  int          num_files   = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      num_threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc) {
+      cache_dir = argv[++i];
+    } else if (strcmp(argv[i], "-gpucull") == 0) {
+      gpu_culling = true;
+    } else {
+      wad_files[num_files++] = argv[i];
+    }
+  }
+
+  if (num_files == 0) { wad_files[num_files++] = "doom1.wad"; }
+
+  wad_t wad;
+  if (wad_map_stack(wad_files, num_files, &wad) != 0) {
+    printf("Failed to load WAD files (%s", wad_files[0]);
+    for (int i = 1; i < num_files; i++) {
+      printf(", %s", wad_files[i]);
+    }
+    printf(")\n");
+    free(wad_files);
+    return 2;
+  }
+  free(wad_files);
+
+  // Asset decoding runs on the workers while the window, the context and the
+  // shaders are being created
+  jobs_init(num_threads);
+  engine_load(&wad, "E1M1", cache_dir);
+
   if (glfwInit() != GLFW_TRUE) {
     fprintf(stderr, "Failed to initalize GLFW\n");
     return 1;
   }
 
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  // GPU culling needs compute shaders, so it asks for OpenGL 4.3 and settles
+  // for 3.3 without them
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, gpu_culling ? 4 : 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
   glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_STENCIL_BITS, 0); // the sky is drawn without a mask
   GLFWwindow *window = glfwCreateWindow(WIDTH, HEIGHT, "DooM", NULL, NULL);
+  if (window == NULL && gpu_culling) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    window = glfwCreateWindow(WIDTH, HEIGHT, "DooM", NULL, NULL);
+  }
   glfwMakeContextCurrent(window);
   glfwSwapInterval(1);
 
@@ -34,34 +92,63 @@ int main(int argc, char **argv) {
   glfwSetMouseButtonCallback(window, input_mouse_button_callback);
   glfwSetCursorPosCallback(window, input_mouse_position_callback);
 
-  wad_t wad;
-  if (wad_load_from_file("doom1.wad", &wad) != 0) {
-    printf("Failed to load WAD file (doom1.wad)\n");
-    return 2;
+  renderer_init(WIDTH, HEIGHT);
+  engine_use_gpu_culling(gpu_culling);
+  if (engine_init() != 0) {
+    engine_unload();
+    jobs_shutdown();
+    glfwTerminate();
+    wad_free(&wad);
+    return 1;
   }
 
-  renderer_init(WIDTH, HEIGHT);
-  engine_init(&wad, "E1M1");
+  printf("Startup took %.1f ms with %d worker threads\n",
+         get_time_ms() - start_time, jobs_num_threads());
 
-  char  title[128];
-  float last = 0.f;
+  char   title[128];
+  float  last              = 0.f;
+  size_t state_changes     = 0;
+  size_t num_frames        = 0;
+  size_t num_state_changes = 0;
+  size_t num_draw_calls    = 0;
+  double cpu_time          = 0.0;
   while (!glfwWindowShouldClose(window)) {
-    float now   = glfwGetTime();
-    float delta = now - last;
-    last        = now;
+    float  now         = glfwGetTime();
+    float  delta       = now - last;
+    double frame_start = get_time_ms();
+    last               = now;
 
     input_tick();
     glfwPollEvents();
-    snprintf(title, 128, "DooM | %.0f", 1.f / delta);
+    snprintf(title, 128, "DooM | %.0f | %zu state changes", 1.f / delta,
+             state_changes);
     glfwSetWindowTitle(window, title);
 
     engine_update(delta);
 
     renderer_clear();
     engine_render();
+    state_changes = renderer_num_state_changes();
+    // Up to the swap, which is where the driver waits on the GPU
+    cpu_time += get_time_ms() - frame_start;
     glfwSwapBuffers(window);
+
+    num_state_changes += state_changes;
+    num_draw_calls    += renderer_num_draw_calls();
+    num_frames++;
+  }
+
+  engine_print_cull_timing();
+  if (num_frames > 0) {
+    printf("%.1f GL state changes per frame\n",
+           (double)num_state_changes / num_frames);
+    printf("%.1f draw calls and %.3f ms of CPU time per frame\n",
+           (double)num_draw_calls / num_frames, cpu_time / num_frames);
   }
 
+  engine_unload();
+  jobs_shutdown();
   glfwTerminate();
+  wad_free(&wad);
   return 0;
 }
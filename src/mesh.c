@@ -1,13 +1,16 @@
 #include "mesh.h"
+#include "util.h"
 #include "vector.h"
 
+#include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 void mesh_create(mesh_t *mesh, vertex_layout_t vertex_layout,
                  size_t num_vertices, const void *vertices, size_t num_indices,
-                 const uint32_t *indices, bool is_dynamic) {
+                 const uint32_t *indices) {
   mesh->num_indices = num_indices;
 
   glGenVertexArrays(1, &mesh->vao);
@@ -20,43 +23,78 @@ void mesh_create(mesh_t *mesh, vertex_layout_t vertex_layout,
   switch (vertex_layout) {
   case VERTEX_LAYOUT_PLAIN:
     glBufferData(GL_ARRAY_BUFFER, sizeof(vec3_t) * num_vertices, vertices,
-                 is_dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+                 GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void *)0);
     glEnableVertexAttribArray(0);
     break;
-  case VERTEX_LAYOUT_FULL:
+  case VERTEX_LAYOUT_PACKED:
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_t) * num_vertices, vertices,
-                 is_dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+                 GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t),
                           (void *)offsetof(vertex_t, position));
     glEnableVertexAttribArray(0);
 
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t),
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(vertex_t),
                           (void *)offsetof(vertex_t, tex_coords));
     glEnableVertexAttribArray(1);
 
-    glVertexAttribIPointer(2, 1, GL_INT, sizeof(vertex_t),
-                           (void *)offsetof(vertex_t, texture_index));
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_SHORT, sizeof(vertex_t),
+                           (void *)offsetof(vertex_t, texture));
     glEnableVertexAttribArray(2);
 
-    glVertexAttribIPointer(3, 1, GL_INT, sizeof(vertex_t),
-                           (void *)offsetof(vertex_t, texture_type));
+    glVertexAttribPointer(3, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(vertex_t),
+                          (void *)offsetof(vertex_t, light));
     glEnableVertexAttribArray(3);
 
-    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(vertex_t),
-                          (void *)offsetof(vertex_t, light));
-    glEnableVertexAttribArray(4);
+    break;
+  }
 
-    glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t),
-                          (void *)offsetof(vertex_t, max_coords));
-    glEnableVertexAttribArray(5);
+  mesh->index_type = GL_UNSIGNED_INT;
+  mesh->index_size = sizeof(uint32_t);
 
-    break;
+  const void *data          = indices;
+  uint16_t   *short_indices = NULL;
+  if (num_vertices <= UINT16_MAX + 1) {
+    short_indices = malloc(sizeof(uint16_t) * num_indices);
+    for (size_t i = 0; i < num_indices; i++) {
+      short_indices[i] = indices[i];
+    }
+
+    data             = short_indices;
+    mesh->index_type = GL_UNSIGNED_SHORT;
+    mesh->index_size = sizeof(uint16_t);
   }
 
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * num_indices, indices,
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->index_size * num_indices, data,
                GL_STATIC_DRAW);
+  free(short_indices);
+}
+
+void mesh_free(mesh_t *mesh) {
+  glDeleteVertexArrays(1, &mesh->vao);
+  glDeleteBuffers(1, &mesh->vbo);
+  glDeleteBuffers(1, &mesh->ebo);
+  *mesh = (mesh_t){0};
+}
+
+static int16_t pack_coord(float texels) {
+  float scaled = roundf(texels * VERTEX_COORD_SCALE);
+  return max(min(scaled, (float)INT16_MAX), (float)INT16_MIN);
+}
+
+vertex_t vertex_pack(vec3_t position, vec2_t tex_coords, int texture_index,
+                     int texture_type, int light) {
+  if (texture_index < 0 || texture_index >= VERTEX_NO_TEXTURE) {
+    texture_index = VERTEX_NO_TEXTURE;
+  }
+
+  return (vertex_t){
+      .position   = position,
+      .tex_coords = {pack_coord(tex_coords.x), pack_coord(tex_coords.y)},
+      .texture    = texture_type << VERTEX_TYPE_SHIFT | texture_index,
+      .light      = max(min(light, 255), 0),
+  };
 }
@@ -0,0 +1,286 @@
+#include "mesh_optimize.h"
+#include "mesh.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_VERTEX UINT32_MAX
+
+// Scoring constants from Forsyth's paper
+#define CACHE_DECAY_POWER   1.5f
+#define LAST_TRIANGLE_SCORE .75f
+#define VALENCE_BOOST_SCALE 2.f
+#define VALENCE_BOOST_POWER .5f
+
+static uint64_t hash_vertex(const vertex_t *vertex) {
+  const uint8_t *bytes = (const uint8_t *)vertex;
+  uint64_t       hash  = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < sizeof(vertex_t); i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Packed vertices have no padding left undefined, so identical ones compare
+// equal byte for byte
+static void weld(vertexarray_t *vertices, indexarray_t *indices) {
+  size_t size = 16;
+  while (size < vertices->count * 2) {
+    size *= 2;
+  }
+
+  uint32_t *slots = malloc(sizeof(uint32_t) * size);
+  uint32_t *remap = malloc(sizeof(uint32_t) * (vertices->count + 1));
+  memset(slots, 0xff, sizeof(uint32_t) * size);
+
+  size_t num_unique = 0;
+  for (size_t i = 0; i < vertices->count; i++) {
+    const vertex_t *vertex = &vertices->data[i];
+
+    size_t slot = hash_vertex(vertex) & (size - 1);
+    while (slots[slot] != NO_VERTEX &&
+           memcmp(&vertices->data[slots[slot]], vertex, sizeof(vertex_t))) {
+      slot = (slot + 1) & (size - 1);
+    }
+
+    if (slots[slot] == NO_VERTEX) {
+      vertices->data[num_unique] = *vertex;
+      slots[slot]                = num_unique++;
+    }
+    remap[i] = slots[slot];
+  }
+
+  vertices->count = num_unique;
+  for (size_t i = 0; i < indices->count; i++) {
+    indices->data[i] = remap[indices->data[i]];
+  }
+
+  free(slots);
+  free(remap);
+}
+
+static float vertex_score(int cache_position, uint32_t num_remaining) {
+  if (num_remaining == 0) { return -1.f; }
+
+  // The last triangle's vertices get a fixed score, so that the next triangle
+  // does not simply reuse the edge just drawn
+  float score = 0.f;
+  if (cache_position >= 0 && cache_position < 3) {
+    score = LAST_TRIANGLE_SCORE;
+  } else if (cache_position >= 3) {
+    float scale = 1.f / (MESH_CACHE_SIZE - 3);
+    score = powf(1.f - (cache_position - 3) * scale, CACHE_DECAY_POWER);
+  }
+
+  // Vertices with few triangles left are worth finishing off
+  return score +
+         VALENCE_BOOST_SCALE * powf(num_remaining, -VALENCE_BOOST_POWER);
+}
+
+// Reorders the triangles of one range, whose vertices have been numbered from
+// zero up to num_vertices
+static void optimize_range(uint32_t *range, size_t num_indices,
+                           size_t num_vertices) {
+  size_t num_triangles = num_indices / 3;
+  if (num_triangles < 2) { return; }
+
+  // Every vertex's triangles that are not drawn yet, packed one vertex after
+  // the other
+  uint32_t *first_triangle = calloc(num_vertices + 1, sizeof(uint32_t));
+  uint32_t *num_remaining  = calloc(num_vertices, sizeof(uint32_t));
+  uint32_t *triangles      = malloc(sizeof(uint32_t) * num_triangles * 3);
+  for (size_t i = 0; i < num_triangles * 3; i++) {
+    num_remaining[range[i]]++;
+  }
+  for (size_t i = 0; i < num_vertices; i++) {
+    first_triangle[i + 1] = first_triangle[i] + num_remaining[i];
+    num_remaining[i]      = 0;
+  }
+  for (size_t i = 0; i < num_triangles * 3; i++) {
+    uint32_t vertex = range[i];
+    triangles[first_triangle[vertex] + num_remaining[vertex]++] = i / 3;
+  }
+
+  float    *score          = malloc(sizeof(float) * num_vertices);
+  float    *triangle_score = calloc(num_triangles, sizeof(float));
+  bool     *is_drawn       = calloc(num_triangles, sizeof(bool));
+  uint32_t *drawn          = malloc(sizeof(uint32_t) * num_triangles * 3);
+  for (size_t i = 0; i < num_vertices; i++) {
+    score[i] = vertex_score(-1, num_remaining[i]);
+  }
+  for (size_t i = 0; i < num_triangles * 3; i++) {
+    triangle_score[i / 3] += score[range[i]];
+  }
+
+  // The cache holds three more entries than it models, for the vertices of
+  // the triangle being drawn as the oldest ones are pushed out
+  uint32_t cache[MESH_CACHE_SIZE + 3], new_cache[MESH_CACHE_SIZE + 3];
+  int      cache_count = 0;
+
+  size_t num_drawn = 0, scan_from = 0;
+  long   best      = -1;
+  while (num_drawn < num_triangles) {
+    // When nothing in the cache has triangles left, the best of the rest is
+    // found by going through them all
+    if (best < 0) {
+      while (is_drawn[scan_from]) {
+        scan_from++;
+      }
+      best = scan_from;
+      for (size_t i = scan_from + 1; i < num_triangles; i++) {
+        if (!is_drawn[i] && triangle_score[i] > triangle_score[best]) {
+          best = i;
+        }
+      }
+    }
+
+    const uint32_t *triangle = &range[best * 3];
+    memcpy(&drawn[num_drawn++ * 3], triangle, sizeof(uint32_t) * 3);
+    is_drawn[best] = true;
+
+    int new_count = 0;
+    for (int i = 0; i < 3; i++) {
+      uint32_t  vertex = triangle[i];
+      uint32_t *list   = &triangles[first_triangle[vertex]];
+      for (uint32_t j = 0; j < num_remaining[vertex]; j++) {
+        if (list[j] == best) {
+          list[j] = list[--num_remaining[vertex]];
+          break;
+        }
+      }
+      new_cache[new_count++] = vertex;
+    }
+    for (int i = 0; i < cache_count; i++) {
+      uint32_t vertex = cache[i];
+      if (vertex != triangle[0] && vertex != triangle[1] &&
+          vertex != triangle[2]) {
+        new_cache[new_count++] = vertex;
+      }
+    }
+
+    // Vertices pushed out of the cache lose their cache score
+    for (int i = 0; i < new_count; i++) {
+      uint32_t vertex = new_cache[i];
+      int position    = i < MESH_CACHE_SIZE ? i : -1;
+
+      float new_score = vertex_score(position, num_remaining[vertex]);
+      float delta     = new_score - score[vertex];
+      score[vertex]   = new_score;
+
+      const uint32_t *list = &triangles[first_triangle[vertex]];
+      for (uint32_t j = 0; j < num_remaining[vertex]; j++) {
+        triangle_score[list[j]] += delta;
+      }
+    }
+
+    cache_count = min(new_count, MESH_CACHE_SIZE);
+    memcpy(cache, new_cache, sizeof(uint32_t) * cache_count);
+
+    best = -1;
+    for (int i = 0; i < cache_count; i++) {
+      uint32_t        vertex = cache[i];
+      const uint32_t *list   = &triangles[first_triangle[vertex]];
+      for (uint32_t j = 0; j < num_remaining[vertex]; j++) {
+        if (best < 0 || triangle_score[list[j]] > triangle_score[best]) {
+          best = list[j];
+        }
+      }
+    }
+  }
+
+  memcpy(range, drawn, sizeof(uint32_t) * num_triangles * 3);
+
+  free(first_triangle);
+  free(num_remaining);
+  free(triangles);
+  free(score);
+  free(triangle_score);
+  free(is_drawn);
+  free(drawn);
+}
+
+void mesh_optimize(vertexarray_t *vertices, indexarray_t *indices,
+                   const index_range_t *ranges, size_t num_ranges) {
+  weld(vertices, indices);
+
+  // Ranges are reordered with their vertices numbered from zero, which the
+  // local ids hold for the range's duration
+  uint32_t *local_ids  = malloc(sizeof(uint32_t) * (vertices->count + 1));
+  uint32_t *global_ids = malloc(sizeof(uint32_t) * (indices->count + 1));
+  memset(local_ids, 0xff, sizeof(uint32_t) * vertices->count);
+
+  for (size_t i = 0; i < num_ranges; i++) {
+    uint32_t *range = &indices->data[ranges[i].first];
+    size_t    count = ranges[i].count, num_local = 0;
+
+    for (size_t j = 0; j < count; j++) {
+      uint32_t *local = &local_ids[range[j]];
+      if (*local == NO_VERTEX) {
+        global_ids[num_local] = range[j];
+        *local                = num_local++;
+      }
+      range[j] = *local;
+    }
+
+    optimize_range(range, count, num_local);
+
+    for (size_t j = 0; j < count; j++) {
+      range[j] = global_ids[range[j]];
+    }
+    for (size_t j = 0; j < num_local; j++) {
+      local_ids[global_ids[j]] = NO_VERTEX;
+    }
+  }
+
+  // Vertices are then laid out in the order they are first drawn in, which
+  // drops any that nothing draws
+  uint32_t *new_ids = local_ids;
+  vertex_t *laid_out = malloc(sizeof(vertex_t) * (vertices->count + 1));
+  size_t    num_used = 0;
+  for (size_t i = 0; i < indices->count; i++) {
+    uint32_t *index = &indices->data[i];
+    if (new_ids[*index] == NO_VERTEX) {
+      laid_out[num_used] = vertices->data[*index];
+      new_ids[*index]    = num_used++;
+    }
+    *index = new_ids[*index];
+  }
+
+  memcpy(vertices->data, laid_out, sizeof(vertex_t) * num_used);
+  vertices->count = num_used;
+
+  free(laid_out);
+  free(local_ids);
+  free(global_ids);
+}
+
+mesh_stats_t mesh_measure(size_t num_vertices, const uint32_t *indices,
+                          size_t num_indices) {
+  // Every vertex keeps the time it entered the cache, so that it is still in
+  // the cache while fewer than MESH_CACHE_SIZE others have entered since
+  size_t *entered = malloc(sizeof(size_t) * (num_vertices + 1));
+  for (size_t i = 0; i < num_vertices; i++) {
+    entered[i] = SIZE_MAX;
+  }
+
+  size_t num_misses = 0;
+  for (size_t i = 0; i < num_indices; i++) {
+    size_t time = entered[indices[i]];
+    if (time == SIZE_MAX || num_misses - time >= MESH_CACHE_SIZE) {
+      entered[indices[i]] = num_misses++;
+    }
+  }
+
+  free(entered);
+
+  size_t num_triangles = num_indices / 3;
+  return (mesh_stats_t){
+      .num_vertices = num_vertices,
+      .acmr = num_triangles ? (float)num_misses / num_triangles : 0.f,
+  };
+}
@@ -0,0 +1,61 @@
+#include "name_table.h"
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+name_key_t name_to_key(const char *name) {
+  name_key_t key = 0;
+  for (int i = 0; i < 8 && name[i]; i++) {
+    key |= (name_key_t)(uint8_t)toupper((int)name[i]) << (i * 8);
+  }
+
+  return key;
+}
+
+static size_t hash_key(name_key_t key, size_t size) {
+  return ((key * 0x9e3779b97f4a7c15ull) >> 32) & (size - 1);
+}
+
+void name_table_init(name_table_t *table, size_t num_names) {
+  table->size = 16;
+  while (table->size < num_names * 2) {
+    table->size *= 2;
+  }
+
+  table->keys   = malloc(sizeof(name_key_t) * table->size);
+  table->values = malloc(sizeof(int) * table->size);
+  memset(table->values, 0xff, sizeof(int) * table->size);
+}
+
+void name_table_free(name_table_t *table) {
+  free(table->keys);
+  free(table->values);
+  *table = (name_table_t){0};
+}
+
+int name_table_insert(name_table_t *table, name_key_t key, int value) {
+  size_t slot = hash_key(key, table->size);
+  while (table->values[slot] >= 0 && table->keys[slot] != key) {
+    slot = (slot + 1) & (table->size - 1);
+  }
+
+  int previous        = table->values[slot];
+  table->keys[slot]   = key;
+  table->values[slot] = value;
+  return previous;
+}
+
+int name_table_find(const name_table_t *table, name_key_t key) {
+  if (table->size == 0) { return -1; }
+
+  size_t slot = hash_key(key, table->size);
+  while (table->values[slot] >= 0) {
+    if (table->keys[slot] == key) { return table->values[slot]; }
+    slot = (slot + 1) & (table->size - 1);
+  }
+
+  return -1;
+}
@@ -0,0 +1,554 @@
+#include "nodebuild.h"
+#include "dynarray.h"
+#include "gl_map.h"
+#include "jobs.h"
+#include "map.h"
+#include "util.h"
+#include "vector.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Distance below which a point counts as lying on a line
+#define EPSILON (1.0 / 256.0)
+
+// Larger seg sets only try an even spread of this many segs as partitions
+#define MAX_CANDIDATES 128
+
+// Scoring goes to the job pool once it takes at least this many seg tests
+#define MIN_PARALLEL_TESTS (1 << 16)
+#define CANDIDATES_PER_JOB 8
+
+// How much imbalance between the two sides a split seg is worth
+#define SPLIT_COST 8
+
+// Margin around the map for the region of the root node
+#define ROOT_MARGIN 64.0
+
+typedef struct dvec2 {
+  double x, y;
+} dvec2_t;
+
+typedef struct line {
+  dvec2_t origin, dir;
+  double  length;
+} line_t;
+
+typedef struct build_seg {
+  dvec2_t  start, end;
+  uint32_t start_vertex, end_vertex;
+  uint32_t linedef;
+  uint16_t side;
+} build_seg_t;
+
+// A subtree still to be built: its segs and the convex region it covers
+typedef struct pending {
+  build_seg_t *segs;
+  size_t       num_segs;
+  dvec2_t     *region;
+  size_t       region_size;
+  int64_t      parent; // node index, or -1 for the root
+  bool         is_back;
+} pending_t;
+
+typedef struct score_job {
+  const build_seg_t *segs;
+  size_t             num_segs;
+  size_t             first, count, stride;
+  int64_t           *scores;
+} score_job_t;
+
+// A seg lying along an edge of a subsector polygon
+typedef struct edge_seg {
+  size_t seg;
+  double start, end;
+} edge_seg_t;
+
+enum { SIDE_FRONT, SIDE_BACK, SIDE_SPLIT };
+
+static struct {
+  dynarray(dvec2_t) vertices;
+  dynarray(gl_segment_t) segments;
+  dynarray(gl_subsector_t) subsectors;
+  dynarray(gl_node_t) nodes;
+  dynarray(pending_t) pending;
+} builder;
+
+static line_t seg_line(const build_seg_t *seg) {
+  dvec2_t dir = {seg->end.x - seg->start.x, seg->end.y - seg->start.y};
+  return (line_t){seg->start, dir, sqrt(dir.x * dir.x + dir.y * dir.y)};
+}
+
+// Signed distance of a point from a line, positive on its front (right) side
+static double line_side(const line_t *line, dvec2_t p) {
+  return ((p.x - line->origin.x) * line->dir.y -
+          (p.y - line->origin.y) * line->dir.x) /
+         line->length;
+}
+
+static int classify_seg(const build_seg_t *seg, const line_t *line,
+                        double *start_side, double *end_side) {
+  double s0 = line_side(line, seg->start), s1 = line_side(line, seg->end);
+  if (fabs(s0) < EPSILON) { s0 = 0.0; }
+  if (fabs(s1) < EPSILON) { s1 = 0.0; }
+
+  *start_side = s0, *end_side = s1;
+
+  // Segs on the partition line go to the side they face
+  if (s0 == 0.0 && s1 == 0.0) {
+    double dot = (seg->end.x - seg->start.x) * line->dir.x +
+                 (seg->end.y - seg->start.y) * line->dir.y;
+    return dot > 0.0 ? SIDE_FRONT : SIDE_BACK;
+  }
+
+  if (s0 >= 0.0 && s1 >= 0.0) { return SIDE_FRONT; }
+  if (s0 <= 0.0 && s1 <= 0.0) { return SIDE_BACK; }
+  return SIDE_SPLIT;
+}
+
+// Returns a lower score for better partitions, or -1 for a line that does not
+// divide the segs at all
+static int64_t score_partition(const build_seg_t *segs, size_t num_segs,
+                               const build_seg_t *partition) {
+  line_t line = seg_line(partition);
+  if (line.length < EPSILON) { return -1; }
+
+  int64_t counts[3] = {0};
+  for (size_t i = 0; i < num_segs; i++) {
+    double s0, s1;
+    counts[classify_seg(&segs[i], &line, &s0, &s1)]++;
+  }
+
+  if (counts[SIDE_BACK] + counts[SIDE_SPLIT] == 0) { return -1; }
+  return counts[SIDE_SPLIT] * SPLIT_COST +
+         llabs(counts[SIDE_FRONT] - counts[SIDE_BACK]);
+}
+
+static void score_candidates(void *arg) {
+  score_job_t *job = arg;
+  for (size_t i = job->first; i < job->first + job->count; i++) {
+    job->scores[i] = score_partition(job->segs, job->num_segs,
+                                     &job->segs[i * job->stride]);
+  }
+}
+
+// Returns the seg whose line is the best partition, or -1 when the segs are
+// already convex
+static int64_t choose_partition(const build_seg_t *segs, size_t num_segs) {
+  size_t num_candidates = min(num_segs, (size_t)MAX_CANDIDATES);
+  size_t stride         = num_segs / num_candidates;
+
+  int64_t *scores = malloc(sizeof(int64_t) * num_segs);
+  int64_t  best   = -1;
+
+  // A spread of candidates that all fail to divide the segs does not prove
+  // that they are convex, so that is checked again with every seg
+  for (;;) {
+    size_t num_jobs = (num_candidates + CANDIDATES_PER_JOB - 1) /
+                      CANDIDATES_PER_JOB;
+    score_job_t *jobs = malloc(sizeof(score_job_t) * num_jobs);
+
+    bool parallel = jobs_num_threads() > 0 &&
+                    num_segs * num_candidates >= MIN_PARALLEL_TESTS;
+
+    jobs_group_t group = {0};
+    for (size_t i = 0; i < num_jobs; i++) {
+      size_t first = i * CANDIDATES_PER_JOB;
+      size_t count = min(num_candidates - first, (size_t)CANDIDATES_PER_JOB);
+      jobs[i] = (score_job_t){segs, num_segs, first, count, stride, scores};
+
+      if (parallel) {
+        jobs_submit_group(score_candidates, &jobs[i], &group);
+      } else {
+        score_candidates(&jobs[i]);
+      }
+    }
+
+    if (parallel) { jobs_wait_group(&group); }
+    free(jobs);
+
+    for (size_t i = 0; i < num_candidates; i++) {
+      if (scores[i] >= 0 && (best < 0 || scores[i] < scores[best / stride])) {
+        best = i * stride;
+      }
+    }
+
+    if (best >= 0 || stride == 1) { break; }
+    num_candidates = num_segs, stride = 1;
+  }
+
+  free(scores);
+  return best;
+}
+
+static uint32_t add_vertex(dvec2_t p) {
+  dynarray_push(builder.vertices, p);
+  return VERT_IS_GL | (uint32_t)(builder.vertices.count - 1);
+}
+
+static void split_segs(const build_seg_t *segs, size_t num_segs,
+                       const line_t *line, pending_t *front, pending_t *back) {
+  // Every seg ends up on one side, or on both when split
+  front->segs     = malloc(sizeof(build_seg_t) * num_segs);
+  back->segs      = malloc(sizeof(build_seg_t) * num_segs);
+  front->num_segs = back->num_segs = 0;
+
+  for (size_t i = 0; i < num_segs; i++) {
+    const build_seg_t *seg = &segs[i];
+
+    double s0, s1;
+    switch (classify_seg(seg, line, &s0, &s1)) {
+    case SIDE_FRONT: front->segs[front->num_segs++] = *seg; break;
+    case SIDE_BACK: back->segs[back->num_segs++] = *seg; break;
+    case SIDE_SPLIT: {
+      double  t = s0 / (s0 - s1);
+      dvec2_t p = {seg->start.x + t * (seg->end.x - seg->start.x),
+                   seg->start.y + t * (seg->end.y - seg->start.y)};
+
+      build_seg_t first = *seg, second = *seg;
+      first.end = second.start = p;
+      first.end_vertex = second.start_vertex = add_vertex(p);
+
+      pending_t *first_side = s0 > 0.0 ? front : back;
+      pending_t *other_side = s0 > 0.0 ? back : front;
+      first_side->segs[first_side->num_segs++] = first;
+      other_side->segs[other_side->num_segs++] = second;
+      break;
+    }
+    }
+  }
+}
+
+// Clips a convex polygon to the front of a line, or to its back. The output
+// needs room for one more point than the input.
+static size_t clip_polygon(const dvec2_t *in, size_t n, const line_t *line,
+                           bool keep_back, dvec2_t *out) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    dvec2_t a = in[i], b = in[(i + 1) % n];
+
+    double da = line_side(line, a), db = line_side(line, b);
+    if (keep_back) { da = -da, db = -db; }
+
+    // Points on the line are kept, but crossings are found on the line itself
+    bool a_inside = da > -EPSILON, b_inside = db > -EPSILON;
+    if (a_inside) { out[count++] = a; }
+    if (a_inside != b_inside) {
+      double t     = da / (da - db);
+      out[count++] = (dvec2_t){a.x + t * (b.x - a.x), a.y + t * (b.y - a.y)};
+    }
+  }
+
+  // Drop points that collapsed onto their neighbour
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    dvec2_t prev = kept > 0 ? out[kept - 1] : out[count - 1];
+    if (fabs(out[i].x - prev.x) >= EPSILON ||
+        fabs(out[i].y - prev.y) >= EPSILON) {
+      out[kept++] = out[i];
+    }
+  }
+
+  return kept;
+}
+
+static void bounding_box(const pending_t *side, int16_t bbox[4]) {
+  double top = -INFINITY, bottom = INFINITY;
+  double left = INFINITY, right = -INFINITY;
+  for (size_t i = 0; i < side->num_segs; i++) {
+    const build_seg_t *seg = &side->segs[i];
+    top    = max(top, max(seg->start.y, seg->end.y));
+    bottom = min(bottom, min(seg->start.y, seg->end.y));
+    left   = min(left, min(seg->start.x, seg->end.x));
+    right  = max(right, max(seg->start.x, seg->end.x));
+  }
+
+  bbox[0] = ceil(top), bbox[1] = floor(bottom);
+  bbox[2] = floor(left), bbox[3] = ceil(right);
+}
+
+// Finds the vertex of a seg end at a point, or adds a GL vertex there
+static uint32_t vertex_at(dvec2_t p, const build_seg_t *segs, size_t num_segs) {
+  for (size_t i = 0; i < num_segs; i++) {
+    if (fabs(segs[i].start.x - p.x) < EPSILON &&
+        fabs(segs[i].start.y - p.y) < EPSILON) {
+      return segs[i].start_vertex;
+    }
+    if (fabs(segs[i].end.x - p.x) < EPSILON &&
+        fabs(segs[i].end.y - p.y) < EPSILON) {
+      return segs[i].end_vertex;
+    }
+  }
+
+  return add_vertex(p);
+}
+
+// Distance of a point along an edge from the edge's start
+static double edge_position(const line_t *edge, dvec2_t p) {
+  return ((p.x - edge->origin.x) * edge->dir.x +
+          (p.y - edge->origin.y) * edge->dir.y) /
+         edge->length;
+}
+
+static void push_seg(uint32_t start, uint32_t end, uint32_t linedef,
+                     uint16_t side) {
+  dynarray_push(builder.segments, ((gl_segment_t){start, end, linedef, side}));
+}
+
+// The subsector's polygon is its region clipped to the front of all its segs.
+// Walking around it clockwise, every stretch of an edge that no seg covers is
+// closed with a miniseg, so that consecutive segs share their end points.
+static uint32_t build_subsector(const pending_t *leaf) {
+  const build_seg_t *segs     = leaf->segs;
+  size_t             num_segs = leaf->num_segs;
+
+  dvec2_t *polygon = malloc(sizeof(dvec2_t) * (leaf->region_size + num_segs));
+  dvec2_t *clipped = malloc(sizeof(dvec2_t) * (leaf->region_size + num_segs));
+  size_t   size    = leaf->region_size;
+  memcpy(polygon, leaf->region, sizeof(dvec2_t) * size);
+
+  for (size_t i = 0; i < num_segs && size >= 3; i++) {
+    line_t line = seg_line(&segs[i]);
+    if (line.length < EPSILON) { continue; }
+
+    size = clip_polygon(polygon, size, &line, false, clipped);
+    dvec2_t *tmp = polygon;
+    polygon = clipped, clipped = tmp;
+  }
+
+  gl_subsector_t subsector = {0, builder.segments.count};
+  bool          *emitted   = calloc(num_segs, sizeof(bool));
+  edge_seg_t    *on_edge   = malloc(sizeof(edge_seg_t) * num_segs);
+
+  // A polygon that collapsed to a sliver still gets its segs as a closed loop
+  uint32_t first   = size >= 3 ? vertex_at(polygon[0], segs, num_segs)
+                               : segs[0].start_vertex;
+  uint32_t current = first;
+  for (size_t e = 0; e < size; e++) {
+    dvec2_t a = polygon[e], b = polygon[(e + 1) % size];
+    line_t  edge = {a, {b.x - a.x, b.y - a.y}, 0.0};
+    edge.length  = sqrt(edge.dir.x * edge.dir.x + edge.dir.y * edge.dir.y);
+    if (edge.length < EPSILON) { continue; }
+
+    // Segs along this edge, sorted by where they start on it
+    size_t num_on_edge = 0;
+    for (size_t i = 0; i < num_segs; i++) {
+      double s0, s1;
+      int    side = classify_seg(&segs[i], &edge, &s0, &s1);
+      if (emitted[i] || side != SIDE_FRONT || s0 != 0.0 || s1 != 0.0) {
+        continue;
+      }
+
+      edge_seg_t edge_seg = {i, edge_position(&edge, segs[i].start),
+                             edge_position(&edge, segs[i].end)};
+
+      size_t j = num_on_edge++;
+      for (; j > 0 && on_edge[j - 1].start > edge_seg.start; j--) {
+        on_edge[j] = on_edge[j - 1];
+      }
+      on_edge[j] = edge_seg;
+    }
+
+    double covered = 0.0;
+    for (size_t k = 0; k < num_on_edge; k++) {
+      const build_seg_t *seg = &segs[on_edge[k].seg];
+      if (on_edge[k].start > covered + EPSILON) {
+        push_seg(current, seg->start_vertex, MAP_NO_INDEX, 0);
+      }
+
+      push_seg(seg->start_vertex, seg->end_vertex, seg->linedef, seg->side);
+      emitted[on_edge[k].seg] = true;
+
+      current = seg->end_vertex;
+      covered = max(covered, on_edge[k].end);
+    }
+
+    if (covered < edge.length - EPSILON) {
+      uint32_t end = e + 1 == size ? first : vertex_at(b, segs, num_segs);
+      push_seg(current, end, MAP_NO_INDEX, 0);
+      current = end;
+    }
+  }
+
+  // Segs the polygon missed (slivers and broken geometry) keep their walls,
+  // joined by minisegs so that the loop stays closed
+  for (size_t i = 0; i < num_segs; i++) {
+    if (emitted[i]) { continue; }
+
+    if (current != segs[i].start_vertex) {
+      push_seg(current, segs[i].start_vertex, MAP_NO_INDEX, 0);
+    }
+    push_seg(segs[i].start_vertex, segs[i].end_vertex, segs[i].linedef,
+             segs[i].side);
+    current = segs[i].end_vertex;
+  }
+
+  if (current != first) { push_seg(current, first, MAP_NO_INDEX, 0); }
+
+  subsector.num_segs = builder.segments.count - subsector.first_seg;
+  dynarray_push(builder.subsectors, subsector);
+
+  free(polygon);
+  free(clipped);
+  free(emitted);
+  free(on_edge);
+
+  return builder.subsectors.count - 1;
+}
+
+static void set_child(const pending_t *pending, uint32_t child_id) {
+  if (pending->parent < 0) { return; }
+
+  gl_node_t *parent = &builder.nodes.data[pending->parent];
+  if (pending->is_back) {
+    parent->back_child_id = child_id;
+  } else {
+    parent->front_child_id = child_id;
+  }
+}
+
+static void build_tree(pending_t root) {
+  dynarray_push(builder.pending, root);
+
+  // Built from an explicit stack, since the tree of a large map can be deeper
+  // than the call stack allows
+  while (builder.pending.count > 0) {
+    pending_t pending = builder.pending.data[--builder.pending.count];
+
+    int64_t partition = choose_partition(pending.segs, pending.num_segs);
+    if (partition < 0) {
+      uint32_t subsector = build_subsector(&pending);
+      set_child(&pending, CHILD_IS_SUBSECTOR | subsector);
+    } else {
+      line_t line = seg_line(&pending.segs[partition]);
+
+      pending_t front = {.parent = builder.nodes.count, .is_back = false};
+      pending_t back  = {.parent = builder.nodes.count, .is_back = true};
+      split_segs(pending.segs, pending.num_segs, &line, &front, &back);
+
+      size_t region_size = pending.region_size + 1;
+      front.region       = malloc(sizeof(dvec2_t) * region_size);
+      back.region        = malloc(sizeof(dvec2_t) * region_size);
+      front.region_size  = clip_polygon(pending.region, pending.region_size,
+                                        &line, false, front.region);
+      back.region_size   = clip_polygon(pending.region, pending.region_size,
+                                        &line, true, back.region);
+
+      gl_node_t node = {
+          .partition       = {line.origin.x, line.origin.y},
+          .delta_partition = {line.dir.x, line.dir.y},
+      };
+      bounding_box(&front, node.front_bbox);
+      bounding_box(&back, node.back_bbox);
+
+      set_child(&pending, builder.nodes.count);
+      dynarray_push(builder.nodes, node);
+
+      dynarray_push(builder.pending, back);
+      dynarray_push(builder.pending, front);
+    }
+
+    free(pending.segs);
+    free(pending.region);
+  }
+}
+
+int nodebuild_build(const map_t *map, gl_map_t *gl_map) {
+  builder = (typeof(builder)){0};
+  dynarray_init(builder.vertices, 0);
+  dynarray_init(builder.segments, 0);
+  dynarray_init(builder.subsectors, 0);
+  dynarray_init(builder.nodes, 0);
+  dynarray_init(builder.pending, 0);
+
+  pending_t root = {.parent = -1};
+  root.segs      = malloc(sizeof(build_seg_t) * map->num_linedefs * 2);
+
+  for (size_t i = 0; i < map->num_linedefs; i++) {
+    const linedef_t *linedef = &map->linedefs[i];
+    if (linedef->start_idx >= map->num_vertices ||
+        linedef->end_idx >= map->num_vertices) {
+      continue;
+    }
+
+    vec2_t  v1 = map->vertices[linedef->start_idx];
+    vec2_t  v2 = map->vertices[linedef->end_idx];
+    dvec2_t p1 = {v1.x, v1.y}, p2 = {v2.x, v2.y};
+    if (fabs(p1.x - p2.x) < EPSILON && fabs(p1.y - p2.y) < EPSILON) {
+      continue;
+    }
+
+    if (linedef->front_sidedef < map->num_sidedefs) {
+      root.segs[root.num_segs++] = (build_seg_t){
+          p1, p2, linedef->start_idx, linedef->end_idx, i, 0,
+      };
+    }
+
+    if (linedef->back_sidedef < map->num_sidedefs) {
+      root.segs[root.num_segs++] = (build_seg_t){
+          p2, p1, linedef->end_idx, linedef->start_idx, i, 1,
+      };
+    }
+  }
+
+  if (root.num_segs == 0) {
+    free(root.segs);
+    return 1;
+  }
+
+  // The root region is the map's bounding box, clockwise like subsectors
+  double left = map->min.x - ROOT_MARGIN, right = map->max.x + ROOT_MARGIN;
+  double bottom = map->min.y - ROOT_MARGIN, top = map->max.y + ROOT_MARGIN;
+
+  root.region_size = 4;
+  root.region      = malloc(sizeof(dvec2_t) * root.region_size);
+  root.region[0]   = (dvec2_t){left, top};
+  root.region[1]   = (dvec2_t){right, top};
+  root.region[2]   = (dvec2_t){right, bottom};
+  root.region[3]   = (dvec2_t){left, bottom};
+
+  build_tree(root);
+
+  // Nodes were added parents first, but the root has to be the last node
+  size_t num_nodes = builder.nodes.count;
+  gl_map->nodes     = malloc(sizeof(gl_node_t) * num_nodes);
+  gl_map->num_nodes = num_nodes;
+  for (size_t i = 0; i < num_nodes; i++) {
+    gl_node_t node = builder.nodes.data[i];
+    if ((node.front_child_id & CHILD_IS_SUBSECTOR) == 0) {
+      node.front_child_id = num_nodes - 1 - node.front_child_id;
+    }
+    if ((node.back_child_id & CHILD_IS_SUBSECTOR) == 0) {
+      node.back_child_id = num_nodes - 1 - node.back_child_id;
+    }
+    gl_map->nodes[num_nodes - 1 - i] = node;
+  }
+
+  gl_map->num_vertices = builder.vertices.count;
+  gl_map->vertices     = malloc(sizeof(vec2_t) * gl_map->num_vertices);
+  gl_map->min          = (vec2_t){INFINITY, INFINITY};
+  gl_map->max          = (vec2_t){-INFINITY, -INFINITY};
+  for (size_t i = 0; i < gl_map->num_vertices; i++) {
+    vec2_t v = {builder.vertices.data[i].x, builder.vertices.data[i].y};
+    gl_map->vertices[i] = v;
+
+    gl_map->min.x = min(gl_map->min.x, v.x);
+    gl_map->min.y = min(gl_map->min.y, v.y);
+    gl_map->max.x = max(gl_map->max.x, v.x);
+    gl_map->max.y = max(gl_map->max.y, v.y);
+  }
+
+  gl_map->num_segments   = builder.segments.count;
+  gl_map->segments       = builder.segments.data;
+  gl_map->num_subsectors = builder.subsectors.count;
+  gl_map->subsectors     = builder.subsectors.data;
+
+  free(builder.vertices.data);
+  free(builder.nodes.data);
+  free(builder.pending.data);
+
+  return 0;
+}
@@ -0,0 +1,140 @@
+#include "occlusion.h"
+#include "util.h"
+#include "vector.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+#define COLUMN_ANGLE (2.f * (float)M_PI / OCCLUSION_COLUMNS)
+
+// Walls closer to the eye than this are left out, as the slopes through them
+// are not well defined
+#define MIN_DISTANCE (1.f / 16.f)
+
+static bool  tables_ready;
+static float column_cos[OCCLUSION_COLUMNS], column_sin[OCCLUSION_COLUMNS];
+
+// Angle of a map space point around the eye, in columns from 0 up to
+// OCCLUSION_COLUMNS
+static float column_of(const occlusion_t *occlusion, float x, float y) {
+  float angle = atan2f(y - occlusion->eye.z, x - occlusion->eye.x);
+  if (angle < 0.f) { angle += 2.f * (float)M_PI; }
+  return angle / COLUMN_ANGLE;
+}
+
+static bool is_closed(const occlusion_t *occlusion, int column) {
+  return occlusion->bottom[column] >= occlusion->top[column];
+}
+
+void occlusion_begin(occlusion_t *occlusion, vec3_t eye) {
+  if (!tables_ready) {
+    for (int i = 0; i < OCCLUSION_COLUMNS; i++) {
+      column_cos[i] = cosf((i + .5f) * COLUMN_ANGLE);
+      column_sin[i] = sinf((i + .5f) * COLUMN_ANGLE);
+    }
+    tables_ready = true;
+  }
+
+  occlusion->eye        = eye;
+  occlusion->num_closed = 0;
+  for (int i = 0; i < OCCLUSION_COLUMNS; i++) {
+    occlusion->bottom[i] = -INFINITY;
+    occlusion->top[i]    = INFINITY;
+  }
+}
+
+void occlusion_add_wall(occlusion_t *occlusion, vec2_t start, vec2_t end,
+                        float bottom, float top) {
+  if (occlusion->num_closed == OCCLUSION_COLUMNS) { return; }
+
+  vec2_t eye   = {occlusion->eye.x, occlusion->eye.z};
+  vec2_t delta = vec2_sub(end, start), to_start = vec2_sub(start, eye);
+
+  // The front of a wall is on its right, where the cross product is negative
+  float cross = delta.x * -to_start.y + delta.y * to_start.x;
+  if (cross >= 0.f) { return; }
+
+  // Seen from the front, the wall runs clockwise from start to end. Columns
+  // whose centre it covers are the ones it affects.
+  float first = column_of(occlusion, end.x, end.y);
+  float last  = column_of(occlusion, start.x, start.y);
+  if (last < first) { last += OCCLUSION_COLUMNS; }
+
+  int first_column = ceilf(first - .5f), last_column = floorf(last - .5f);
+  for (int i = first_column; i <= last_column; i++) {
+    int column = i & (OCCLUSION_COLUMNS - 1);
+    if (is_closed(occlusion, column)) { continue; }
+
+    if (bottom >= top) {
+      occlusion->bottom[column] = INFINITY;
+      occlusion->top[column]    = -INFINITY;
+      occlusion->num_closed++;
+      continue;
+    }
+
+    // Where the column's centre ray meets the wall
+    float denominator =
+        column_cos[column] * delta.y - column_sin[column] * delta.x;
+    if (denominator == 0.f) { continue; }
+
+    float distance = (to_start.x * delta.y - to_start.y * delta.x) /
+                     denominator;
+    if (distance < MIN_DISTANCE) { continue; }
+
+    float bottom_slope = (bottom - occlusion->eye.y) / distance;
+    float top_slope    = (top - occlusion->eye.y) / distance;
+    occlusion->bottom[column] = max(occlusion->bottom[column], bottom_slope);
+    occlusion->top[column]    = min(occlusion->top[column], top_slope);
+
+    if (is_closed(occlusion, column)) { occlusion->num_closed++; }
+  }
+}
+
+bool occlusion_test_box(const occlusion_t *occlusion, vec3_t min, vec3_t max) {
+  vec3_t eye = occlusion->eye;
+  if (eye.x >= min.x && eye.x <= max.x && eye.z >= min.z && eye.z <= max.z) {
+    return true;
+  }
+
+  if (occlusion->num_closed == OCCLUSION_COLUMNS) { return false; }
+
+  // The box spans less than half a turn from outside, so its corners are
+  // measured from the direction of its centre to get past the wrap around
+  float centre = column_of(occlusion, (min.x + max.x) / 2.f,
+                           (min.z + max.z) / 2.f);
+  float first = centre, last = centre;
+  float far   = 0.f;
+  for (int i = 0; i < 4; i++) {
+    float x = i & 1 ? max.x : min.x, z = i & 2 ? max.z : min.z;
+
+    float offset = column_of(occlusion, x, z) - centre;
+    if (offset > OCCLUSION_COLUMNS / 2) { offset -= OCCLUSION_COLUMNS; }
+    if (offset < -OCCLUSION_COLUMNS / 2) { offset += OCCLUSION_COLUMNS; }
+
+    first = min(first, centre + offset);
+    last  = max(last, centre + offset);
+    far   = max(far, hypotf(x - eye.x, z - eye.z));
+  }
+
+  float dx   = max(max(min.x - eye.x, eye.x - max.x), 0.f);
+  float dz   = max(max(min.z - eye.z, eye.z - max.z), 0.f);
+  float near = max(hypotf(dx, dz), MIN_DISTANCE);
+
+  // The steepest slopes from the eye to anything in the box
+  float bottom = min.y - eye.y, top = max.y - eye.y;
+  float bottom_slope = bottom / (bottom < 0.f ? near : far);
+  float top_slope    = top / (top > 0.f ? near : far);
+
+  // Columns are tested by their centres, so one more on either side is taken
+  int first_column = floorf(first - .5f) - 1;
+  int last_column  = ceilf(last - .5f) + 1;
+  for (int i = first_column; i <= last_column; i++) {
+    int column = i & (OCCLUSION_COLUMNS - 1);
+    if (occlusion->bottom[column] < top_slope &&
+        occlusion->top[column] > bottom_slope) {
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,585 @@
+#include "pvs.h"
+#include "dynarray.h"
+#include "gl_map.h"
+#include "jobs.h"
+#include "map.h"
+#include "util.h"
+#include "vector.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Distance below which a point counts as lying on a line
+#define ON_EPSILON (1.0 / 8.0)
+
+// How far across a seg the subsectors on its other side are looked up
+#define PROBE_DISTANCE 0.5
+
+// Spans shorter than this are not split any further to find out where the
+// subsector on the other side changes
+#define MIN_PROBE_SPAN 1.0
+
+#define PORTALS_PER_JOB 16
+
+// Words of leaf sets a single flow may go through before it gives up and
+// keeps everything its flood reached. Open areas have paths through them
+// that multiply with every portal, and this keeps them from taking minutes.
+#define MAX_FLOW_WORK (1 << 20)
+
+typedef struct dvec2 {
+  double x, y;
+} dvec2_t;
+
+// A portal leads out of a leaf, which is on its right, into the target leaf
+typedef struct portal {
+  dvec2_t  a, b;
+  uint32_t leaf, target;
+} portal_t;
+
+typedef struct flow_job {
+  size_t first, count;
+} flow_job_t;
+
+// One flow from a source portal. Every depth of the walk has its own set of
+// leaves that might still be seen, narrowed at each portal it goes through.
+typedef struct flow {
+  uint64_t *vis;
+  uint64_t *might;
+  size_t    max_depth;
+  size_t    work;
+} flow_t;
+
+static struct {
+  const map_t    *map;
+  const gl_map_t *gl_map;
+
+  dynarray(portal_t) portals;
+  uint32_t *leaf_portals; // first portal of each leaf, plus the end
+
+  size_t    num_words; // per set of leaves
+  uint64_t *flood;     // leaves each portal might see
+  uint64_t *vis;       // leaves each portal does see
+  uint32_t *might_see; // number of leaves in each flood
+  uint32_t *order;     // portals in the order their flows run
+  bool     *done;      // whether each portal's vis is complete
+} builder;
+
+static inline bool test_bit(const uint64_t *bits, uint32_t i) {
+  return bits[i / 64] & (1ull << (i % 64));
+}
+
+static inline void set_bit(uint64_t *bits, uint32_t i) {
+  bits[i / 64] |= 1ull << (i % 64);
+}
+
+static inline uint64_t *portal_bits(uint64_t *sets, size_t portal) {
+  return sets + portal * builder.num_words;
+}
+
+static dvec2_t lerp(dvec2_t a, dvec2_t b, double t) {
+  return (dvec2_t){a.x + t * (b.x - a.x), a.y + t * (b.y - a.y)};
+}
+
+// Signed distance of a point from the line through a and b, positive on the
+// left, which is the side a portal leads into
+static double line_side(dvec2_t a, dvec2_t b, dvec2_t p) {
+  double dx = b.x - a.x, dy = b.y - a.y;
+  double length = sqrt(dx * dx + dy * dy);
+  if (length == 0.0) { return 0.0; }
+
+  return (dx * (p.y - a.y) - dy * (p.x - a.x)) / length;
+}
+
+// Keeps the part of the segment from p to q that is further than the margin
+// to the left of the line through a and b. Returns false if none is.
+static bool clip_segment(dvec2_t *p, dvec2_t *q, dvec2_t a, dvec2_t b,
+                         double margin) {
+  double dp = line_side(a, b, *p) - margin, dq = line_side(a, b, *q) - margin;
+  if (dp <= 0.0 && dq <= 0.0) { return false; }
+
+  if (dp < 0.0) {
+    *p = lerp(*p, *q, dp / (dp - dq));
+  } else if (dq < 0.0) {
+    *q = lerp(*p, *q, dp / (dp - dq));
+  }
+
+  return true;
+}
+
+static dvec2_t vertex_position(uint32_t id) {
+  vec2_t v = id & VERT_IS_GL ? builder.gl_map->vertices[id & ~VERT_IS_GL]
+                             : builder.map->vertices[id];
+  return (dvec2_t){v.x, v.y};
+}
+
+static uint32_t locate_leaf(dvec2_t p) {
+  const gl_map_t *gl_map = builder.gl_map;
+
+  uint32_t id = CHILD_IS_SUBSECTOR; // a map without nodes is one subsector
+  if (gl_map->num_nodes > 0) { id = gl_map->num_nodes - 1; }
+
+  while ((id & CHILD_IS_SUBSECTOR) == 0) {
+    if (id >= gl_map->num_nodes) { return MAP_NO_INDEX; }
+
+    const gl_node_t *node = &gl_map->nodes[id];
+
+    double dx = p.x - node->partition.x, dy = p.y - node->partition.y;
+    bool   is_on_back =
+        dx * node->delta_partition.y - dy * node->delta_partition.x <= 0.0;
+
+    id = is_on_back ? node->back_child_id : node->front_child_id;
+  }
+
+  id &= ~CHILD_IS_SUBSECTOR;
+  return id < gl_map->num_subsectors ? id : MAP_NO_INDEX;
+}
+
+// Segs that sight passes through: minisegs and two-sided lines
+static bool is_passable(const gl_segment_t *seg) {
+  if (seg->linedef == MAP_NO_INDEX) { return true; }
+  if (seg->linedef >= builder.map->num_linedefs) { return false; }
+
+  const linedef_t *linedef = &builder.map->linedefs[seg->linedef];
+  return linedef->front_sidedef < builder.map->num_sidedefs &&
+         linedef->back_sidedef < builder.map->num_sidedefs;
+}
+
+typedef struct probe {
+  uint32_t leaf;
+  dvec2_t  a, b, across;
+  double   length;
+  size_t   first_portal; // the first portal found along this seg
+} probe_t;
+
+static uint32_t probe_leaf(const probe_t *probe, double t) {
+  // Kept away from the ends, where the seg meets other subsectors
+  double inset = min(PROBE_DISTANCE / probe->length, 0.25);
+  t            = min(max(t, inset), 1.0 - inset);
+
+  dvec2_t p = lerp(probe->a, probe->b, t);
+  return locate_leaf((dvec2_t){p.x + probe->across.x, p.y + probe->across.y});
+}
+
+static void add_portal(const probe_t *probe, uint32_t target, double t0,
+                       double t1) {
+  if (target == MAP_NO_INDEX || target == probe->leaf) { return; }
+
+  dvec2_t a = lerp(probe->a, probe->b, t0), b = lerp(probe->a, probe->b, t1);
+
+  // Stretches of one seg that lead into the same leaf become one portal
+  if (builder.portals.count > probe->first_portal) {
+    portal_t *last = &builder.portals.data[builder.portals.count - 1];
+    if (last->leaf == probe->leaf && last->target == target &&
+        last->b.x == a.x && last->b.y == a.y) {
+      last->b = b;
+      return;
+    }
+  }
+
+  dynarray_push(builder.portals, ((portal_t){a, b, probe->leaf, target}));
+}
+
+// Splits the span between t0 and t1 until each part has a single leaf on the
+// other side of the seg. As leaves are convex, a leaf found at both ends of a
+// span covers all of it.
+static void find_portals(const probe_t *probe, double t0, uint32_t leaf0,
+                         double t1, uint32_t leaf1) {
+  if (leaf0 == leaf1) {
+    add_portal(probe, leaf0, t0, t1);
+    return;
+  }
+
+  double mid = (t0 + t1) / 2.0;
+  if ((t1 - t0) * probe->length < MIN_PROBE_SPAN) {
+    add_portal(probe, leaf0, t0, mid);
+    add_portal(probe, leaf1, mid, t1);
+    return;
+  }
+
+  uint32_t leaf_mid = probe_leaf(probe, mid);
+  find_portals(probe, t0, leaf0, mid, leaf_mid);
+  find_portals(probe, mid, leaf_mid, t1, leaf1);
+}
+
+static void find_leaf_portals(uint32_t leaf) {
+  const gl_subsector_t *subsector = &builder.gl_map->subsectors[leaf];
+
+  for (uint32_t i = 0; i < subsector->num_segs; i++) {
+    const gl_segment_t *seg =
+        &builder.gl_map->segments[subsector->first_seg + i];
+    if (!is_passable(seg)) { continue; }
+
+    probe_t probe = {
+        .leaf         = leaf,
+        .a            = vertex_position(seg->start_vertex),
+        .b            = vertex_position(seg->end_vertex),
+        .first_portal = builder.portals.count,
+    };
+
+    double dx = probe.b.x - probe.a.x, dy = probe.b.y - probe.a.y;
+    probe.length = sqrt(dx * dx + dy * dy);
+    if (probe.length < ON_EPSILON) { continue; }
+
+    // The leaf itself is on the seg's right, so the other side is its left
+    probe.across = (dvec2_t){-dy / probe.length * PROBE_DISTANCE,
+                             dx / probe.length * PROBE_DISTANCE};
+
+    find_portals(&probe, 0.0, probe_leaf(&probe, 0.0), 1.0,
+                 probe_leaf(&probe, 1.0));
+  }
+}
+
+// Whether sight through one portal can go on through another: the second has
+// to reach in front of the first, and the first behind the second
+static bool portal_may_see(const portal_t *from, const portal_t *to) {
+  return (line_side(from->a, from->b, to->a) > ON_EPSILON ||
+          line_side(from->a, from->b, to->b) > ON_EPSILON) &&
+         (line_side(to->a, to->b, from->a) < -ON_EPSILON ||
+          line_side(to->a, to->b, from->b) < -ON_EPSILON);
+}
+
+// A quick and generous first pass: the leaves reachable from a portal through
+// portals it may see, which bounds the exact flow
+static void flood_portal(size_t index, uint32_t *stack) {
+  const portal_t *source = &builder.portals.data[index];
+  uint64_t       *flood  = portal_bits(builder.flood, index);
+
+  size_t count    = 0;
+  stack[count++]  = source->target;
+  set_bit(flood, source->target);
+
+  while (count > 0) {
+    uint32_t leaf = stack[--count];
+
+    for (uint32_t i = builder.leaf_portals[leaf];
+         i < builder.leaf_portals[leaf + 1]; i++) {
+      const portal_t *portal = &builder.portals.data[i];
+      if (test_bit(flood, portal->target) || !portal_may_see(source, portal)) {
+        continue;
+      }
+
+      set_bit(flood, portal->target);
+      stack[count++] = portal->target;
+    }
+  }
+}
+
+static void flood_portals(void *arg) {
+  flow_job_t *job   = arg;
+  uint32_t   *stack = malloc(sizeof(uint32_t) * builder.gl_map->num_subsectors);
+
+  for (size_t i = job->first; i < job->first + job->count; i++) {
+    flood_portal(i, stack);
+  }
+
+  free(stack);
+}
+
+// Clips a target portal to what the source can see of it through the pass.
+// Each separating line runs through an end of the source and an end of the
+// pass, with their other ends on opposite sides, and the target has to be on
+// the pass's side. Points close to a line are kept, to stay on the safe side.
+static bool clip_to_separators(dvec2_t *p, dvec2_t *q, const dvec2_t source[2],
+                               const dvec2_t pass[2]) {
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      dvec2_t s = source[i], t = pass[j];
+
+      double source_side = line_side(s, t, source[1 - i]);
+      double pass_side   = line_side(s, t, pass[1 - j]);
+
+      bool is_separator = (source_side < -ON_EPSILON && pass_side > 0.0) ||
+                          (source_side > ON_EPSILON && pass_side < 0.0);
+      if (!is_separator) { continue; }
+
+      bool clipped = pass_side > 0.0
+                         ? clip_segment(p, q, s, t, -ON_EPSILON)
+                         : clip_segment(p, q, t, s, -ON_EPSILON);
+      if (!clipped) { return false; }
+    }
+  }
+
+  return true;
+}
+
+// Walks on from a leaf through every portal that some of the source can still
+// see through the pass, which is NULL in the first leaf past the source
+static void flow_leaf(flow_t *flow, uint32_t leaf, const dvec2_t source[2],
+                      const dvec2_t *pass, size_t depth) {
+  size_t num_words = builder.num_words;
+  set_bit(flow->vis, leaf);
+
+  if (flow->work > MAX_FLOW_WORK) { return; }
+
+  // A walk can not pass through more leaves than there are
+  if (depth + 1 >= builder.gl_map->num_subsectors) { return; }
+
+  if (depth + 1 >= flow->max_depth) {
+    flow->max_depth *= 2;
+    flow->might = realloc(flow->might,
+                          sizeof(uint64_t) * num_words * flow->max_depth);
+  }
+
+  for (uint32_t i = builder.leaf_portals[leaf];
+       i < builder.leaf_portals[leaf + 1]; i++) {
+    const portal_t *portal = &builder.portals.data[i];
+
+    uint64_t *might = flow->might + depth * num_words;
+    if (!test_bit(might, portal->target)) { continue; }
+
+    // A portal whose own flow is done knows exactly what it sees. Nothing new
+    // can be found past a leaf that is already seen, once the portal leaves
+    // no more leaves that might be.
+    bool      is_done = __atomic_load_n(&builder.done[i], __ATOMIC_ACQUIRE);
+    uint64_t *test    = portal_bits(is_done ? builder.vis : builder.flood, i);
+    uint64_t *next    = might + num_words;
+    bool      more    = false;
+    for (size_t w = 0; w < num_words; w++) {
+      next[w] = might[w] & test[w];
+      more |= (next[w] & ~flow->vis[w]) != 0;
+    }
+    flow->work += num_words;
+    if (!more && test_bit(flow->vis, portal->target)) { continue; }
+
+    dvec2_t p = portal->a, q = portal->b;
+    if (!clip_segment(&p, &q, source[0], source[1], ON_EPSILON)) { continue; }
+
+    dvec2_t next_pass[2] = {p, q};
+    if (pass == NULL) {
+      flow_leaf(flow, portal->target, source, next_pass, depth + 1);
+      continue;
+    }
+
+    // Only the part of the source behind the target can see through it
+    dvec2_t next_source[2] = {source[0], source[1]};
+    if (!clip_segment(&next_source[0], &next_source[1], portal->b, portal->a,
+                      -ON_EPSILON) ||
+        !clip_to_separators(&next_pass[0], &next_pass[1], next_source, pass)) {
+      continue;
+    }
+
+    flow_leaf(flow, portal->target, next_source, next_pass, depth + 1);
+  }
+}
+
+static void flow_portals(void *arg) {
+  flow_job_t *job       = arg;
+  size_t      num_words = builder.num_words;
+
+  flow_t flow = {.max_depth = 64};
+  flow.might  = malloc(sizeof(uint64_t) * num_words * flow.max_depth);
+
+  for (size_t i = job->first; i < job->first + job->count; i++) {
+    uint32_t        index  = builder.order[i];
+    const portal_t *portal = &builder.portals.data[index];
+
+    flow.vis  = portal_bits(builder.vis, index);
+    flow.work = 0;
+    memcpy(flow.might, portal_bits(builder.flood, index),
+           sizeof(uint64_t) * num_words);
+
+    dvec2_t source[2] = {portal->a, portal->b};
+    flow_leaf(&flow, portal->target, source, NULL, 0);
+
+    if (flow.work > MAX_FLOW_WORK) {
+      memcpy(flow.vis, flow.might, sizeof(uint64_t) * num_words);
+    }
+
+    __atomic_store_n(&builder.done[index], true, __ATOMIC_RELEASE);
+  }
+
+  free(flow.might);
+}
+
+// Portals that might see the least go first, so that the portals they pass
+// through are more likely to be done by the time larger flows get to them
+static int compare_might_see(const void *a, const void *b) {
+  uint32_t count_a = builder.might_see[*(const uint32_t *)a];
+  uint32_t count_b = builder.might_see[*(const uint32_t *)b];
+  return (count_a > count_b) - (count_a < count_b);
+}
+
+static void run_jobs(job_fn_t fn) {
+  size_t num_portals = builder.portals.count;
+  size_t num_jobs    = (num_portals + PORTALS_PER_JOB - 1) / PORTALS_PER_JOB;
+  flow_job_t *jobs   = malloc(sizeof(flow_job_t) * num_jobs);
+
+  jobs_group_t group = {0};
+  for (size_t i = 0; i < num_jobs; i++) {
+    size_t first = i * PORTALS_PER_JOB;
+    jobs[i] = (flow_job_t){first, min(num_portals - first, PORTALS_PER_JOB)};
+
+    if (jobs_num_threads() > 0) {
+      jobs_submit_group(fn, &jobs[i], &group);
+    } else {
+      fn(&jobs[i]);
+    }
+  }
+
+  if (jobs_num_threads() > 0) { jobs_wait_group(&group); }
+  free(jobs);
+}
+
+// Writes a row with each run of zero bytes as a zero and the run's length
+static void compress_row(const uint64_t *bits, size_t row_size,
+                         pvs_t *pvs, size_t *capacity) {
+  size_t i = 0;
+  while (i < row_size) {
+    if (pvs->size + 2 > *capacity) {
+      *capacity *= 2;
+      pvs->data = realloc(pvs->data, *capacity);
+    }
+
+    uint8_t byte = bits[i / 8] >> (i % 8 * 8);
+    if (byte != 0) {
+      pvs->data[pvs->size++] = byte;
+      i++;
+      continue;
+    }
+
+    size_t run = 1;
+    while (i + run < row_size && run < 255 &&
+           (uint8_t)(bits[(i + run) / 8] >> ((i + run) % 8 * 8)) == 0) {
+      run++;
+    }
+
+    pvs->data[pvs->size++] = 0;
+    pvs->data[pvs->size++] = run;
+    i += run;
+  }
+}
+
+int pvs_build(const map_t *map, const gl_map_t *gl_map, pvs_t *pvs) {
+  size_t num_leaves = gl_map->num_subsectors;
+  if (num_leaves == 0) { return 1; }
+
+  builder = (typeof(builder)){map, gl_map};
+  dynarray_init(builder.portals, 0);
+
+  builder.leaf_portals = malloc(sizeof(uint32_t) * (num_leaves + 1));
+  for (uint32_t i = 0; i < num_leaves; i++) {
+    builder.leaf_portals[i] = builder.portals.count;
+    find_leaf_portals(i);
+  }
+  builder.leaf_portals[num_leaves] = builder.portals.count;
+
+  size_t num_portals  = builder.portals.count;
+  size_t num_words    = (num_leaves + 63) / 64;
+  builder.num_words   = num_words;
+  builder.flood       = calloc(num_portals * num_words, sizeof(uint64_t));
+  builder.vis         = calloc(num_portals * num_words, sizeof(uint64_t));
+  builder.might_see   = malloc(sizeof(uint32_t) * num_portals);
+  builder.order       = malloc(sizeof(uint32_t) * num_portals);
+  builder.done        = calloc(num_portals, sizeof(bool));
+
+  run_jobs(flood_portals);
+
+  for (uint32_t i = 0; i < num_portals; i++) {
+    uint64_t *flood = portal_bits(builder.flood, i);
+    uint32_t  count = 0;
+    for (size_t w = 0; w < num_words; w++) {
+      count += __builtin_popcountll(flood[w]);
+    }
+    builder.might_see[i] = count;
+    builder.order[i]     = i;
+  }
+  qsort(builder.order, num_portals, sizeof(uint32_t), compare_might_see);
+
+  run_jobs(flow_portals);
+
+  // A leaf sees itself and whatever its portals see. Sight goes both ways, so
+  // the rows are made symmetric, which also covers for the clipping being
+  // done from one side only.
+  uint64_t *rows = calloc(num_leaves * num_words, sizeof(uint64_t));
+  for (uint32_t i = 0; i < num_leaves; i++) {
+    uint64_t *row = rows + i * num_words;
+    set_bit(row, i);
+
+    for (uint32_t j = builder.leaf_portals[i]; j < builder.leaf_portals[i + 1];
+         j++) {
+      uint64_t *vis = portal_bits(builder.vis, j);
+      for (size_t w = 0; w < num_words; w++) {
+        row[w] |= vis[w];
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < num_leaves; i++) {
+    const uint64_t *row = rows + i * num_words;
+    for (size_t w = 0; w < num_words; w++) {
+      for (uint64_t bits = row[w]; bits != 0; bits &= bits - 1) {
+        size_t j = w * 64 + __builtin_ctzll(bits);
+        set_bit(rows + j * num_words, i);
+      }
+    }
+  }
+
+  size_t row_size = (num_leaves + 7) / 8;
+  size_t capacity = 64;
+
+  *pvs = (pvs_t){num_leaves, 0, malloc(sizeof(uint32_t) * (num_leaves + 1)),
+                 malloc(capacity)};
+  for (uint32_t i = 0; i < num_leaves; i++) {
+    pvs->offsets[i] = pvs->size;
+    compress_row(rows + i * num_words, row_size, pvs, &capacity);
+  }
+  pvs->offsets[num_leaves] = pvs->size;
+
+  free(rows);
+  free(builder.portals.data);
+  free(builder.leaf_portals);
+  free(builder.flood);
+  free(builder.vis);
+  free(builder.might_see);
+  free(builder.order);
+  free(builder.done);
+
+  return 0;
+}
+
+void pvs_get_row(const pvs_t *pvs, uint32_t subsector, uint8_t *row) {
+  size_t row_size = (pvs->num_subsectors + 7) / 8;
+  size_t out      = 0;
+
+  const uint8_t *in  = pvs->data + pvs->offsets[subsector];
+  const uint8_t *end = pvs->data + pvs->offsets[subsector + 1];
+  while (in < end && out < row_size) {
+    if (*in != 0) {
+      row[out++] = *in++;
+    } else if (in + 1 < end) {
+      size_t run = min((size_t)in[1], row_size - out);
+      memset(row + out, 0, run);
+      out += run, in += 2;
+    } else {
+      break;
+    }
+  }
+
+  memset(row + out, 0, row_size - out);
+}
+
+float pvs_culled_fraction(const pvs_t *pvs) {
+  size_t num = pvs->num_subsectors;
+  if (num == 0) { return 0.f; }
+
+  uint8_t *row  = malloc((num + 7) / 8);
+  double   seen = 0.0;
+  for (uint32_t i = 0; i < num; i++) {
+    pvs_get_row(pvs, i, row);
+    for (size_t j = 0; j < (num + 7) / 8; j++) {
+      seen += __builtin_popcount(row[j]);
+    }
+  }
+  free(row);
+
+  return 1.0 - seen / ((double)num * num);
+}
+
+void pvs_free(pvs_t *pvs) {
+  free(pvs->offsets);
+  free(pvs->data);
+  *pvs = (pvs_t){0};
+}
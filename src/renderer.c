@@ -1,39 +1,87 @@
 #include "renderer.h"
+#include "dynarray.h"
 #include "gl_helpers.h"
 #include "matrix.h"
 #include "mesh.h"
 #include "vector.h"
 
 #include <GL/glew.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
-static void init_skybox();
 static void init_shaders();
 
+// Per frame state that every shader reads from one uniform buffer, laid out
+// for std140
+#define FRAME_BLOCK_SRC                                                        \
+  "layout (std140) uniform Frame {\n"                                          \
+  "  mat4 view;\n"                                                             \
+  "  mat4 projection;\n"                                                       \
+  "  mat4 view_projection;\n"                                                  \
+  "  int palette_index;\n"                                                     \
+  "  float time;\n"                                                            \
+  "};\n"
+
+typedef struct frame_uniforms {
+  mat4_t  view, projection, view_projection;
+  int32_t palette_index;
+  float   time;
+  float   padding[2];
+} frame_uniforms_t;
+
+#define FRAME_BINDING 0
+
+// Vertices are packed as in mesh.h: texture coordinates are in quarter texels
+// and the texture type is in the top two bits of the index. Flats and wall
+// textures go through their frame table, which the animations update, so that
+// the vertices only ever hold the first frame. The wall frame table also maps
+// each texture to its layer, as only the used ones are uploaded.
 const char *vert_src =
     "#version 330 core\n"
     "layout (location = 0) in vec3 pos;\n"
     "layout (location = 1) in vec2 texCoords;\n"
-    "layout (location = 2) in int texIndex;\n"
-    "layout (location = 3) in int texType;\n"
-    "layout (location = 4) in float light;\n"
-    "layout (location = 5) in vec2 maxTexCoords;\n"
+    "layout (location = 2) in uint packedTexture;\n"
+    "layout (location = 3) in float light;\n"
     "out vec2 TexCoords;\n"
     "flat out int TexIndex;\n"
     "flat out int TexType;\n"
     "flat out vec2 MaxTexCoords;"
     "out float Light;\n"
+    "out vec3 SkyRay;\n"
+    FRAME_BLOCK_SRC
     "uniform mat4 model;\n"
-    "uniform mat4 view;\n"
-    "uniform mat4 projection;\n"
+    "uniform isamplerBuffer flat_frames;\n"
+    "uniform isamplerBuffer wall_frames;\n"
+    "uniform samplerBuffer wall_max_coords;\n"
+    "uniform usampler2DArray wall_tex;\n"
     "void main() {\n"
-    "  gl_Position = projection * view * model * vec4(pos, 1.0);\n"
-    "  TexIndex = texIndex;\n"
-    "  TexType = texType;\n"
-    "  TexCoords = texCoords;\n"
-    "  Light = light;\n"
-    "  MaxTexCoords = maxTexCoords;\n"
+    "  gl_Position = view_projection * model * vec4(pos, 1.0);\n"
+    "  vec3 eye = -view[3].xyz * mat3(view);\n"
+    "  SkyRay = (model * vec4(pos, 1.0)).xyz - eye;\n"
+    "  TexType = int(packedTexture >> 14u);\n"
+    "  TexIndex = int(packedTexture & 0x3fffu);\n"
+    "  vec2 texels = texCoords / 4.0;\n"
+    "  TexCoords = texels;\n"
+    "  MaxTexCoords = vec2(1.0);\n"
+    "  if (TexIndex == 0x3fff) {\n"
+    "    TexIndex = -1;\n"
+    "  } else if (TexType == 1) {\n"
+    "    TexIndex = texelFetch(flat_frames, TexIndex).r;\n"
+    "    TexCoords = texels / 64.0;\n"
+    "  } else if (TexType >= 2) {\n"
+    "    TexIndex = texelFetch(wall_frames, TexIndex).r;\n"
+    "    TexCoords = texels / vec2(textureSize(wall_tex, 0).xy);\n"
+    "    MaxTexCoords = texelFetch(wall_max_coords, TexIndex).rg;\n"
+    "  }\n"
+    "  Light = TexType == 3 ? 1.0 : light / 256.0;\n"
     "}\n";
 
+// Texture type 3 is the sky, a wall texture wrapped around the eye four times
+// as in the original, where row 100 of 128 is level with the eye and a unit of
+// slope is 160 rows. It is looked up along the ray to the fragment, so it
+// stays put however far away the surface is.
 const char *frag_src =
     "#version 330 core\n"
     "in vec2 TexCoords;\n"
@@ -41,11 +89,18 @@ const char *frag_src =
     "flat in int TexType;\n"
     "flat in vec2 MaxTexCoords;"
     "in float Light;\n"
+    "in vec3 SkyRay;\n"
     "out vec4 fragColor;\n"
     "uniform usampler2DArray flat_tex;\n"
     "uniform usampler2DArray wall_tex;\n"
     "uniform sampler1DArray palettes;\n"
-    "uniform int palette_index;\n"
+    FRAME_BLOCK_SRC
+    "vec2 sky_coords(vec3 ray) {\n"
+    "  float angle = atan(ray.z, ray.x) * 2.0 / 3.14159265;\n"
+    "  float slope = ray.y / length(ray.xz);\n"
+    "  return vec2(fract(-angle), "
+    "              clamp((100.0 - 160.0 * slope) / 128.0, 0.0, 0.999));\n"
+    "}\n"
     "void main() {\n"
     "  vec3 color;"
     "  if (TexIndex == -1) { discard; }\n"
@@ -55,100 +110,169 @@ const char *frag_src =
     "  } else if (TexType == 1) {\n"
     "    color = vec3(texelFetch(palettes, ivec2(int(texture(flat_tex, "
     "                 vec3(TexCoords, TexIndex)).r), palette_index), 0));\n"
-    "  } else if (TexType == 2) {\n"
+    "  } else if (TexType == 2 || TexType == 3) {\n"
+    "    vec2 coords = TexType == 2 ? fract(TexCoords / MaxTexCoords) "
+    "                               : sky_coords(SkyRay);\n"
     "    color = vec3(texelFetch(palettes, ivec2(int(texture(wall_tex, "
-    "                 vec3(fract(TexCoords / MaxTexCoords) * MaxTexCoords, "
-    "                             TexIndex)).r), palette_index), 0));\n"
+    "                 vec3(coords * MaxTexCoords, TexIndex)).r), "
+    "                 palette_index), 0));\n"
     "  }\n"
     "  fragColor = vec4(color * Light, 1.0);\n"
     "}\n";
 
-const char *plain_vert_src =
-    "#version 330 core\n"
-    "layout (location = 0) in vec3 pos;\n"
-    "uniform mat4 model;\n"
-    "uniform mat4 view;\n"
-    "uniform mat4 projection;\n"
-    "void main() {\n"
-    "  gl_Position = projection * view * model * vec4(pos, 1.0);\n"
-    "}\n";
+static struct {
+  GLuint id;
+  GLint  model_location;
+} shaders[NUM_SHADERS];
 
-const char *plain_frag_src =
-    "#version 330 core\n"
-    "out vec4 fragColor;\n"
-    "void main() {\n"
-    "  fragColor = vec4(1.0, 1.0, 1.0, 1.0);\n"
-    "}\n";
+// Written to the uniform buffer once per frame, at the first flush after it
+// changed
+static frame_uniforms_t frame_uniforms;
+static GLuint           frame_buffer;
+static bool             is_frame_dirty;
+
+static float width, height;
+
+// Current frame of every flat and wall texture, as buffer textures
+enum { FRAMES_FLAT, FRAMES_WALL, NUM_FRAME_TABLES };
+static GLuint frame_buffers[NUM_FRAME_TABLES], frame_textures[NUM_FRAME_TABLES];
+
+// Size of every wall texture in the texture array, as a buffer texture
+static GLuint max_coords_buffer, max_coords_texture;
+
+typedef enum draw_kind {
+  DRAW_MESH,
+  DRAW_RANGES,
+  DRAW_INDIRECT,
+} draw_kind_t;
+
+// A recorded draw. The key orders packets by program and vertex array, and
+// then by the order they were recorded in.
+typedef struct render_packet {
+  uint64_t    key;
+  draw_kind_t kind;
+  int         shader;
+  GLuint      vao;
+  GLenum      index_type;
+  mat4_t      transformation;
+  union {
+    GLsizei num_indices;
+    struct {
+      const GLsizei     *counts;
+      const void *const *offsets;
+      size_t             num_ranges;
+    } ranges;
+    struct {
+      GLintptr offset, count_offset;
+      GLsizei  max_draws;
+    } indirect;
+  };
+} render_packet_t;
 
-const char *sky_vert_src =
-    "#version 330 core\n"
-    "layout (location = 0) in vec3 pos;\n"
-    "out vec3 TexCoords;\n"
-    "uniform mat4 view;\n"
-    "uniform mat4 projection;\n"
-    "void main() {\n"
-    "  gl_Position = projection * mat4(mat3(view)) * vec4(pos, 1.0);\n"
-    "  TexCoords = pos;\n"
-    "}\n";
-
-const char *sky_frag_src =
-    "#version 330 core\n"
-    "in vec3 TexCoords;\n"
-    "out vec4 fragColor;\n"
-    "uniform sampler1DArray palettes;\n"
-    "uniform usamplerCube sky;\n"
-    "uniform int palette_index;\n"
-    "void main() {\n"
-    "  fragColor = texelFetch(palettes, ivec2(int(texture(sky, TexCoords).r), "
-    "palette_index), 0);\n"
-    "}\n";
+static dynarray(render_packet_t) queue;
 
+// GL state as the renderer last set it, so that binds and uniforms that would
+// not change anything are left out. The program and the vertex array are
+// forgotten at the start of every frame, as meshes and compute shaders bind
+// their own; uniforms stay with their program.
 static struct {
-  GLuint id;
-  GLint  model_location, view_location, projection_location;
-  GLint  palette_index_location;
-} shaders[NUM_SHADERS];
+  GLuint program, vao;
+  bool   has_model[NUM_SHADERS];
+  mat4_t model[NUM_SHADERS];
+} bound;
 
-static GLuint skybox_vao, skybox_vbo;
-static float  width, height;
+static size_t num_state_changes, num_draw_calls;
 
 void renderer_init(int w, int h) {
   width  = w;
   height = h;
 
   glClearColor(.1f, .1f, .1f, 1.f);
-  glEnable(GL_STENCIL_TEST);
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
 
-  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-  glStencilFunc(GL_ALWAYS, 1, 0xff);
+  dynarray_init(queue, 0);
+  bound = (typeof(bound)){0};
+
+  glGenBuffers(1, &frame_buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(frame_uniforms_t), NULL,
+               GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, frame_buffer);
+  frame_uniforms = (frame_uniforms_t){
+      .view       = mat4_identity(),
+      .projection = mat4_identity(),
+  };
+  is_frame_dirty = true;
+
+  glGenBuffers(NUM_FRAME_TABLES, frame_buffers);
+  glGenTextures(NUM_FRAME_TABLES, frame_textures);
+  glGenBuffers(1, &max_coords_buffer);
+  glGenTextures(1, &max_coords_texture);
 
-  init_skybox();
   init_shaders();
 }
 
+void renderer_use_program(GLuint program) {
+  if (bound.program == program) { return; }
+
+  glUseProgram(program);
+  bound.program = program;
+  num_state_changes++;
+}
+
+static void bind_vertex_array(GLuint vao) {
+  if (bound.vao == vao) { return; }
+
+  glBindVertexArray(vao);
+  bound.vao = vao;
+  num_state_changes++;
+}
+
+static void set_model(int shader, mat4_t transformation) {
+  if (shaders[shader].model_location == -1) { return; }
+  if (bound.has_model[shader] &&
+      memcmp(&bound.model[shader], &transformation, sizeof(mat4_t)) == 0) {
+    return;
+  }
+
+  renderer_use_program(shaders[shader].id);
+  glUniformMatrix4fv(shaders[shader].model_location, 1, GL_FALSE,
+                     transformation.v);
+  bound.has_model[shader] = true;
+  bound.model[shader]     = transformation;
+  num_state_changes++;
+}
+
 void renderer_clear() {
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+  num_state_changes = 0;
+  num_draw_calls    = 0;
+  bound.program = bound.vao = 0;
+
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
+size_t renderer_num_state_changes() { return num_state_changes; }
+
+size_t renderer_num_draw_calls() { return num_draw_calls; }
+
 void renderer_set_view(mat4_t view) {
-  for (int i = 0; i < NUM_SHADERS; i++) {
-    glUseProgram(shaders[i].id);
-    if (shaders[i].view_location != -1) {
-      glUniformMatrix4fv(shaders[i].view_location, 1, GL_FALSE, view.v);
-    }
-  }
+  frame_uniforms.view = view;
+  frame_uniforms.view_projection =
+      mat4_mul(view, frame_uniforms.projection);
+  is_frame_dirty = true;
 }
 
 void renderer_set_projection(mat4_t projection) {
-  for (int i = 0; i < NUM_SHADERS; i++) {
-    glUseProgram(shaders[i].id);
-    if (shaders[i].projection_location != -1) {
-      glUniformMatrix4fv(shaders[i].projection_location, 1, GL_FALSE,
-                         projection.v);
-    }
-  }
+  frame_uniforms.projection = projection;
+  frame_uniforms.view_projection =
+      mat4_mul(frame_uniforms.view, projection);
+  is_frame_dirty = true;
+}
+
+void renderer_set_time(float time) {
+  frame_uniforms.time = time;
+  is_frame_dirty      = true;
 }
 
 void renderer_set_palette_texture(GLuint palette_texture) {
@@ -157,12 +281,8 @@ void renderer_set_palette_texture(GLuint palette_texture) {
 }
 
 void renderer_set_palette_index(int index) {
-  for (int i = 0; i < NUM_SHADERS; i++) {
-    glUseProgram(shaders[i].id);
-    if (shaders[i].palette_index_location != -1) {
-      glUniform1i(shaders[i].palette_index_location, index);
-    }
-  }
+  frame_uniforms.palette_index = index;
+  is_frame_dirty               = true;
 }
 
 void renderer_set_wall_texture(GLuint texture) {
@@ -170,47 +290,147 @@ void renderer_set_wall_texture(GLuint texture) {
   glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
 }
 
-void renderer_set_sky_texture(GLuint texture) {
-  glActiveTexture(GL_TEXTURE3);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
-}
-
 void renderer_set_flat_texture(GLuint texture) {
   glActiveTexture(GL_TEXTURE1);
   glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
 }
 
+void renderer_set_texture_frames(const int32_t *flat_frames, size_t num_flats,
+                                 const int32_t *wall_frames,
+                                 size_t         num_wall_textures) {
+  const int32_t *tables[NUM_FRAME_TABLES] = {flat_frames, wall_frames};
+  size_t         sizes[NUM_FRAME_TABLES]  = {num_flats, num_wall_textures};
+
+  for (int i = 0; i < NUM_FRAME_TABLES; i++) {
+    glBindBuffer(GL_TEXTURE_BUFFER, frame_buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(int32_t) * sizes[i], tables[i],
+                 GL_STREAM_DRAW);
+
+    glActiveTexture(GL_TEXTURE5 + i);
+    glBindTexture(GL_TEXTURE_BUFFER, frame_textures[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, frame_buffers[i]);
+  }
+}
+
+void renderer_set_wall_max_coords(const vec2_t *max_coords,
+                                  size_t        num_wall_textures) {
+  glBindBuffer(GL_TEXTURE_BUFFER, max_coords_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(vec2_t) * num_wall_textures,
+               max_coords, GL_STATIC_DRAW);
+
+  glActiveTexture(GL_TEXTURE7);
+  glBindTexture(GL_TEXTURE_BUFFER, max_coords_texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, max_coords_buffer);
+}
+
 vec2_t renderer_get_size() { return (vec2_t){width, height}; }
 
+static void record(render_packet_t packet) {
+  packet.key = (uint64_t)packet.shader << 48 |
+               (uint64_t)(packet.vao & 0xffffff) << 24 |
+               (queue.count & 0xffffff);
+  dynarray_push(queue, packet);
+}
+
 void renderer_draw_mesh(const mesh_t *mesh, int shader, mat4_t transformation) {
-  glUseProgram(shaders[shader].id);
-  glUniformMatrix4fv(shaders[shader].model_location, 1, GL_FALSE,
-                     transformation.v);
+  record((render_packet_t){
+      .kind           = DRAW_MESH,
+      .shader         = shader,
+      .vao            = mesh->vao,
+      .index_type     = mesh->index_type,
+      .transformation = transformation,
+      .num_indices    = mesh->num_indices,
+  });
+}
 
-  glBindVertexArray(mesh->vao);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ebo);
-  glDrawElements(GL_TRIANGLES, mesh->num_indices, GL_UNSIGNED_INT, NULL);
+void renderer_draw_ranges(const mesh_t *mesh, int shader, mat4_t transformation,
+                          const GLsizei *counts, const void *const *offsets,
+                          size_t num_ranges) {
+  if (num_ranges == 0) { return; }
+
+  record((render_packet_t){
+      .kind           = DRAW_RANGES,
+      .shader         = shader,
+      .vao            = mesh->vao,
+      .index_type     = mesh->index_type,
+      .transformation = transformation,
+      .ranges         = {counts, offsets, num_ranges},
+  });
 }
 
-void renderer_draw_sky() {
-  glStencilFunc(GL_EQUAL, 1, 0xff);
-  glStencilMask(0x00);
-  glDisable(GL_CULL_FACE);
-  glUseProgram(shaders[SHADER_SKY].id);
-  glBindVertexArray(skybox_vao);
-  glDrawArrays(GL_TRIANGLES, 0, 36);
-  glEnable(GL_CULL_FACE);
-  glStencilMask(0xff);
-  glStencilFunc(GL_ALWAYS, 1, 0xff);
+void renderer_draw_indirect(const mesh_t *mesh, int shader,
+                            mat4_t transformation, GLintptr offset,
+                            GLsizei max_draws, GLintptr count_offset) {
+  record((render_packet_t){
+      .kind           = DRAW_INDIRECT,
+      .shader         = shader,
+      .vao            = mesh->vao,
+      .index_type     = mesh->index_type,
+      .transformation = transformation,
+      .indirect       = {offset, count_offset, max_draws},
+  });
+}
+
+static int compare_packets(const void *a, const void *b) {
+  uint64_t key_a = ((const render_packet_t *)a)->key;
+  uint64_t key_b = ((const render_packet_t *)b)->key;
+  return (key_a > key_b) - (key_a < key_b);
+}
+
+void renderer_flush() {
+  if (is_frame_dirty) {
+    glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame_uniforms_t),
+                    &frame_uniforms);
+    is_frame_dirty = false;
+    num_state_changes++;
+  }
+
+  qsort(queue.data, queue.count, sizeof(render_packet_t), compare_packets);
+
+  for (size_t i = 0; i < queue.count; i++) {
+    render_packet_t *packet = &queue.data[i];
+
+    renderer_use_program(shaders[packet->shader].id);
+    set_model(packet->shader, packet->transformation);
+    bind_vertex_array(packet->vao);
+    num_draw_calls++;
+
+    // Meshes bind their element buffer while their vertex array is bound, so
+    // it comes with the vertex array
+    switch (packet->kind) {
+    case DRAW_MESH:
+      glDrawElements(GL_TRIANGLES, packet->num_indices, packet->index_type,
+                     NULL);
+      break;
+    case DRAW_RANGES:
+      glMultiDrawElements(GL_TRIANGLES, packet->ranges.counts,
+                          packet->index_type, packet->ranges.offsets,
+                          packet->ranges.num_ranges);
+      break;
+    case DRAW_INDIRECT:
+      if (packet->indirect.count_offset != -1) {
+        glMultiDrawElementsIndirectCountARB(
+            GL_TRIANGLES, packet->index_type,
+            (const void *)packet->indirect.offset,
+            packet->indirect.count_offset, packet->indirect.max_draws, 0);
+      } else {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, packet->index_type,
+                                    (const void *)packet->indirect.offset,
+                                    packet->indirect.max_draws, 0);
+      }
+      break;
+    }
+  }
+
+  queue.count = 0;
 }
 
 void init_shaders() {
   struct {
     const char *vert, *frag;
   } shader_units[NUM_SHADERS] = {
-      [SHADER_DEFAULT] = {vert_src,       frag_src      },
-      [SHADER_SKY]     = {sky_vert_src,   sky_frag_src  },
-      [SHADER_PLAIN]   = {plain_vert_src, plain_frag_src},
+      [SHADER_DEFAULT] = {vert_src, frag_src},
   };
 
   for (int i = 0; i < NUM_SHADERS; i++) {
@@ -219,12 +439,12 @@ void init_shaders() {
     shaders[i].id   = link_program(2, vertex, fragment);
     glUseProgram(shaders[i].id);
 
-    shaders[i].projection_location =
-        glGetUniformLocation(shaders[i].id, "projection");
     shaders[i].model_location = glGetUniformLocation(shaders[i].id, "model");
-    shaders[i].view_location  = glGetUniformLocation(shaders[i].id, "view");
-    shaders[i].palette_index_location =
-        glGetUniformLocation(shaders[i].id, "palette_index");
+
+    GLuint frame_index = glGetUniformBlockIndex(shaders[i].id, "Frame");
+    if (frame_index != GL_INVALID_INDEX) {
+      glUniformBlockBinding(shaders[i].id, frame_index, FRAME_BINDING);
+    }
 
     GLint palette_location = glGetUniformLocation(shaders[i].id, "palettes");
     if (palette_location != -1) { glUniform1i(palette_location, 0); }
@@ -237,30 +457,16 @@ void init_shaders() {
         glGetUniformLocation(shaders[i].id, "wall_tex");
     if (wall_texture_location != -1) { glUniform1i(wall_texture_location, 2); }
 
-    GLint sky_texture_location = glGetUniformLocation(shaders[i].id, "sky");
-    if (sky_texture_location != -1) { glUniform1i(sky_texture_location, 3); }
-  }
-}
+    GLint flat_frames_location =
+        glGetUniformLocation(shaders[i].id, "flat_frames");
+    if (flat_frames_location != -1) { glUniform1i(flat_frames_location, 5); }
 
-void init_skybox() {
-  float vertices[] = {
-      -1.0f, 1.0f,  -1.0f, -1.0f, -1.0f, -1.0f, 1.0f,  -1.0f, -1.0f, 1.0f,
-      -1.0f, -1.0f, 1.0f,  1.0f,  -1.0f, -1.0f, 1.0f,  -1.0f, -1.0f, -1.0f,
-      1.0f,  -1.0f, -1.0f, -1.0f, -1.0f, 1.0f,  -1.0f, -1.0f, 1.0f,  -1.0f,
-      -1.0f, 1.0f,  1.0f,  -1.0f, -1.0f, 1.0f,  1.0f,  -1.0f, -1.0f, 1.0f,
-      -1.0f, 1.0f,  1.0f,  1.0f,  1.0f,  1.0f,  1.0f,  1.0f,  1.0f,  1.0f,
-      -1.0f, 1.0f,  -1.0f, -1.0f, -1.0f, -1.0f, 1.0f,  -1.0f, 1.0f,  1.0f,
-      1.0f,  1.0f,  1.0f,  1.0f,  1.0f,  1.0f,  1.0f,  -1.0f, 1.0f,  -1.0f,
-      -1.0f, 1.0f,  -1.0f, 1.0f,  -1.0f, 1.0f,  1.0f,  -1.0f, 1.0f,  1.0f,
-      1.0f,  1.0f,  1.0f,  1.0f,  -1.0f, 1.0f,  1.0f,  -1.0f, 1.0f,  -1.0f,
-      -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, 1.0f,  1.0f,  -1.0f, -1.0f, 1.0f,
-      -1.0f, -1.0f, -1.0f, -1.0f, 1.0f,  1.0f,  -1.0f, 1.0f};
-
-  glGenVertexArrays(1, &skybox_vao);
-  glGenBuffers(1, &skybox_vbo);
-  glBindVertexArray(skybox_vao);
-  glBindBuffer(GL_ARRAY_BUFFER, skybox_vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices, GL_STATIC_DRAW);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+    GLint wall_frames_location =
+        glGetUniformLocation(shaders[i].id, "wall_frames");
+    if (wall_frames_location != -1) { glUniform1i(wall_frames_location, 6); }
+
+    GLint max_coords_location =
+        glGetUniformLocation(shaders[i].id, "wall_max_coords");
+    if (max_coords_location != -1) { glUniform1i(max_coords_location, 7); }
+  }
 }
@@ -2,24 +2,44 @@
 #include "flat_texture.h"
 #include "gl_map.h"
 #include "map.h"
+#include "name_table.h"
 #include "palette.h"
-#include "patch.h"
 #include "util.h"
 #include "vector.h"
 #include "wall_texture.h"
 
+#include <ctype.h>
+#include <fcntl.h>
 #include <math.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
 
 #define READ_I16(buffer, offset)                                               \
   ((buffer)[(offset)] | ((buffer)[(offset + 1)] << 8))
 
 #define READ_I32(buffer, offset)                                               \
   ((buffer)[(offset)] | ((buffer)[(offset + 1)] << 8) |                        \
-   ((buffer)[(offset + 2)] << 16) | ((buffer)[(offset + 3)] << 24))
+   ((buffer)[(offset + 2)] << 16) | ((uint32_t)(buffer)[(offset + 3)] << 24))
+
+static const char *namespace_markers[NUM_WAD_NAMESPACES][2] = {
+    [WAD_NS_FLATS]   = {"F_START", "F_END"},
+    [WAD_NS_PATCHES] = {"P_START", "P_END"},
+    [WAD_NS_SPRITES] = {"S_START", "S_END"},
+};
+
+static int  read_directory(const uint8_t *buffer, size_t size, lump_t **lumps,
+                           uint32_t *num_lumps);
+static void merge_directories(wad_t *wad, lump_t *const *file_lumps,
+                              const uint32_t *file_num_lumps, int num_files);
+static void build_lump_index(wad_t *wad);
 
 int wad_load_from_file(const char *filename, wad_t *wad) {
   if (wad == NULL) { return 1; }
@@ -35,52 +55,271 @@ int wad_load_from_file(const char *filename, wad_t *wad) {
   fread(buffer, size, 1, fp);
   fclose(fp);
 
+  *wad = (wad_t){0};
+
+  lump_t  *lumps;
+  uint32_t num_lumps;
+  int      ret_code = read_directory(buffer, size, &lumps, &num_lumps);
+  if (ret_code == 0) {
+    wad->id = strndup((const char *)buffer, 4);
+    merge_directories(wad, &lumps, &num_lumps, 1);
+    free(lumps);
+
+    for (int i = 0; i < wad->num_lumps; i++) {
+      uint8_t *data = malloc(wad->lumps[i].size);
+      if (wad->lumps[i].size > 0) {
+        memcpy(data, wad->lumps[i].data, wad->lumps[i].size);
+      }
+      wad->lumps[i].data = data;
+    }
+  }
+
+  free(buffer);
+  return ret_code;
+}
+
+int wad_map_from_file(const char *filename, wad_t *wad) {
+  return wad_map_stack(&filename, 1, wad);
+}
+
+int wad_map_stack(const char **filenames, int num_files, wad_t *wad) {
+  if (wad == NULL || num_files < 1) { return 1; }
+
+  *wad       = (wad_t){0};
+  wad->files = calloc(num_files, sizeof(wad_file_t));
+
+  lump_t  **file_lumps     = calloc(num_files, sizeof(lump_t *));
+  uint32_t *file_num_lumps = calloc(num_files, sizeof(uint32_t));
+
+  int ret_code = 0;
+  for (int i = 0; i < num_files && ret_code == 0; i++) {
+    int fd = open(filenames[i], O_RDONLY);
+    if (fd < 0) {
+      ret_code = 2;
+      break;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 12) {
+      close(fd);
+      ret_code = 3;
+      break;
+    }
+
+    // The mapping stays valid after the descriptor is closed. Pages are only
+    // read in when a lump is first touched.
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      ret_code = 2;
+      break;
+    }
+
+    wad->files[wad->num_files++] = (wad_file_t){mapping, st.st_size};
+    ret_code = read_directory(mapping, st.st_size, &file_lumps[i],
+                              &file_num_lumps[i]);
+  }
+
+  if (ret_code == 0) {
+    wad->id = strndup((const char *)wad->files[0].mapping, 4);
+    merge_directories(wad, file_lumps, file_num_lumps, num_files);
+  }
+
+  for (int i = 0; i < num_files; i++) {
+    free(file_lumps[i]);
+  }
+  free(file_lumps);
+  free(file_num_lumps);
+
+  if (ret_code != 0) { wad_free(wad); }
+  return ret_code;
+}
+
+int read_directory(const uint8_t *buffer, size_t size, lump_t **lumps,
+                   uint32_t *num_lumps) {
   // Read header
   if (size < 12) { return 3; }
-  wad->id = malloc(5);
-  memcpy(wad->id, buffer, 4);
-  wad->id[4] = 0; // null terminator
 
-  wad->num_lumps            = READ_I32(buffer, 4);
+  *num_lumps                = READ_I32(buffer, 4);
   uint32_t directory_offset = READ_I32(buffer, 8);
+  if (directory_offset + (size_t)*num_lumps * 16 > size) {
+    *num_lumps = 0;
+    return 3;
+  }
 
-  wad->lumps = malloc(sizeof(lump_t) * wad->num_lumps);
-  for (int i = 0; i < wad->num_lumps; i++) {
+  *lumps = malloc(sizeof(lump_t) * *num_lumps);
+  for (int i = 0; i < *num_lumps; i++) {
     uint32_t offset = directory_offset + i * 16;
+    lump_t  *lump   = &(*lumps)[i];
 
     uint32_t lump_offset = READ_I32(buffer, offset);
-    wad->lumps[i].size   = READ_I32(buffer, offset + 4);
-    wad->lumps[i].name   = malloc(9);
-    memcpy(wad->lumps[i].name, &buffer[offset + 8], 8);
-    wad->lumps[i].name[8] = 0; // null terminator
+    lump->size           = READ_I32(buffer, offset + 4);
+    memcpy(lump->name, &buffer[offset + 8], 8);
+    lump->name[8] = 0; // null terminator
+
+    if ((size_t)lump_offset + lump->size > size) {
+      free(*lumps);
+      *lumps     = NULL;
+      *num_lumps = 0;
+      return 3;
+    }
 
-    wad->lumps[i].data = malloc(wad->lumps[i].size);
-    memcpy(wad->lumps[i].data, &buffer[lump_offset], wad->lumps[i].size);
+    lump->data = &buffer[lump_offset];
   }
 
-  free(buffer);
   return 0;
 }
 
+// Returns the namespace that a lump name opens (or closes), also accepting the
+// doubled letter form (FF_START) that PWADs use
+static int namespace_marker(const char *name, bool end) {
+  for (int i = 0; i < NUM_WAD_NAMESPACES; i++) {
+    const char *marker = namespace_markers[i][end];
+    if (strcasecmp(name, marker) == 0 ||
+        (toupper(name[0]) == marker[0] && strcasecmp(name + 1, marker) == 0)) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// Lumps outside of a namespace keep their order, so that map lumps stay right
+// after their marker, and are overridden through the name index. The lumps of
+// each namespace are gathered into a single range, in which a lump from a
+// later file replaces the one with the same name in place. That keeps indices
+// into the range (flat numbers and animation cycles) the same.
+void merge_directories(wad_t *wad, lump_t *const *file_lumps,
+                       const uint32_t *file_num_lumps, int num_files) {
+  uint32_t total = 0;
+  for (int i = 0; i < num_files; i++) {
+    total += file_num_lumps[i];
+  }
+
+  lump_t      *ns_lumps[NUM_WAD_NAMESPACES];
+  uint32_t     ns_num_lumps[NUM_WAD_NAMESPACES] = {0};
+  bool         ns_present[NUM_WAD_NAMESPACES]   = {0};
+  name_table_t ns_names[NUM_WAD_NAMESPACES];
+  for (int i = 0; i < NUM_WAD_NAMESPACES; i++) {
+    ns_lumps[i] = malloc(sizeof(lump_t) * total);
+    name_table_init(&ns_names[i], total);
+  }
+
+  // Room for every lump plus the markers of the merged namespaces
+  wad->lumps     = malloc(sizeof(lump_t) * (total + 2 * NUM_WAD_NAMESPACES));
+  wad->num_lumps = 0;
+
+  for (int f = 0; f < num_files; f++) {
+    int ns = -1;
+    for (uint32_t i = 0; i < file_num_lumps[f]; i++) {
+      const lump_t *lump = &file_lumps[f][i];
+
+      if (ns < 0) {
+        ns = namespace_marker(lump->name, false);
+        if (ns >= 0) {
+          ns_present[ns] = true;
+        } else {
+          wad->lumps[wad->num_lumps++] = *lump;
+        }
+        continue;
+      }
+
+      if (namespace_marker(lump->name, true) == ns) {
+        ns = -1;
+        continue;
+      }
+
+      name_key_t key  = name_to_key(lump->name);
+      int        slot = name_table_find(&ns_names[ns], key);
+      if (slot < 0) {
+        slot = ns_num_lumps[ns]++;
+        name_table_insert(&ns_names[ns], key, slot);
+      }
+      ns_lumps[ns][slot] = *lump;
+    }
+  }
+
+  for (int i = 0; i < NUM_WAD_NAMESPACES; i++) {
+    if (ns_present[i]) {
+      lump_t *start = &wad->lumps[wad->num_lumps++];
+      *start        = (lump_t){.data = NULL, .size = 0};
+      strcpy(start->name, namespace_markers[i][0]);
+
+      memcpy(&wad->lumps[wad->num_lumps], ns_lumps[i],
+             sizeof(lump_t) * ns_num_lumps[i]);
+      wad->num_lumps += ns_num_lumps[i];
+
+      lump_t *end = &wad->lumps[wad->num_lumps++];
+      *end        = (lump_t){.data = NULL, .size = 0};
+      strcpy(end->name, namespace_markers[i][1]);
+    }
+
+    free(ns_lumps[i]);
+    name_table_free(&ns_names[i]);
+  }
+
+  build_lump_index(wad);
+}
+
+void build_lump_index(wad_t *wad) {
+  name_table_init(&wad->lump_names, wad->num_lumps);
+  wad->lump_prev = malloc(sizeof(int) * wad->num_lumps);
+
+  // Later lumps override earlier ones with the same name
+  for (int i = 0; i < wad->num_lumps; i++) {
+    name_key_t key    = name_to_key(wad->lumps[i].name);
+    wad->lump_prev[i] = name_table_insert(&wad->lump_names, key, i);
+  }
+
+  for (int i = 0; i < NUM_WAD_NAMESPACES; i++) {
+    wad->namespaces[i].start = wad_find_lump(namespace_markers[i][0], wad);
+    wad->namespaces[i].end   = wad_find_lump(namespace_markers[i][1], wad);
+  }
+}
+
 void wad_free(wad_t *wad) {
   if (wad == NULL) { return; }
 
-  for (int i = 0; i < wad->num_lumps; i++) {
-    free(wad->lumps[i].data);
+  if (wad->files) {
+    for (int i = 0; i < wad->num_files; i++) {
+      munmap(wad->files[i].mapping, wad->files[i].size);
+    }
+  } else {
+    for (int i = 0; i < wad->num_lumps; i++) {
+      free((void *)wad->lumps[i].data);
+    }
   }
 
   free(wad->id);
+  free(wad->files);
   free(wad->lumps);
+  free(wad->lump_prev);
+  name_table_free(&wad->lump_names);
 
+  wad->id        = NULL;
+  wad->files     = NULL;
+  wad->lumps     = NULL;
+  wad->lump_prev = NULL;
   wad->num_lumps = 0;
+  wad->num_files = 0;
 }
 
 int wad_find_lump(const char *lumpname, const wad_t *wad) {
-  for (int i = 0; i < wad->num_lumps; i++) {
-    if (strcmp_nocase(wad->lumps[i].name, lumpname) == 0) { return i; }
+  return name_table_find(&wad->lump_names, name_to_key(lumpname));
+}
+
+int wad_find_lump_in_namespace(const char *lumpname, wad_namespace_t ns,
+                               const wad_t *wad) {
+  wad_range_t range = wad->namespaces[ns];
+  if (range.start < 0 || range.end < 0) { return -1; }
+
+  // Walk back through the overridden lumps until one falls inside the range
+  int i = wad_find_lump(lumpname, wad);
+  while (i >= 0 && (i <= range.start || i >= range.end)) {
+    i = wad->lump_prev[i];
   }
 
-  return -1;
+  return i;
 }
 
 palette_t *wad_read_playpal(size_t *num, const wad_t *wad) {
@@ -100,130 +339,211 @@ palette_t *wad_read_playpal(size_t *num, const wad_t *wad) {
 }
 
 flat_tex_t *wad_read_flats(size_t *num, const wad_t *wad) {
-  int f_start = wad_find_lump("F_START", wad);
-  int f_end   = wad_find_lump("F_END", wad);
+  int f_start = wad->namespaces[WAD_NS_FLATS].start;
+  int f_end   = wad->namespaces[WAD_NS_FLATS].end;
 
   if (num == NULL || f_end < 0 || f_start < 0) { return NULL; }
 
   *num              = f_end - f_start - 1;
   flat_tex_t *flats = malloc(sizeof(flat_tex_t) * *num);
 
+  // Flat numbers are offsets into the range, so lumps that are not flats
+  // (such as the inner F1_START markers) keep an empty slot
   for (int i = f_start + 1; i < f_end; i++) {
+    flat_tex_t *flat = &flats[i - f_start - 1];
+    memcpy(flat->name, wad->lumps[i].name, 9);
+
     if (wad->lumps[i].size != FLAT_TEXTURE_SIZE * FLAT_TEXTURE_SIZE) {
-      (*num)--;
-      continue;
+      memset(flat->data, 0, FLAT_TEXTURE_SIZE * FLAT_TEXTURE_SIZE);
+    } else {
+      memcpy(flat->data, wad->lumps[i].data,
+             FLAT_TEXTURE_SIZE * FLAT_TEXTURE_SIZE);
     }
-
-    memcpy(flats[i - f_start - 1].name, wad->lumps[i].name, 8);
-    memcpy(flats[i - f_start - 1].data, wad->lumps[i].data,
-           FLAT_TEXTURE_SIZE * FLAT_TEXTURE_SIZE);
   }
 
   return flats;
 }
 
-int wad_read_patch(patch_t *patch, const char *patch_name, const wad_t *wad) {
-  *patch             = (patch_t){0};
-  int patch_lump_idx = wad_find_lump(patch_name, wad);
-  if (patch_lump_idx < 0) { return 1; }
-  lump_t *patch_lump = &wad->lumps[patch_lump_idx];
+// Finds the texture definition lumps, TEXTURE1 and the optional TEXTURE2, and
+// the number of textures in each. Returns the total number of textures.
+static size_t find_texture_lumps(const lump_t *lumps[2], size_t counts[2],
+                                 const wad_t *wad) {
+  const char *lumpnames[2] = {"TEXTURE1", "TEXTURE2"};
+
+  size_t total = 0;
+  for (int i = 0; i < 2; i++) {
+    int lump_index = wad_find_lump(lumpnames[i], wad);
+    lumps[i]       = lump_index >= 0 ? &wad->lumps[lump_index] : NULL;
+    counts[i]      = 0;
+    if (lumps[i] && lumps[i]->size >= 4) {
+      counts[i] = READ_I32(lumps[i]->data, 0);
+    }
 
-  patch->width  = READ_I16(patch_lump->data, 0);
-  patch->height = READ_I16(patch_lump->data, 2);
-  patch->data   = malloc(patch->width * patch->height);
-  memset(patch->data, 247, patch->width * patch->height);
+    total += counts[i];
+  }
 
-  for (int16_t x = 0; x < patch->width; x++) {
-    uint32_t column_offset = READ_I32(patch_lump->data, 8 + x * 4);
-    uint8_t  post_topdelta = 0;
-    for (;;) {
-      post_topdelta = patch_lump->data[column_offset++];
-      if (post_topdelta == 255) { break; }
-      uint8_t post_length = patch_lump->data[column_offset++];
-      column_offset++; // dummy value
+  return total;
+}
 
-      for (int y = 0; y < post_length; y++) {
-        int data_byte = patch_lump->data[column_offset++];
-        int tex_x = x, tex_y = y + post_topdelta;
-        patch->data[tex_y * patch->width + tex_x] = data_byte;
-      }
-      column_offset++; // dummy value
-    }
-  }
+// Returns the lump holding the definition of texture i and its offset in there
+static const lump_t *texture_def(size_t i, const lump_t *lumps[2],
+                                 const size_t counts[2], uint32_t *offset) {
+  int lump = i >= counts[0];
+  if (lump) { i -= counts[0]; }
 
-  return 0;
+  *offset = READ_I32(lumps[lump]->data, 4 * i + 4);
+  return lumps[lump];
 }
 
-patch_t *wad_read_patches(size_t *num, const wad_t *wad) {
-  int     pnames_index = wad_find_lump("PNAMES", wad);
-  lump_t *pnames_lump  = &wad->lumps[pnames_index];
-  *num                 = READ_I32(pnames_lump->data, 0);
-  patch_t *patches     = malloc(sizeof(patch_t) * *num);
+wall_tex_t *wad_read_textures(size_t *num, const wad_t *wad) {
+  const lump_t *tex_lumps[2];
+  size_t        tex_counts[2];
+  *num = find_texture_lumps(tex_lumps, tex_counts, wad);
+  if (tex_lumps[0] == NULL) { return NULL; }
 
+  wall_tex_t *textures = malloc(sizeof(wall_tex_t) * *num);
   for (int i = 0; i < *num; i++) {
-    char patch_name[9] = {0};
-    memcpy(patch_name, &pnames_lump->data[i * 8 + 4], 8);
-    wad_read_patch(&patches[i], patch_name, wad);
+    uint32_t      offset;
+    const lump_t *tex_lump = texture_def(i, tex_lumps, tex_counts, &offset);
+    memcpy(textures[i].name, tex_lump->data + offset, 8);
+    textures[i].width  = READ_I16(tex_lump->data, offset + 12);
+    textures[i].height = READ_I16(tex_lump->data, offset + 14);
+    textures[i].data   = NULL;
   }
 
-  return patches;
+  return textures;
 }
 
-void wad_free_patches(patch_t *patches, size_t num) {
-  for (int i = 0; i < num; i++) {
-    patches[i].width = patches[i].height = 0;
-    free(patches[i].data);
+void wad_index_textures(name_table_t *tex_names, const wall_tex_t *textures,
+                        size_t num) {
+  // Inserted back to front so that the first texture with a name wins
+  name_table_init(tex_names, num);
+  for (int i = (int)num - 1; i >= 0; i--) {
+    name_table_insert(tex_names, name_to_key(textures[i].name), i);
   }
 }
 
-wall_tex_t *wad_read_textures(size_t *num, const char *lumpname,
-                              const wad_t *wad) {
-  size_t   num_patches;
-  patch_t *patches = wad_read_patches(&num_patches, wad);
+int wad_find_texture(const char *name, const name_table_t *tex_names) {
+  return name_table_find(tex_names, name_to_key(name));
+}
 
-  int     lump_index = wad_find_lump(lumpname, wad);
-  lump_t *tex_lump   = &wad->lumps[lump_index];
-  *num               = READ_I32(tex_lump->data, 0);
+// Copies every post of a patch straight from its lump into a column-major
+// texture buffer. Each post is clipped once and copied as one run of bytes.
+static void blit_patch(uint8_t *columns, int tex_width, int tex_height,
+                       const lump_t *patch_lump, int origin_x, int origin_y) {
+  const uint8_t *data = patch_lump->data;
+  if (patch_lump->size < 8) { return; }
 
-  wall_tex_t *textures = malloc(sizeof(wall_tex_t) * *num);
-  for (int i = 0; i < *num; i++) {
-    uint32_t offset = READ_I32(tex_lump->data, 4 * i + 4);
-    memcpy(textures[i].name, tex_lump->data + offset, 8);
-    textures[i].width  = READ_I16(tex_lump->data, offset + 12);
-    textures[i].height = READ_I16(tex_lump->data, offset + 14);
+  int16_t width = READ_I16(data, 0);
+  if (8 + width * 4 > patch_lump->size) { return; }
+
+  int x_start = max(0, -origin_x), x_end = min(width, tex_width - origin_x);
+  for (int x = x_start; x < x_end; x++) {
+    uint8_t *column        = columns + (x + origin_x) * tex_height;
+    uint32_t column_offset = READ_I32(data, 8 + x * 4);
+
+    while (column_offset + 3 <= patch_lump->size) {
+      uint8_t post_topdelta = data[column_offset];
+      if (post_topdelta == 255) { break; }
+
+      int post_length = data[column_offset + 1];
+      if (column_offset + 3 + post_length > patch_lump->size) { break; }
+
+      const uint8_t *post = &data[column_offset + 3];
+      column_offset += post_length + 4;
+
+      int top = post_topdelta + origin_y, skip = 0;
+      if (top < 0) { skip = -top, top = 0; }
+      int length = min(post_length - skip, tex_height - top);
+
+      if (length > 0) { memcpy(column + top, post + skip, length); }
+    }
+  }
+}
+
+static void transpose_columns(uint8_t *dst, const uint8_t *columns, int width,
+                              int height) {
+  // Done in small blocks so that both buffers stay in cache
+  for (int bx = 0; bx < width; bx += 16) {
+    for (int by = 0; by < height; by += 16) {
+      int x_end = min(bx + 16, width), y_end = min(by + 16, height);
+      for (int y = by; y < y_end; y++) {
+        for (int x = bx; x < x_end; x++) {
+          dst[y * width + x] = columns[x * height + y];
+        }
+      }
+    }
+  }
+}
+
+int wad_composite_textures(wall_tex_t *textures, size_t start, size_t end,
+                           const bool *used, const wad_t *wad) {
+  const lump_t *tex_lumps[2];
+  size_t        tex_counts[2];
+  find_texture_lumps(tex_lumps, tex_counts, wad);
+
+  int pnames_index = wad_find_lump("PNAMES", wad);
+  if (tex_lumps[0] == NULL || pnames_index < 0) { return 1; }
+
+  const lump_t *pnames_lump = &wad->lumps[pnames_index];
+
+  // Patch lumps are looked up the first time a composited texture references
+  // them and shared by every later texture that uses the same PNAMES entry
+  size_t num_patches = READ_I32(pnames_lump->data, 0);
+  int   *patch_lumps = malloc(sizeof(int) * num_patches);
+  for (int i = 0; i < num_patches; i++) {
+    patch_lumps[i] = -2; // not looked up yet
+  }
 
-    textures[i].data = malloc(textures[i].width * textures[i].height);
-    memset(textures[i].data, 247, textures[i].width * textures[i].height);
+  uint8_t *columns      = NULL;
+  size_t   columns_size = 0;
 
-    uint16_t num_patches = READ_I16(tex_lump->data, offset + 20);
-    for (int j = 0; j < num_patches; j++) {
+  for (int i = start; i < end; i++) {
+    if (used != NULL && !used[i]) { continue; }
+
+    int    width = textures[i].width, height = textures[i].height;
+    size_t size  = width * height;
+    if (size > columns_size) {
+      columns_size = size;
+      columns      = realloc(columns, columns_size);
+    }
+    memset(columns, 247, size);
+
+    uint32_t      offset;
+    const lump_t *tex_lump = texture_def(i, tex_lumps, tex_counts, &offset);
+
+    uint16_t num_tex_patches = READ_I16(tex_lump->data, offset + 20);
+    for (int j = 0; j < num_tex_patches; j++) {
       int16_t  origin_x  = READ_I16(tex_lump->data, offset + 22 + j * 10);
       int16_t  origin_y  = READ_I16(tex_lump->data, offset + 24 + j * 10);
       uint16_t patch_idx = READ_I16(tex_lump->data, offset + 26 + j * 10);
+      if (patch_idx >= num_patches) { continue; }
 
-      patch_t patch = patches[patch_idx];
-      for (int x = 0; x < patch.width; x++) {
-        for (int y = 0; y < patch.height; y++) {
-          uint8_t data_byte = patch.data[y * patch.width + x];
-          int     tex_x = x + origin_x, tex_y = y + origin_y;
-
-          if (tex_x >= 0 && tex_x < textures[i].width && tex_y >= 0 &&
-              tex_y < textures[i].height && data_byte != 247) {
-            textures[i].data[tex_y * textures[i].width + tex_x] = data_byte;
-          }
-        }
+      if (patch_lumps[patch_idx] == -2) {
+        char patch_name[9] = {0};
+        memcpy(patch_name, &pnames_lump->data[patch_idx * 8 + 4], 8);
+        patch_lumps[patch_idx] = wad_find_lump(patch_name, wad);
       }
+
+      if (patch_lumps[patch_idx] < 0) { continue; }
+      blit_patch(columns, width, height, &wad->lumps[patch_lumps[patch_idx]],
+                 origin_x, origin_y);
     }
+
+    textures[i].data = malloc(size);
+    transpose_columns(textures[i].data, columns, width, height);
   }
 
-  wad_free_patches(patches, num_patches);
-  return textures;
+  free(columns);
+  free(patch_lumps);
+  return 0;
 }
 
 void wad_free_wall_textures(wall_tex_t *textures, size_t num) {
   for (int i = 0; i < num; i++) {
     textures[i].width = textures[i].height = 0;
     free(textures[i].data);
+    textures[i].data = NULL;
   }
 }
 
@@ -236,36 +556,39 @@ void wad_free_wall_textures(wall_tex_t *textures, size_t num) {
 #define NODES_IDX    7
 #define SECTORS_IDX  8
 
+// Widens a 16-bit index, keeping 0xffff as the marker for a missing one
+static uint32_t widen_index(uint16_t index) {
+  return index == 0xffff ? MAP_NO_INDEX : index;
+}
+
 static void read_vertices(map_t *map, const lump_t *lump);
 static void read_linedefs(map_t *map, const lump_t *lump);
 static void read_things(map_t *map, const lump_t *lump);
 static void read_sectors(map_t *map, const lump_t *lump, const wad_t *wad);
-static void read_sidedefs(map_t *map, const lump_t *lump, const wall_tex_t *tex,
-                          int num_tex);
+static void read_sidedefs(map_t *map, const lump_t *lump,
+                          const name_table_t *tex_names);
 
 int wad_read_map(const char *mapname, map_t *map, const wad_t *wad,
-                 const wall_tex_t *tex, int num_tex) {
+                 const name_table_t *tex_names) {
   int map_index = wad_find_lump(mapname, wad);
   if (map_index < 0) { return 1; }
 
   read_vertices(map, &wad->lumps[map_index + VERTEXES_IDX]);
   read_linedefs(map, &wad->lumps[map_index + LINEDEFS_IDX]);
   read_things(map, &wad->lumps[map_index + THINGS_IDX]);
-  read_sidedefs(map, &wad->lumps[map_index + SIDEDEFS_IDX], tex, num_tex);
+  read_sidedefs(map, &wad->lumps[map_index + SIDEDEFS_IDX], tex_names);
   read_sectors(map, &wad->lumps[map_index + SECTORS_IDX], wad);
 
   return 0;
 }
 
 void wad_free_map(map_t *map) {
-  map->num_vertices = map->num_things = map->num_sectors = map->num_linedefs =
-      map->num_sidedefs                                  = 0;
-
   free(map->vertices);
   free(map->things);
   free(map->sectors);
   free(map->linedefs);
   free(map->sidedefs);
+  *map = (map_t){0};
 }
 
 void read_vertices(map_t *map, const lump_t *lump) {
@@ -294,8 +617,8 @@ void read_linedefs(map_t *map, const lump_t *lump) {
     map->linedefs[j].start_idx     = READ_I16(lump->data, i);
     map->linedefs[j].end_idx       = READ_I16(lump->data, i + 2);
     map->linedefs[j].flags         = READ_I16(lump->data, i + 4);
-    map->linedefs[j].front_sidedef = READ_I16(lump->data, i + 10);
-    map->linedefs[j].back_sidedef  = READ_I16(lump->data, i + 12);
+    map->linedefs[j].front_sidedef = widen_index(READ_I16(lump->data, i + 10));
+    map->linedefs[j].back_sidedef  = widen_index(READ_I16(lump->data, i + 12));
   }
 }
 
@@ -313,35 +636,21 @@ void read_things(map_t *map, const lump_t *lump) {
   }
 }
 
-void read_sidedefs(map_t *map, const lump_t *lump, const wall_tex_t *tex,
-                   int num_tex) {
+void read_sidedefs(map_t *map, const lump_t *lump,
+                   const name_table_t *tex_names) {
   map->num_sidedefs = lump->size / 30; // each sidedef is 30 bytes
   map->sidedefs     = malloc(sizeof(sidedef_t) * map->num_sidedefs);
 
   for (int i = 0, j = 0; i < lump->size; i += 30, j++) {
-    map->sidedefs[j].lower = map->sidedefs[j].upper = map->sidedefs[j].middle =
-        -1;
-
-    for (int k = 0; k < num_tex; k++) {
-      if (strncmp_nocase((char *)lump->data + i + 4, tex[k].name, 8) == 0) {
-        map->sidedefs[j].upper = k;
-        break;
-      }
-    }
+    const char *names = (const char *)lump->data + i;
 
-    for (int k = 0; k < num_tex; k++) {
-      if (strncmp_nocase((char *)lump->data + i + 12, tex[k].name, 8) == 0) {
-        map->sidedefs[j].lower = k;
-        break;
-      }
-    }
+    name_key_t upper  = name_to_key(names + 4);
+    name_key_t lower  = name_to_key(names + 12);
+    name_key_t middle = name_to_key(names + 20);
 
-    for (int k = 0; k < num_tex; k++) {
-      if (strncmp_nocase((char *)lump->data + i + 20, tex[k].name, 8) == 0) {
-        map->sidedefs[j].middle = k;
-        break;
-      }
-    }
+    map->sidedefs[j].upper  = name_table_find(tex_names, upper);
+    map->sidedefs[j].lower  = name_table_find(tex_names, lower);
+    map->sidedefs[j].middle = name_table_find(tex_names, middle);
 
     map->sidedefs[j].x_off      = (int16_t)READ_I16(lump->data, i);
     map->sidedefs[j].y_off      = (int16_t)READ_I16(lump->data, i + 2);
@@ -353,8 +662,8 @@ void read_sectors(map_t *map, const lump_t *lump, const wad_t *wad) {
   map->num_sectors = lump->size / 26; // each sector is 26 bytes
   map->sectors     = malloc(sizeof(sector_t) * map->num_sectors);
 
-  int f_start = wad_find_lump("F_START", wad);
-  int f_end   = wad_find_lump("F_END", wad);
+  int f_start = wad->namespaces[WAD_NS_FLATS].start;
+  int f_end   = wad->namespaces[WAD_NS_FLATS].end;
   for (int i = 0, j = 0; i < lump->size; i += 26, j++) {
     map->sectors[j].floor       = (int16_t)READ_I16(lump->data, i);
     map->sectors[j].ceiling     = (int16_t)READ_I16(lump->data, i + 2);
@@ -363,16 +672,16 @@ void read_sectors(map_t *map, const lump_t *lump, const wad_t *wad) {
     char name[9] = {0};
 
     memcpy(name, &lump->data[i + 4], 8);
-    int floor = wad_find_lump(name, wad);
-    if (floor <= f_start || floor >= f_end - 1) {
+    int floor = wad_find_lump_in_namespace(name, WAD_NS_FLATS, wad);
+    if (floor <= f_start || floor >= f_end) {
       map->sectors[j].floor_tex = -1;
     } else {
       map->sectors[j].floor_tex = floor - f_start - 1;
     }
 
     memcpy(name, &lump->data[i + 12], 8);
-    int ceiling = wad_find_lump(name, wad);
-    if (ceiling <= f_start || ceiling >= f_end - 1) {
+    int ceiling = wad_find_lump_in_namespace(name, WAD_NS_FLATS, wad);
+    if (ceiling <= f_start || ceiling >= f_end) {
       map->sectors[j].ceiling_tex = -1;
     } else {
       map->sectors[j].ceiling_tex = ceiling - f_start - 1;
@@ -385,33 +694,82 @@ void read_sectors(map_t *map, const lump_t *lump, const wad_t *wad) {
 #define GL_SSECTORS_IDX 3
 #define GL_NODES_IDX    4
 
+// The glBSP node versions differ in field widths, in the bit that marks a GL
+// vertex and in whether the segs and subsectors lumps start with a magic
+typedef struct gl_format {
+  int      seg_size, vertex_size;
+  uint32_t vertex_gl_flag;
+  int      subsector_size;
+  int      lump_header; // size of the magic in GL_SEGS and GL_SSECT
+  int      child_size;
+} gl_format_t;
+
+static const gl_format_t gl_format_v2 = {10, 2, 1u << 15, 4, 0, 2};
+static const gl_format_t gl_format_v3 = {16, 4, 1u << 30, 8, 4, 2};
+static const gl_format_t gl_format_v5 = {16, 4, 1u << 31, 8, 0, 4};
+
 static void read_gl_vertices(gl_map_t *map, const lump_t *lump);
-static void read_gl_segments(gl_map_t *map, const lump_t *lump);
-static void read_gl_subsectors(gl_map_t *map, const lump_t *lump);
-static void read_gl_nodes(gl_map_t *map, const lump_t *lump);
+static void read_gl_segments(gl_map_t *map, const lump_t *lump,
+                             const gl_format_t *format);
+static void read_gl_subsectors(gl_map_t *map, const lump_t *lump,
+                               const gl_format_t *format);
+static void read_gl_nodes(gl_map_t *map, const lump_t *lump,
+                          const gl_format_t *format);
+static int  read_extended_gl_nodes(gl_map_t *map, const lump_t *lump);
+
+int wad_read_gl_map(const char *mapname, gl_map_t *map, const wad_t *wad) {
+  *map = (gl_map_t){0};
+
+  // ZDoom's extended GL nodes are stored in the map's own SSECTORS lump
+  int map_index = wad_find_lump(mapname, wad);
+  if (map_index >= 0 && map_index + SSECTORS_IDX < wad->num_lumps) {
+    const lump_t *ssectors = &wad->lumps[map_index + SSECTORS_IDX];
+    if (ssectors->size >= 4 && (memcmp(ssectors->data, "XGL", 3) == 0 ||
+                                memcmp(ssectors->data, "ZGL", 3) == 0)) {
+      return read_extended_gl_nodes(map, ssectors);
+    }
+  }
 
-int wad_read_gl_map(const char *gl_mapname, gl_map_t *map, const wad_t *wad) {
-  int map_index = wad_find_lump(gl_mapname, wad);
-  if (map_index < 0) { return 1; }
+  char gl_mapname[16];
+  snprintf(gl_mapname, sizeof(gl_mapname), "GL_%s", mapname);
 
-  if (strncmp((const char *)wad->lumps[map_index + GL_VERTICES_IDX].data,
-              "gNd2", 4) != 0) {
-    return 2;
+  // GL nodes from before the map belong to a map that a PWAD replaced
+  int gl_index = wad_find_lump(gl_mapname, wad);
+  if (gl_index < 0 || gl_index < map_index ||
+      gl_index + GL_NODES_IDX >= wad->num_lumps) {
+    return 1;
   }
 
-  if (strncmp((const char *)wad->lumps[map_index + GL_SEGS_IDX].data, "gNd3",
-              4) == 0) {
+  const lump_t *vertices = &wad->lumps[gl_index + GL_VERTICES_IDX];
+  const lump_t *segments = &wad->lumps[gl_index + GL_SEGS_IDX];
+  if (vertices->size < 4) { return 2; }
+
+  const gl_format_t *format;
+  if (segments->size >= 4 && memcmp(segments->data, "gNd3", 4) == 0) {
+    format = &gl_format_v3;
+  } else if (memcmp(vertices->data, "gNd2", 4) == 0) {
+    format = &gl_format_v2;
+  } else if (memcmp(vertices->data, "gNd5", 4) == 0) {
+    format = &gl_format_v5;
+  } else {
     return 2;
   }
 
-  read_gl_vertices(map, &wad->lumps[map_index + GL_VERTICES_IDX]);
-  read_gl_segments(map, &wad->lumps[map_index + GL_SEGS_IDX]);
-  read_gl_subsectors(map, &wad->lumps[map_index + GL_SSECTORS_IDX]);
-  read_gl_nodes(map, &wad->lumps[map_index + GL_NODES_IDX]);
+  read_gl_vertices(map, vertices);
+  read_gl_segments(map, segments, format);
+  read_gl_subsectors(map, &wad->lumps[gl_index + GL_SSECTORS_IDX], format);
+  read_gl_nodes(map, &wad->lumps[gl_index + GL_NODES_IDX], format);
 
   return 0;
 }
 
+static void update_bounds(gl_map_t *map, vec2_t vertex) {
+  if (vertex.x < map->min.x) { map->min.x = vertex.x; }
+  if (vertex.y < map->min.y) { map->min.y = vertex.y; }
+  if (vertex.x > map->max.x) { map->max.x = vertex.x; }
+  if (vertex.y > map->max.y) { map->max.y = vertex.y; }
+}
+
 void read_gl_vertices(gl_map_t *map, const lump_t *lump) {
   map->num_vertices = (lump->size - 4) / 8; // each vertex is 4+4=8 bytes
   map->vertices     = malloc(sizeof(vec2_t) * map->num_vertices);
@@ -419,68 +777,269 @@ void read_gl_vertices(gl_map_t *map, const lump_t *lump) {
   map->min = (vec2_t){INFINITY, INFINITY};
   map->max = (vec2_t){-INFINITY, -INFINITY};
 
-  for (int i = 4, j = 0; i < lump->size; i += 8, j++) {
+  for (int i = 4, j = 0; j < map->num_vertices; i += 8, j++) {
     map->vertices[j].x = (float)((int32_t)READ_I32(lump->data, i)) / (1 << 16);
     map->vertices[j].y =
         (float)((int32_t)READ_I32(lump->data, i + 4)) / (1 << 16);
-
-    if (map->vertices[j].x < map->min.x) { map->min.x = map->vertices[j].x; }
-    if (map->vertices[j].y < map->min.y) { map->min.y = map->vertices[j].y; }
-    if (map->vertices[j].x > map->max.x) { map->max.x = map->vertices[j].x; }
-    if (map->vertices[j].y > map->max.y) { map->max.y = map->vertices[j].y; }
+    update_bounds(map, map->vertices[j]);
   }
 }
 
-void read_gl_segments(gl_map_t *map, const lump_t *lump) {
-  map->num_segments = lump->size / 10; // each segment is 10 bytes
+static uint32_t read_field(const uint8_t *data, int size) {
+  return size == 4 ? (uint32_t)READ_I32(data, 0) : (uint32_t)READ_I16(data, 0);
+}
+
+// Widens a vertex id, moving the format's GL vertex bit to VERT_IS_GL
+static uint32_t widen_vertex(uint32_t id, uint32_t gl_flag) {
+  return id & gl_flag ? VERT_IS_GL | (id & (gl_flag - 1)) : id;
+}
+
+static uint32_t widen_child(uint32_t id, int size) {
+  if (size == 4) { return id; }
+  return id & 0x8000 ? CHILD_IS_SUBSECTOR | (id & 0x7fff) : id;
+}
+
+void read_gl_segments(gl_map_t *map, const lump_t *lump,
+                      const gl_format_t *format) {
+  size_t         header = min(lump->size, format->lump_header);
+  const uint8_t *data   = lump->data + header;
+  int            size = format->seg_size, vsize = format->vertex_size;
+
+  map->num_segments = (lump->size - header) / size;
   map->segments     = malloc(sizeof(gl_segment_t) * map->num_segments);
 
-  for (int i = 0, j = 0; i < lump->size; i += 10, j++) {
-    map->segments[j].start_vertex = READ_I16(lump->data, i);
-    map->segments[j].end_vertex   = READ_I16(lump->data, i + 2);
-    map->segments[j].linedef      = READ_I16(lump->data, i + 4);
-    map->segments[j].side         = READ_I16(lump->data, i + 6);
+  for (size_t j = 0; j < map->num_segments; j++, data += size) {
+    gl_segment_t *segment = &map->segments[j];
+
+    segment->start_vertex =
+        widen_vertex(read_field(data, vsize), format->vertex_gl_flag);
+    segment->end_vertex =
+        widen_vertex(read_field(data + vsize, vsize), format->vertex_gl_flag);
+    segment->linedef = widen_index(READ_I16(data, 2 * vsize));
+    segment->side    = READ_I16(data, 2 * vsize + 2);
   }
 }
 
-void read_gl_subsectors(gl_map_t *map, const lump_t *lump) {
-  map->num_subsectors = lump->size / 4; // each subsector is 4 bytes
+void read_gl_subsectors(gl_map_t *map, const lump_t *lump,
+                        const gl_format_t *format) {
+  size_t         header = min(lump->size, format->lump_header);
+  const uint8_t *data   = lump->data + header;
+  int            size   = format->subsector_size;
+
+  map->num_subsectors = (lump->size - header) / size;
   map->subsectors     = malloc(sizeof(gl_subsector_t) * map->num_subsectors);
 
-  for (int i = 0, j = 0; i < lump->size; i += 4, j++) {
-    map->subsectors[j].num_segs  = READ_I16(lump->data, i);
-    map->subsectors[j].first_seg = READ_I16(lump->data, i + 2);
+  for (size_t j = 0; j < map->num_subsectors; j++, data += size) {
+    map->subsectors[j].num_segs  = read_field(data, size / 2);
+    map->subsectors[j].first_seg = read_field(data + size / 2, size / 2);
   }
 }
 
-void read_gl_nodes(gl_map_t *map, const lump_t *lump) {
-  map->num_nodes = lump->size / 28; // each node is 28 bytes
+void read_gl_nodes(gl_map_t *map, const lump_t *lump,
+                   const gl_format_t *format) {
+  int size = 24 + 2 * format->child_size;
+
+  map->num_nodes = lump->size / size;
   map->nodes     = malloc(sizeof(gl_node_t) * map->num_nodes);
 
-  for (int i = 0, j = 0; i < lump->size; i += 28, j++) {
-    map->nodes[j].partition.x       = (int16_t)READ_I16(lump->data, i);
-    map->nodes[j].partition.y       = (int16_t)READ_I16(lump->data, i + 2);
-    map->nodes[j].delta_partition.x = (int16_t)READ_I16(lump->data, i + 4);
-    map->nodes[j].delta_partition.y = (int16_t)READ_I16(lump->data, i + 6);
+  const uint8_t *data = lump->data;
+  for (size_t j = 0; j < map->num_nodes; j++, data += size) {
+    gl_node_t *node = &map->nodes[j];
+
+    node->partition.x       = (int16_t)READ_I16(data, 0);
+    node->partition.y       = (int16_t)READ_I16(data, 2);
+    node->delta_partition.x = (int16_t)READ_I16(data, 4);
+    node->delta_partition.y = (int16_t)READ_I16(data, 6);
+
+    for (int k = 0; k < 4; k++) {
+      node->front_bbox[k] = READ_I16(data, 8 + k * 2);
+      node->back_bbox[k]  = READ_I16(data, 16 + k * 2);
+    }
+
+    int child_size       = format->child_size;
+    node->front_child_id = widen_child(read_field(data + 24, child_size),
+                                       child_size);
+    node->back_child_id  = widen_child(
+        read_field(data + 24 + child_size, child_size), child_size);
+  }
+}
+
+// Inflates the zlib stream of a compressed (ZGLN) node lump
+static uint8_t *inflate_nodes(const uint8_t *data, size_t size,
+                              size_t *inflated_size) {
+  z_stream stream = {.next_in = (Bytef *)data, .avail_in = size};
+  if (inflateInit(&stream) != Z_OK) { return NULL; }
 
-    map->nodes[j].front_bbox[0] = READ_I16(lump->data, i + 8);
-    map->nodes[j].front_bbox[1] = READ_I16(lump->data, i + 10);
-    map->nodes[j].front_bbox[2] = READ_I16(lump->data, i + 12);
-    map->nodes[j].front_bbox[3] = READ_I16(lump->data, i + 14);
+  size_t   capacity = size * 4 + 1024;
+  uint8_t *buffer   = malloc(capacity);
 
-    map->nodes[j].back_bbox[0] = READ_I16(lump->data, i + 16);
-    map->nodes[j].back_bbox[1] = READ_I16(lump->data, i + 18);
-    map->nodes[j].back_bbox[2] = READ_I16(lump->data, i + 20);
-    map->nodes[j].back_bbox[3] = READ_I16(lump->data, i + 22);
+  int ret;
+  do {
+    if (stream.total_out == capacity) {
+      capacity *= 2;
+      buffer = realloc(buffer, capacity);
+    }
+
+    stream.next_out  = buffer + stream.total_out;
+    stream.avail_out = capacity - stream.total_out;
+    ret              = inflate(&stream, Z_NO_FLUSH);
+  } while (ret == Z_OK);
 
-    map->nodes[j].front_child_id = READ_I16(lump->data, i + 24);
-    map->nodes[j].back_child_id  = READ_I16(lump->data, i + 26);
+  *inflated_size = stream.total_out;
+  inflateEnd(&stream);
+
+  if (ret != Z_STREAM_END) {
+    free(buffer);
+    return NULL;
+  }
+
+  return buffer;
+}
+
+typedef struct node_reader {
+  const uint8_t *data;
+  size_t         size, offset;
+  bool           overrun;
+} node_reader_t;
+
+static uint32_t read_next(node_reader_t *reader, int size) {
+  if (reader->offset + size > reader->size) {
+    reader->overrun = true;
+    return 0;
+  }
+
+  uint32_t value = 0;
+  for (int i = 0; i < size; i++) {
+    value |= (uint32_t)reader->data[reader->offset + i] << (8 * i);
+  }
+
+  reader->offset += size;
+  return value;
+}
+
+// Reads a count and checks that that many elements of the given size fit in
+// the rest of the lump
+static uint32_t read_count(node_reader_t *reader, size_t element_size) {
+  uint32_t count = read_next(reader, 4);
+  if (count * element_size > reader->size - reader->offset) {
+    reader->overrun = true;
+    return 0;
+  }
+
+  return count;
+}
+
+// Reads XGLN, XGL2 and XGL3 nodes (and their ZGL* compressed forms). Segs only
+// store their start vertex, since each one ends where the next seg of its
+// subsector starts.
+int read_extended_gl_nodes(gl_map_t *map, const lump_t *lump) {
+  char version = lump->data[3];
+  if (version != 'N' && version != '2' && version != '3') { return 2; }
+
+  node_reader_t reader = {lump->data + 4, lump->size - 4};
+
+  uint8_t *inflated = NULL;
+  if (lump->data[0] == 'Z') {
+    inflated = inflate_nodes(reader.data, reader.size, &reader.size);
+    if (inflated == NULL) { return 3; }
+    reader.data = inflated;
+  }
+
+  // Vertices below num_map_vertices are the map's own, the rest are new
+  uint32_t num_map_vertices = read_next(&reader, 4);
+  map->num_vertices         = read_count(&reader, 8);
+  map->vertices             = malloc(sizeof(vec2_t) * map->num_vertices);
+
+  map->min = (vec2_t){INFINITY, INFINITY};
+  map->max = (vec2_t){-INFINITY, -INFINITY};
+  for (size_t i = 0; i < map->num_vertices; i++) {
+    map->vertices[i].x = (float)(int32_t)read_next(&reader, 4) / (1 << 16);
+    map->vertices[i].y = (float)(int32_t)read_next(&reader, 4) / (1 << 16);
+    update_bounds(map, map->vertices[i]);
   }
+
+  map->num_subsectors = read_count(&reader, 4);
+  map->subsectors     = malloc(sizeof(gl_subsector_t) * map->num_subsectors);
+
+  uint32_t first_seg = 0;
+  for (size_t i = 0; i < map->num_subsectors; i++) {
+    map->subsectors[i].num_segs  = read_next(&reader, 4);
+    map->subsectors[i].first_seg = first_seg;
+    first_seg += map->subsectors[i].num_segs;
+  }
+
+  int linedef_size  = version == 'N' ? 2 : 4;
+  map->num_segments = read_count(&reader, 9 + linedef_size);
+  map->segments     = malloc(sizeof(gl_segment_t) * map->num_segments);
+  if (first_seg != map->num_segments) { reader.overrun = true; }
+
+  for (size_t i = 0; i < map->num_segments && !reader.overrun; i++) {
+    uint32_t vertex = read_next(&reader, 4);
+    read_next(&reader, 4); // partner seg
+    uint32_t linedef = read_next(&reader, linedef_size);
+
+    if (vertex >= num_map_vertices) {
+      vertex = VERT_IS_GL | (vertex - num_map_vertices);
+    }
+
+    map->segments[i] = (gl_segment_t){
+        .start_vertex = vertex,
+        .linedef = linedef_size == 2 ? widen_index(linedef) : linedef,
+        .side    = read_next(&reader, 1),
+    };
+  }
+
+  for (size_t i = 0; i < map->num_subsectors && !reader.overrun; i++) {
+    gl_subsector_t *subsector = &map->subsectors[i];
+    for (uint32_t j = 0; j < subsector->num_segs; j++) {
+      uint32_t next = j + 1 < subsector->num_segs ? j + 1 : 0;
+      map->segments[subsector->first_seg + j].end_vertex =
+          map->segments[subsector->first_seg + next].start_vertex;
+    }
+  }
+
+  // XGL3 stores partition lines as 16.16 fixed point
+  int partition_size = version == '3' ? 4 : 2;
+  map->num_nodes     = read_count(&reader, 4 * partition_size + 24);
+  map->nodes         = malloc(sizeof(gl_node_t) * map->num_nodes);
+
+  for (size_t i = 0; i < map->num_nodes; i++) {
+    gl_node_t *node = &map->nodes[i];
+
+    float partition[4];
+    for (int k = 0; k < 4; k++) {
+      uint32_t value = read_next(&reader, partition_size);
+      partition[k]   = partition_size == 4 ? (int32_t)value / 65536.f
+                                           : (int16_t)value;
+    }
+
+    node->partition       = (vec2_t){partition[0], partition[1]};
+    node->delta_partition = (vec2_t){partition[2], partition[3]};
+
+    for (int k = 0; k < 4; k++) {
+      node->front_bbox[k] = read_next(&reader, 2);
+    }
+    for (int k = 0; k < 4; k++) {
+      node->back_bbox[k] = read_next(&reader, 2);
+    }
+
+    node->front_child_id = read_next(&reader, 4);
+    node->back_child_id  = read_next(&reader, 4);
+  }
+
+  free(inflated);
+  if (reader.overrun) {
+    wad_free_gl_map(map);
+    return 3;
+  }
+
+  return 0;
 }
 
 void wad_free_gl_map(gl_map_t *map) {
-  map->num_vertices = map->num_segments = map->num_subsectors = 0;
   free(map->vertices);
   free(map->segments);
   free(map->subsectors);
+  free(map->nodes);
+  *map = (gl_map_t){0};
 }
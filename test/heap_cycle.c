@@ -0,0 +1,218 @@
+#include "engine.h"
+#include "engine/state.h"
+#include "jobs.h"
+#include "renderer.h"
+#include "wad.h"
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Loads every ExMy map in the WADs in turn, the given number of times over,
+// and fails when a map does not load, when unloading it leaves any of its GL
+// objects behind, or when the heap ends a cycle with a different size than it
+// ended the second one. The first cycle is left out as it may have written
+// the cache that the others read.
+
+#define WIDTH  1280
+#define HEIGHT 800
+
+// The test wraps the allocator of the game's own code at link time, so that
+// what the GL driver and the other libraries keep does not count
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void  __real_free(void *ptr);
+
+// Each block starts with the size that was asked for, in a header that keeps
+// malloc's alignment
+#define HEAP_HEADER_SIZE 16
+
+static size_t heap_bytes;
+
+static void *count_block(size_t *block, size_t size) {
+  if (block == NULL) { return NULL; }
+
+  *block = size;
+  __atomic_add_fetch(&heap_bytes, size, __ATOMIC_RELAXED);
+  return (uint8_t *)block + HEAP_HEADER_SIZE;
+}
+
+static size_t *uncount_block(void *ptr) {
+  size_t *block = (size_t *)((uint8_t *)ptr - HEAP_HEADER_SIZE);
+  __atomic_sub_fetch(&heap_bytes, *block, __ATOMIC_RELAXED);
+  return block;
+}
+
+void *__wrap_malloc(size_t size) {
+  return count_block(__real_malloc(HEAP_HEADER_SIZE + size), size);
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+  if (size > 0 && num > (SIZE_MAX - HEAP_HEADER_SIZE) / size) { return NULL; }
+  return count_block(__real_calloc(1, HEAP_HEADER_SIZE + num * size),
+                     num * size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  if (ptr == NULL) { return __wrap_malloc(size); }
+
+  size_t *block    = (size_t *)((uint8_t *)ptr - HEAP_HEADER_SIZE);
+  size_t  old_size = *block;
+  block            = __real_realloc(block, HEAP_HEADER_SIZE + size);
+  if (block == NULL) { return NULL; }
+
+  __atomic_sub_fetch(&heap_bytes, old_size, __ATOMIC_RELAXED);
+  return count_block(block, size);
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr) { __real_free(uncount_block(ptr)); }
+}
+
+// Allocates inside libc, so it has to hand out a counted block too
+char *__wrap_strndup(const char *str, size_t size) {
+  size_t length = strnlen(str, size);
+  char  *copy   = __wrap_malloc(length + 1);
+  if (copy) {
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+  }
+  return copy;
+}
+
+// The names of the GL objects a level owns, taken while it is loaded
+typedef struct level_objects {
+  GLuint vertex_array, buffers[2], textures[3];
+} level_objects_t;
+
+static level_objects_t get_level_objects() {
+  return (level_objects_t){
+      .vertex_array = level_mesh.vao,
+      .buffers      = {level_mesh.vbo, level_mesh.ebo},
+      .textures     = {palette_texture, flat_texture_array, wall_texture_array},
+  };
+}
+
+// Returns how many of the objects GL still knows
+static int count_live_objects(const level_objects_t *objects) {
+  int count = glIsVertexArray(objects->vertex_array) ? 1 : 0;
+  for (int i = 0; i < 2; i++) {
+    if (glIsBuffer(objects->buffers[i])) { count++; }
+  }
+  for (int i = 0; i < 3; i++) {
+    if (glIsTexture(objects->textures[i])) { count++; }
+  }
+  return count;
+}
+
+static int cycle_maps(const wad_t *wad, const char *cache_dir,
+                      int num_cycles) {
+  size_t base_bytes = 0;
+  for (int cycle = 0; cycle < num_cycles; cycle++) {
+    for (int episode = 1; episode <= 4; episode++) {
+      for (int mission = 1; mission <= 9; mission++) {
+        char mapname[8];
+        snprintf(mapname, sizeof mapname, "E%dM%d", episode, mission);
+        if (wad_find_lump(mapname, wad) < 0) { continue; }
+
+        engine_load(wad, mapname, cache_dir);
+        if (engine_init() != 0) {
+          engine_unload();
+          return 1;
+        }
+
+        // One frame, for what drawing allocates
+        renderer_clear();
+        engine_render();
+
+        level_objects_t objects = get_level_objects();
+        engine_unload();
+
+        int num_live = count_live_objects(&objects);
+        if (num_live > 0) {
+          fprintf(stderr, "Unloading %s left %d GL objects behind\n", mapname,
+                  num_live);
+          return 1;
+        }
+      }
+    }
+
+    size_t bytes = __atomic_load_n(&heap_bytes, __ATOMIC_RELAXED);
+    printf("Cycle %d: %zu bytes on the heap\n", cycle + 1, bytes);
+    if (cycle == 1) { base_bytes = bytes; }
+
+    if (cycle > 1 && bytes != base_bytes) {
+      fprintf(stderr, "Map cycle %d left %+td bytes on the heap\n", cycle + 1,
+              (ptrdiff_t)(bytes - base_bytes));
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  // Takes the game's options, less -gpucull, and the number of cycles
+  int          num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int          num_cycles  = 1;
+  const char  *cache_dir   = NULL;
+  const char **wad_files   = malloc(sizeof(char *) * argc);
+  int          num_files   = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      num_threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc) {
+      cache_dir = argv[++i];
+    } else if (strcmp(argv[i], "-cycle") == 0 && i + 1 < argc) {
+      num_cycles = atoi(argv[++i]);
+    } else {
+      wad_files[num_files++] = argv[i];
+    }
+  }
+
+  if (num_files == 0) { wad_files[num_files++] = "doom1.wad"; }
+
+  wad_t wad;
+  if (wad_map_stack(wad_files, num_files, &wad) != 0) {
+    fprintf(stderr, "Failed to load WAD files\n");
+    free(wad_files);
+    return 2;
+  }
+  free(wad_files);
+
+  if (glfwInit() != GLFW_TRUE) {
+    fprintf(stderr, "Failed to initalize GLFW\n");
+    wad_free(&wad);
+    return 1;
+  }
+
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_STENCIL_BITS, 0);
+  GLFWwindow *window = glfwCreateWindow(WIDTH, HEIGHT, "DooM", NULL, NULL);
+  glfwMakeContextCurrent(window);
+
+  if (window == NULL || glewInit() != GLEW_OK) {
+    fprintf(stderr, "Failed to create a GL context\n");
+    glfwTerminate();
+    wad_free(&wad);
+    return 1;
+  }
+
+  jobs_init(num_threads);
+  renderer_init(WIDTH, HEIGHT);
+
+  int ret_code = cycle_maps(&wad, cache_dir, num_cycles);
+
+  jobs_shutdown();
+  glfwTerminate();
+  wad_free(&wad);
+  return ret_code;
+}